@@ -0,0 +1,167 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+// Encoding of values in the MRD binary format, shared by the tools that read or write streams without
+// the generated serializers. Unsigned integers are varints (7 bits per byte, least significant first),
+// signed integers are zigzag-encoded varints, floating point values are stored raw, optionals are a
+// presence byte followed by the value, and vectors and strings are a varint size followed by the values.
+// Arrays are their shape followed by their elements, which are varints for integer element types.
+
+inline int64_t zigzag_decode(uint64_t value)
+{
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+inline uint64_t zigzag_encode(int64_t value)
+{
+    return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+// Appends the varint encoding of value to out.
+inline void append_varint(std::string &out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out.push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+// Writes the varint encoding of value to os.
+inline void write_varint(std::ostream &os, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        os.put(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    os.put(static_cast<char>(value));
+}
+
+// Decodes and skips values for a byte source Source, which derives from BinaryDecoder<Source> and provides
+//   uint8_t Byte();                         the next byte
+//   void Raw(void *values, size_t bytes);   the next bytes, copied to values
+//   void Skip(uint64_t bytes);
+//   uint64_t Offset() const;                the position in the stream, for error messages
+// Source may also provide a faster SkipVarints(uint64_t count).
+template <typename Source>
+class BinaryDecoder
+{
+public:
+    uint64_t Varint()
+    {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7)
+        {
+            uint8_t b = Self().Byte();
+            value |= static_cast<uint64_t>(b & 0x7F) << shift;
+            if (!(b & 0x80))
+            {
+                return value;
+            }
+        }
+        throw std::runtime_error("Malformed integer in MRD stream at offset " + std::to_string(Self().Offset()));
+    }
+
+    int64_t Zigzag()
+    {
+        return zigzag_decode(Varint());
+    }
+
+    std::optional<uint32_t> OptionalVarint()
+    {
+        if (!Self().Byte())
+        {
+            return std::nullopt;
+        }
+        return static_cast<uint32_t>(Varint());
+    }
+
+    void SkipVarints(uint64_t count)
+    {
+        for (uint64_t i = 0; i < count; i++)
+        {
+            Varint();
+        }
+    }
+
+    void SkipVarintVector()
+    {
+        Self().SkipVarints(Varint());
+    }
+
+    // Skips a vector or string of values of item_size bytes each.
+    void SkipVector(size_t item_size)
+    {
+        Self().Skip(Varint() * item_size);
+    }
+
+    template <size_t N>
+    std::array<size_t, N> ArrayShape()
+    {
+        std::array<size_t, N> shape;
+        for (auto &s : shape)
+        {
+            s = Varint();
+        }
+        return shape;
+    }
+
+    // Reads count values of type T, as stored in arrays and fixed-size vectors.
+    template <typename T>
+    void Values(T *values, size_t count)
+    {
+        if constexpr (std::is_integral_v<T>)
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                values[i] = static_cast<T>(std::is_signed_v<T> ? Zigzag() : static_cast<int64_t>(Varint()));
+            }
+        }
+        else
+        {
+            Self().Raw(values, count * sizeof(T));
+        }
+    }
+
+    // Skips count values of type T, as stored in arrays and fixed-size vectors.
+    template <typename T>
+    void SkipValues(uint64_t count)
+    {
+        if constexpr (std::is_integral_v<T>)
+        {
+            Self().SkipVarints(count);
+        }
+        else
+        {
+            Self().Skip(count * sizeof(T));
+        }
+    }
+
+    // Skips an array of rank N with elements of type T.
+    template <typename T, size_t N>
+    void SkipArray()
+    {
+        uint64_t elements = 1;
+        for (auto s : ArrayShape<N>())
+        {
+            elements *= s;
+        }
+        SkipValues<T>(elements);
+    }
+
+private:
+    Source &Self()
+    {
+        return static_cast<Source &>(*this);
+    }
+};
@@ -0,0 +1,351 @@
+#include "binary_stream_scanner.h"
+#include "generated/binary/protocols.h"
+#include <algorithm>
+#include <complex>
+#include <sstream>
+#include <stdexcept>
+#include <streambuf>
+
+namespace
+{
+    constexpr size_t kScanBufferSize = 1 << 20;
+    constexpr size_t kRecordChunkSize = 64 << 10;
+
+    // Reads up to size bytes from in and returns how many were read. If on_wait is set, only the first byte
+    // is waited for, and on_wait is called before waiting.
+    size_t read_input(std::istream &in, char *data, size_t size, const std::function<void()> &on_wait)
+    {
+        if (!on_wait)
+        {
+            in.read(data, size);
+            return in.gcount();
+        }
+
+        if (in.rdbuf()->in_avail() <= 0)
+        {
+            on_wait();
+        }
+        if (!in.read(data, 1))
+        {
+            return 0;
+        }
+        return 1 + in.readsome(data + 1, size - 1);
+    }
+
+    // Input buffer that keeps a copy of everything read through it, so that the bytes consumed
+    // by the generated reader while reading the header can be scanned again afterwards.
+    class RecordingBuffer : public std::streambuf
+    {
+    public:
+        RecordingBuffer(std::istream &in, const std::function<void()> &on_wait)
+            : in_(in), on_wait_(on_wait)
+        {
+        }
+
+        std::string &Recorded()
+        {
+            return recorded_;
+        }
+
+    protected:
+        int_type underflow() override
+        {
+            if (gptr() < egptr())
+            {
+                return traits_type::to_int_type(*gptr());
+            }
+
+            auto size = recorded_.size();
+            recorded_.resize(size + kRecordChunkSize);
+            recorded_.resize(size + read_input(in_, &recorded_[size], kRecordChunkSize, on_wait_));
+            if (recorded_.size() == size)
+            {
+                return traits_type::eof();
+            }
+
+            setg(recorded_.data(), recorded_.data() + size, recorded_.data() + recorded_.size());
+            return traits_type::to_int_type(*gptr());
+        }
+
+    private:
+        std::istream &in_;
+        const std::function<void()> &on_wait_;
+        std::string recorded_;
+    };
+}
+
+BinaryStreamScanner::BinaryStreamScanner(std::istream &in, std::ostream *copy, std::function<void()> on_wait)
+    : in_(in), copy_(copy), on_wait_(std::move(on_wait))
+{
+    RecordingBuffer recording(in_, on_wait_);
+    std::istream recorded_in(&recording);
+    {
+        mrd::binary::MrdReader r(recorded_in);
+        r.ReadHeader(header_);
+    }
+
+    // The encoding is canonical, so the preamble is as long as its re-encoding.
+    auto preamble = serialize_stream_preamble(header_);
+    auto &recorded = recording.Recorded();
+    if (recorded.compare(0, preamble.size(), preamble) != 0)
+    {
+        throw std::runtime_error("Unexpected encoding of the MRD stream header");
+    }
+
+    header_size_ = preamble.size();
+    buffer_.assign(recorded.begin(), recorded.end());
+    pos_ = header_size_;
+    end_ = buffer_.size();
+}
+
+bool BinaryStreamScanner::Next(StreamIndexEntry &entry, std::string *bytes)
+{
+    if (at_end_)
+    {
+        return false;
+    }
+
+    while (items_left_in_block_ == 0)
+    {
+        items_left_in_block_ = Varint();
+        if (items_left_in_block_ == 0)
+        {
+            at_end_ = true;
+            if (copy_)
+            {
+                copy_->write(buffer_.data(), end_);
+                *copy_ << std::flush;
+            }
+            return false;
+        }
+    }
+
+    capture_ = bytes;
+    capture_start_ = pos_;
+
+    entry = StreamIndexEntry();
+    entry.offset = buffer_offset_ + pos_;
+    entry.type_index = static_cast<uint32_t>(Varint());
+    switch (entry.type_index)
+    {
+    case 0:
+        ScanAcquisition(entry);
+        break;
+    case 1:
+        ScanWaveform(entry);
+        break;
+    case 2:
+        ScanImage<uint16_t>(entry);
+        break;
+    case 3:
+        ScanImage<int16_t>(entry);
+        break;
+    case 4:
+        ScanImage<uint32_t>(entry);
+        break;
+    case 5:
+        ScanImage<int32_t>(entry);
+        break;
+    case 6:
+        ScanImage<float>(entry);
+        break;
+    case 7:
+        ScanImage<double>(entry);
+        break;
+    case 8:
+        ScanImage<std::complex<float>>(entry);
+        break;
+    case 9:
+        ScanImage<std::complex<double>>(entry);
+        break;
+    default:
+        throw std::runtime_error("Unknown item type " + std::to_string(entry.type_index) + " at offset " + std::to_string(entry.offset));
+    }
+
+    entry.size = buffer_offset_ + pos_ - entry.offset;
+    if (capture_)
+    {
+        capture_->append(buffer_.data() + capture_start_, pos_ - capture_start_);
+        capture_ = nullptr;
+    }
+    items_left_in_block_--;
+    return true;
+}
+
+void BinaryStreamScanner::Fill()
+{
+    if (copy_)
+    {
+        copy_->write(buffer_.data(), end_);
+    }
+    if (capture_)
+    {
+        capture_->append(buffer_.data() + capture_start_, end_ - capture_start_);
+        capture_start_ = 0;
+    }
+
+    buffer_offset_ += end_;
+    buffer_.resize(kScanBufferSize);
+    pos_ = 0;
+    end_ = read_input(in_, buffer_.data(), buffer_.size(), on_wait_);
+    if (end_ == 0)
+    {
+        throw std::runtime_error("Unexpected end of MRD stream at offset " + std::to_string(buffer_offset_));
+    }
+}
+
+uint8_t BinaryStreamScanner::Byte()
+{
+    if (pos_ == end_)
+    {
+        Fill();
+    }
+    return static_cast<uint8_t>(buffer_[pos_++]);
+}
+
+void BinaryStreamScanner::Skip(uint64_t bytes)
+{
+    while (bytes > 0)
+    {
+        if (pos_ == end_)
+        {
+            // Large payloads of seekable inputs are skipped without reading them.
+            if (!copy_ && !capture_ && bytes > kScanBufferSize)
+            {
+                if (in_.seekg(bytes, std::ios::cur))
+                {
+                    buffer_offset_ += end_ + bytes;
+                    pos_ = end_ = 0;
+                    return;
+                }
+                in_.clear();
+            }
+            Fill();
+        }
+
+        auto n = std::min<uint64_t>(bytes, end_ - pos_);
+        pos_ += n;
+        bytes -= n;
+    }
+}
+
+void BinaryStreamScanner::SkipVarints(uint64_t count)
+{
+    // Every varint ends with a byte that does not have the continuation bit set.
+    while (count > 0)
+    {
+        if (pos_ == end_)
+        {
+            Fill();
+        }
+        for (; pos_ < end_ && count > 0; pos_++)
+        {
+            count -= !(buffer_[pos_] & 0x80);
+        }
+    }
+}
+
+void BinaryStreamScanner::ScanAcquisition(StreamIndexEntry &entry)
+{
+    entry.flags = Varint();
+
+    // The optional counters of mrd::EncodingCounters are in the order of IndexCounter.
+    for (auto &counter : entry.counters)
+    {
+        counter = OptionalVarint().value_or(kNoCounter);
+    }
+    SkipVarintVector(); // idx.user
+
+    SkipVarints(1);   // measurement_uid
+    OptionalVarint(); // scan_counter
+    entry.time_stamp = OptionalVarint().value_or(kNoCounter);
+    SkipVarintVector(); // physiology_time_stamp
+    SkipVarintVector(); // channel_order
+    for (int i = 0; i < 4; i++)
+    {
+        OptionalVarint(); // discard_pre, discard_post, center_sample, encoding_space_ref
+    }
+    if (Byte())
+    {
+        Skip(sizeof(float)); // sample_time_us
+    }
+    Skip(5 * 3 * sizeof(float));         // position, read_dir, phase_dir, slice_dir, patient_table_position
+    SkipVarintVector();                  // user_int
+    SkipVector(sizeof(float));           // user_float
+    SkipArray<std::complex<float>, 2>(); // data
+    SkipArray<float, 2>();               // trajectory
+}
+
+void BinaryStreamScanner::ScanWaveform(StreamIndexEntry &entry)
+{
+    entry.flags = Varint();
+    SkipVarints(2); // measurement_uid, scan_counter
+    entry.time_stamp = static_cast<uint32_t>(Varint());
+    Skip(sizeof(float)); // sample_time_us
+    SkipVarints(1);      // waveform_id
+    SkipArray<uint32_t, 2>(); // data
+}
+
+template <typename T>
+void BinaryStreamScanner::ScanImage(StreamIndexEntry &entry)
+{
+    entry.flags = Varint();
+    SkipVarints(1);              // measurement_uid
+    Skip(6 * 3 * sizeof(float)); // field_of_view, position, col_dir, line_dir, slice_dir, patient_table_position
+    for (auto counter : {kAverage, kSlice, kContrast, kPhase, kRepetition, kSet})
+    {
+        entry.counters[counter] = OptionalVarint().value_or(kNoCounter);
+    }
+    entry.time_stamp = OptionalVarint().value_or(kNoCounter);
+    SkipVarints(3);            // physiology_time_stamp
+    SkipVarints(1);            // image_type
+    OptionalVarint();          // image_index
+    OptionalVarint();          // image_series_index
+    SkipVarintVector();        // user_int
+    SkipVector(sizeof(float)); // user_float
+    SkipArray<T, 4>();         // data
+
+    ScanMeta();
+}
+
+void BinaryStreamScanner::ScanMeta()
+{
+    auto count = Varint();
+    for (uint64_t i = 0; i < count; i++)
+    {
+        SkipVector(1); // name
+        auto values = Varint();
+        for (uint64_t j = 0; j < values; j++)
+        {
+            SkipVector(1);
+        }
+    }
+}
+
+std::string serialize_stream_preamble(const std::optional<mrd::Header> &header)
+{
+    std::ostringstream os;
+    {
+        mrd::binary::MrdWriter w(os);
+        w.WriteHeader(header);
+        w.EndData();
+    }
+
+    // Drop the end of stream marker written by EndData.
+    auto preamble = os.str();
+    preamble.pop_back();
+    return preamble;
+}
+
+StreamIndex index_binary_stream(std::istream &in, std::ostream *copy)
+{
+    BinaryStreamScanner scanner(in, copy);
+    StreamIndex index;
+    index.header_size = scanner.HeaderSize();
+    StreamIndexEntry entry;
+    while (scanner.Next(entry))
+    {
+        index.entries.push_back(entry);
+    }
+    return index;
+}
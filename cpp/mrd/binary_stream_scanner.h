@@ -0,0 +1,85 @@
+#pragma once
+
+#include "binary_format.h"
+#include "generated/types.h"
+#include "stream_index.h"
+#include <cstdint>
+#include <functional>
+#include <istream>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Walks the items of an MRD binary stream, reading the type, flags, encoding counters and time stamp
+// of each item and skipping over its payload without decoding it. This is what makes indexing run
+// at the speed of the input rather than at the speed of the deserializer.
+
+class BinaryStreamScanner : private BinaryDecoder<BinaryStreamScanner>
+{
+public:
+    // If copy is not null, every byte read from in is also written to it, so the scanner can sit in a pipeline.
+    // If on_wait is set, the scanner reads only what in has available instead of filling its buffer, so that
+    // the items of a live stream are scanned as they arrive, and calls on_wait before waiting for more input.
+    // Reads the stream preamble and header. Throws std::runtime_error if the stream is malformed.
+    BinaryStreamScanner(std::istream &in, std::ostream *copy = nullptr, std::function<void()> on_wait = nullptr);
+
+    const std::optional<mrd::Header> &Header() const
+    {
+        return header_;
+    }
+
+    // Size of the preamble (format header, schema and MRD header) preceding the items.
+    uint64_t HeaderSize() const
+    {
+        return header_size_;
+    }
+
+    // Scans the next item and fills in its index entry, including its byte offset and size.
+    // If bytes is not null, the encoded item is appended to it. Returns false at the end of the stream.
+    bool Next(StreamIndexEntry &entry, std::string *bytes = nullptr);
+
+private:
+    friend class BinaryDecoder<BinaryStreamScanner>;
+
+    void Fill();
+    uint8_t Byte();
+    void Skip(uint64_t bytes);
+    void SkipVarints(uint64_t count);
+    uint64_t Offset() const
+    {
+        return buffer_offset_ + pos_;
+    }
+
+    void ScanAcquisition(StreamIndexEntry &entry);
+    void ScanWaveform(StreamIndexEntry &entry);
+    template <typename T>
+    void ScanImage(StreamIndexEntry &entry);
+    void ScanMeta();
+
+    std::istream &in_;
+    std::ostream *copy_;
+    std::function<void()> on_wait_;
+    std::optional<mrd::Header> header_;
+    uint64_t header_size_ = 0;
+
+    // buffer_ holds the bytes [buffer_offset_, buffer_offset_ + end_) of the stream.
+    std::vector<char> buffer_;
+    size_t pos_ = 0;
+    size_t end_ = 0;
+    uint64_t buffer_offset_ = 0;
+
+    // Where the encoded item is appended while it is scanned, and the start of its part in buffer_.
+    std::string *capture_ = nullptr;
+    size_t capture_start_ = 0;
+
+    uint64_t items_left_in_block_ = 0;
+    bool at_end_ = false;
+};
+
+// Returns the binary encoding of the format header, schema and MRD header that start a stream,
+// as the generated writer produces it.
+std::string serialize_stream_preamble(const std::optional<mrd::Header> &header);
+
+// Scans a whole stream and returns its index. Offsets are relative to the current position of in.
+StreamIndex index_binary_stream(std::istream &in, std::ostream *copy = nullptr);
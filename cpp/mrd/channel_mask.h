@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+// Conversion between ISMRMRD channel masks (one bit per receiver channel, 64 channels per word)
+// and MRD channel_order (the channel number of each row of mrd::Acquisition::data).
+
+// Appends the numbers of the channels set in mask to channel_order in increasing order.
+template <size_t N>
+void channel_order_from_mask(const uint64_t (&mask)[N], std::vector<uint32_t> &channel_order)
+{
+    for (size_t w = 0; w < N; w++)
+    {
+        uint64_t word = mask[w];
+        while (word)
+        {
+            channel_order.push_back(static_cast<uint32_t>(w * 64 + __builtin_ctzll(word)));
+            word &= word - 1;
+        }
+    }
+}
+
+// Returns whether channel_order gives the channel of each of the rows of data. An empty channel_order
+// (no channel mask set) means that the rows are channels 0 to rows - 1.
+inline bool channel_order_matches(const std::vector<uint32_t> &channel_order, size_t rows)
+{
+    return channel_order.empty() || channel_order.size() == rows;
+}
+
+// Sets the bits of the channels in channel_order in mask.
+template <size_t N>
+void channel_mask_from_order(const std::vector<uint32_t> &channel_order, uint64_t (&mask)[N])
+{
+    for (auto c : channel_order)
+    {
+        if (c >= N * 64)
+        {
+            throw std::runtime_error("Channel number too large for channel mask");
+        }
+        mask[c / 64] |= uint64_t(1) << (c % 64);
+    }
+}
+
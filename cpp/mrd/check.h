@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+// Expectations shared by the *_check programs that run under CTest. A check program calls expect for
+// each condition and exits with status 1 if any of them failed.
+
+namespace check
+{
+    // Number of expectations that failed so far.
+    inline int failures = 0;
+
+    // Results of benchmarked calls are summed here so that they are not optimized away.
+    inline volatile size_t benchmark_sink = 0;
+
+    inline void expect(bool condition, const std::string &what)
+    {
+        if (!condition)
+        {
+            std::cerr << "FAILED: " << what << std::endl;
+            failures++;
+        }
+    }
+
+    // Returns true if f throws std::runtime_error.
+    template <typename F>
+    bool throws(F f)
+    {
+        try
+        {
+            f();
+        }
+        catch (const std::runtime_error &)
+        {
+            return true;
+        }
+        return false;
+    }
+}
@@ -0,0 +1,197 @@
+#include "date_time.h"
+#include <charconv>
+#include <chrono>
+#include <stdexcept>
+
+namespace
+{
+    // Parses exactly the characters in [first, last) as an unsigned decimal number.
+    bool parse_fixed(const char *first, const char *last, unsigned &value)
+    {
+        auto [ptr, ec] = std::from_chars(first, last, value);
+        return ec == std::errc() && ptr == last;
+    }
+
+    // Parses min_digits to max_digits decimal digits at s[pos] and advances pos past them.
+    bool parse_field(std::string_view s, size_t &pos, size_t min_digits, size_t max_digits, unsigned &value)
+    {
+        size_t end = pos;
+        while (end < s.size() && end - pos < max_digits && s[end] >= '0' && s[end] <= '9')
+        {
+            end++;
+        }
+        if (end - pos < min_digits || !parse_fixed(s.data() + pos, s.data() + end, value))
+        {
+            return false;
+        }
+        pos = end;
+        return true;
+    }
+
+    bool parse_separator(std::string_view s, size_t &pos, char separator)
+    {
+        if (pos >= s.size() || s[pos] != separator)
+        {
+            return false;
+        }
+        pos++;
+        return true;
+    }
+
+    // Checks that the rest of s, if any, is an ISO 8601 time zone designator: Z or +HH:MM/-HH:MM.
+    bool is_time_zone(std::string_view s)
+    {
+        if (s.empty() || s == "Z")
+        {
+            return true;
+        }
+
+        size_t pos = 1;
+        unsigned h, m;
+        return (s[0] == '+' || s[0] == '-') &&
+               parse_field(s, pos, 2, 2, h) && parse_separator(s, pos, ':') && parse_field(s, pos, 2, 2, m) &&
+               pos == s.size() && h <= 14 && m <= 59;
+    }
+
+    // Writes value as a zero padded decimal number with exactly width digits.
+    char *format_fixed(char *out, uint64_t value, size_t width)
+    {
+        for (size_t i = width; i > 0; i--)
+        {
+            out[i - 1] = static_cast<char>('0' + value % 10);
+            value /= 10;
+        }
+        return out + width;
+    }
+
+    bool is_leap_year(unsigned y)
+    {
+        return (y % 4 == 0 && y % 100 != 0) || y % 400 == 0;
+    }
+
+    unsigned days_in_month(unsigned y, unsigned m)
+    {
+        static constexpr unsigned days[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+        return m == 2 && is_leap_year(y) ? 29 : days[m - 1];
+    }
+
+    // Number of fractional second digits date::format writes for yardl::Time.
+    constexpr size_t fractional_digits()
+    {
+        size_t digits = 0;
+        for (auto den = yardl::Time::period::den; den > 1; den /= 10)
+        {
+            digits++;
+        }
+        return digits;
+    }
+
+    constexpr uint64_t pow10(size_t n)
+    {
+        return n == 0 ? 1 : 10 * pow10(n - 1);
+    }
+
+    static_assert(yardl::Time::period::num == 1 && pow10(fractional_digits()) == yardl::Time::period::den,
+                  "yardl::Time must have a decimal sub-second precision");
+}
+
+yardl::Date date_from_string(std::string_view s)
+{
+    size_t pos = 0;
+    unsigned y, m, d;
+    if (!parse_field(s, pos, 4, 4, y) || !parse_separator(s, pos, '-') ||
+        !parse_field(s, pos, 1, 2, m) || !parse_separator(s, pos, '-') ||
+        !parse_field(s, pos, 1, 2, d) || !is_time_zone(s.substr(pos)) ||
+        m < 1 || m > 12 || d < 1 || d > days_in_month(y, m))
+    {
+        throw std::runtime_error("invalid date format");
+    }
+
+    return yardl::Date(date::local_days(date::year(y) / date::month(m) / date::day(d)));
+}
+
+yardl::Time time_from_string(std::string_view s)
+{
+    size_t pos = 0;
+    unsigned h, m, sec;
+    if (!parse_field(s, pos, 1, 2, h) || !parse_separator(s, pos, ':') ||
+        !parse_field(s, pos, 1, 2, m) || !parse_separator(s, pos, ':') ||
+        !parse_field(s, pos, 1, 2, sec) ||
+        h > 23 || m > 59 || sec > 59)
+    {
+        throw std::runtime_error("invalid time format");
+    }
+
+    std::chrono::nanoseconds fraction{0};
+    if (pos < s.size() && s[pos] == '.')
+    {
+        // Fractional seconds: a decimal point followed by 1 to 9 digits.
+        auto start = ++pos;
+        unsigned ns;
+        if (!parse_field(s, pos, 1, 9, ns) || (pos < s.size() && s[pos] >= '0' && s[pos] <= '9'))
+        {
+            throw std::runtime_error("invalid time format");
+        }
+        fraction = std::chrono::nanoseconds(ns * pow10(9 - (pos - start)));
+    }
+
+    if (!is_time_zone(s.substr(pos)))
+    {
+        throw std::runtime_error("invalid time format");
+    }
+
+    return std::chrono::duration_cast<yardl::Time>(std::chrono::hours(h) + std::chrono::minutes(m) + std::chrono::seconds(sec) + fraction);
+}
+
+size_t format_date(const yardl::Date &d, char *buffer)
+{
+    date::year_month_day ymd{d};
+    int y = static_cast<int>(ymd.year());
+    if (y < 0 || y > 9999)
+    {
+        throw std::runtime_error("date out of range");
+    }
+
+    char *out = format_fixed(buffer, y, 4);
+    *out++ = '-';
+    out = format_fixed(out, static_cast<unsigned>(ymd.month()), 2);
+    *out++ = '-';
+    out = format_fixed(out, static_cast<unsigned>(ymd.day()), 2);
+    return out - buffer;
+}
+
+size_t format_time(const yardl::Time &t, char *buffer)
+{
+    if (t < yardl::Time::zero() || t >= std::chrono::hours(24))
+    {
+        throw std::runtime_error("time out of range");
+    }
+
+    uint64_t ticks = t.count();
+    uint64_t ticks_per_second = pow10(fractional_digits());
+    uint64_t seconds = ticks / ticks_per_second;
+
+    char *out = format_fixed(buffer, seconds / 3600, 2);
+    *out++ = ':';
+    out = format_fixed(out, (seconds / 60) % 60, 2);
+    *out++ = ':';
+    out = format_fixed(out, seconds % 60, 2);
+    if constexpr (fractional_digits() > 0)
+    {
+        *out++ = '.';
+        out = format_fixed(out, ticks % ticks_per_second, fractional_digits());
+    }
+    return out - buffer;
+}
+
+std::string date_to_string(const yardl::Date &d)
+{
+    char buffer[kMaxDateStringLength];
+    return std::string(buffer, format_date(d, buffer));
+}
+
+std::string time_to_string(const yardl::Time &t)
+{
+    char buffer[kMaxTimeStringLength];
+    return std::string(buffer, format_time(t, buffer));
+}
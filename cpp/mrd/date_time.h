@@ -0,0 +1,39 @@
+#pragma once
+
+#include "generated/types.h"
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// Fixed-format ISO 8601 date and time conversion used by the header converters.
+// These avoid std::stringstream and date::parse/date::format, which take 1 to 3 us per call,
+// 20 to 60 times as long as these (date_time_check --benchmark).
+
+// Maximum number of characters written by format_date and format_time.
+constexpr size_t kMaxDateStringLength = 10;     // YYYY-MM-DD
+constexpr size_t kMaxTimeStringLength = 8 + 19; // HH:MM:SS.fffffffff plus room for finer precisions
+
+// Parses a date in the format YYYY-MM-DD (date::parse "%F"). As with date::parse, the month and day
+// may have a single digit. A time zone designator (Z, +HH:MM or -HH:MM) is accepted and ignored,
+// since yardl::Date has no time zone.
+// Throws std::runtime_error if the string is not a valid date.
+yardl::Date date_from_string(std::string_view s);
+
+// Parses a time in the format HH:MM:SS with optional fractional seconds (date::parse "%T"). As with
+// date::parse, each field may have a single digit. A time zone designator (Z, +HH:MM or -HH:MM),
+// which xs:time allows in ISMRMRD headers, is accepted and ignored, since yardl::Time is a time of
+// day without a time zone.
+// Throws std::runtime_error if the string is not a valid time of day.
+yardl::Time time_from_string(std::string_view s);
+
+// Writes the date as YYYY-MM-DD to buffer and returns the number of characters written.
+// The buffer must hold at least kMaxDateStringLength characters.
+size_t format_date(const yardl::Date &d, char *buffer);
+
+// Writes the time as HH:MM:SS, followed by fractional seconds at the precision of yardl::Time
+// (as date::format "%T" does), and returns the number of characters written.
+// The buffer must hold at least kMaxTimeStringLength characters.
+size_t format_time(const yardl::Time &t, char *buffer);
+
+std::string date_to_string(const yardl::Date &d);
+std::string time_to_string(const yardl::Time &t);
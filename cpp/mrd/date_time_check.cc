@@ -0,0 +1,180 @@
+#include "date_time.h"
+#include "check.h"
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Checks the fixed-format date and time conversion against the date::parse/date::format
+// implementation it replaced, and with --benchmark, compares their speed.
+
+namespace
+{
+    // The stringstream based conversion used before date_time.h.
+    yardl::Date reference_date_from_string(const std::string &s)
+    {
+        std::stringstream ss{s};
+        yardl::Date d;
+        ss >> date::parse("%F", d);
+        if (ss.fail())
+        {
+            throw std::runtime_error("invalid date format");
+        }
+        return d;
+    }
+
+    yardl::Time reference_time_from_string(const std::string &s)
+    {
+        std::stringstream ss{s};
+        yardl::Time t;
+        ss >> date::parse("%T", t);
+        if (ss.fail())
+        {
+            throw std::runtime_error("invalid time format");
+        }
+        return t;
+    }
+
+    std::string reference_date_to_string(const yardl::Date &d)
+    {
+        std::stringstream ss;
+        ss << date::format("%F", d);
+        return ss.str();
+    }
+
+    std::string reference_time_to_string(const yardl::Time &t)
+    {
+        std::stringstream ss;
+        ss << date::format("%T", t);
+        return ss.str();
+    }
+
+    using check::expect;
+    using check::throws;
+
+    void check_valid()
+    {
+        for (std::string s : {"2023-01-01", "2023-02-28", "2024-02-29", "2000-02-29", "1999-12-31", "0001-01-01", "9999-12-31"})
+        {
+            expect(date_from_string(s) == reference_date_from_string(s), "date_from_string(\"" + s + "\") matches date::parse");
+            expect(date_to_string(date_from_string(s)) == s, "date \"" + s + "\" roundtrips");
+            expect(date_to_string(date_from_string(s)) == reference_date_to_string(date_from_string(s)), "date_to_string(\"" + s + "\") matches date::format");
+        }
+
+        for (std::string s : {"00:00:00", "23:59:59", "12:34:56", "12:34:56.5", "12:34:56.123456789", "07:08:09.000001"})
+        {
+            expect(time_from_string(s) == reference_time_from_string(s), "time_from_string(\"" + s + "\") matches date::parse");
+            expect(time_to_string(time_from_string(s)) == reference_time_to_string(time_from_string(s)), "time_to_string(\"" + s + "\") matches date::format");
+        }
+
+        // Fields without zero padding and time zone designators, which date::parse also accepts.
+        // The time zone is ignored.
+        for (std::string s : {"2023-1-01", "2023-01-1", "2023-1-5", "2023-01-01Z", "2023-12-31+01:00", "2024-2-29-05:30"})
+        {
+            expect(date_from_string(s) == reference_date_from_string(s), "date_from_string(\"" + s + "\") matches date::parse");
+        }
+
+        for (std::string s : {"1:00:00", "12:0:00", "12:00:5", "1:2:3.25", "12:00:00Z", "12:00:00+01:00", "12:34:56.5-05:00",
+                              "23:59:59.123456789+14:00", "00:00:00-00:00"})
+        {
+            expect(time_from_string(s) == reference_time_from_string(s), "time_from_string(\"" + s + "\") matches date::parse");
+        }
+    }
+
+    void check_rejected()
+    {
+        for (std::string s : {"", "2023-02-29", "1900-02-29", "2023-13-01", "2023-00-10", "2023-04-31", "2023-01-00",
+                              "2023-001-01", "2023-01-001", "23-01-01", "2023/01/01", "2023-01-01T00:00:00", " 2023-01-01",
+                              "2023-01-01 ", "+023-01-01", "-023-01-01", "2023-0a-01", "2023-01-01z", "2023-01-01+0100"})
+        {
+            expect(throws([&]
+                          { date_from_string(s); }),
+                   "date_from_string(\"" + s + "\") throws");
+        }
+
+        for (std::string s : {"", "24:00:00", "12:60:00", "12:00:60", "123:00:00", "12:000:00", "12-00-00", "12:00:00.",
+                              "12:00:00.1234567890", "12:00:00,5", "12:00:00.5s", "12:00:00.-1", "12:00:00.+1",
+                              " 12:00:00", "12:00:00 ", "+1:00:00", "12:00", "12:00:00z", "12:00:00Z ", "12:00:00.Z",
+                              "12:00:00+01", "12:00:00+1:00", "12:00:00+0100", "12:00:00+15:00", "12:00:00+01:60", "12:00:00UTC"})
+        {
+            expect(throws([&]
+                          { time_from_string(s); }),
+                   "time_from_string(\"" + s + "\") throws");
+        }
+
+        expect(throws([]
+                      { time_to_string(std::chrono::hours(24)); }),
+               "time_to_string(24h) throws");
+        expect(throws([]
+                      { time_to_string(-std::chrono::seconds(1)); }),
+               "time_to_string(-1s) throws");
+    }
+
+    // Runs f on each input repeatedly, and returns the average time per call in ns.
+    template <typename F>
+    double time_per_call(const std::vector<std::string> &inputs, size_t iterations, F f)
+    {
+        size_t sink = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < iterations; i++)
+        {
+            sink += f(inputs[i % inputs.size()]);
+        }
+        std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+        check::benchmark_sink = check::benchmark_sink + sink;
+        return elapsed.count() / iterations;
+    }
+
+    void benchmark(size_t iterations)
+    {
+        std::vector<std::string> dates = {"2023-01-01", "1985-07-12", "2024-02-29", "1999-12-31"};
+        std::vector<std::string> times = {"08:15:00", "12:34:56.123456", "23:59:59.5", "00:00:01"};
+
+        auto report = [](const char *operation, double reference_ns, double fixed_ns)
+        {
+            std::cout << operation << ": date::parse/format " << reference_ns << " ns, fixed format " << fixed_ns
+                      << " ns (" << reference_ns / fixed_ns << "x)" << std::endl;
+        };
+
+        report("date_from_string",
+               time_per_call(dates, iterations, [](const std::string &s)
+                             { return reference_date_from_string(s).time_since_epoch().count(); }),
+               time_per_call(dates, iterations, [](const std::string &s)
+                             { return date_from_string(s).time_since_epoch().count(); }));
+        report("time_from_string",
+               time_per_call(times, iterations, [](const std::string &s)
+                             { return reference_time_from_string(s).count(); }),
+               time_per_call(times, iterations, [](const std::string &s)
+                             { return time_from_string(s).count(); }));
+        report("date_to_string",
+               time_per_call(dates, iterations, [d = date_from_string(dates[0])](const std::string &s)
+                             { return reference_date_to_string(d + date::days(s.size())).size(); }),
+               time_per_call(dates, iterations, [d = date_from_string(dates[0])](const std::string &s)
+                             { return date_to_string(d + date::days(s.size())).size(); }));
+        report("time_to_string",
+               time_per_call(times, iterations, [](const std::string &s)
+                             { return reference_time_to_string(yardl::Time(s.size() * 1234567891)).size(); }),
+               time_per_call(times, iterations, [](const std::string &s)
+                             { return time_to_string(yardl::Time(s.size() * 1234567891)).size(); }));
+    }
+}
+
+int main(int argc, char **argv)
+{
+    check_valid();
+    check_rejected();
+    if (check::failures > 0)
+    {
+        std::cerr << check::failures << " date/time checks failed" << std::endl;
+        return 1;
+    }
+
+    if (argc > 1 && std::strcmp(argv[1], "--benchmark") == 0)
+    {
+        benchmark(argc > 2 ? std::stoul(argv[2]) : 1000000);
+    }
+    return 0;
+}
@@ -0,0 +1,176 @@
+#include "fd_stream.h"
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <unistd.h>
+
+size_t parse_buffer_size(const std::string &arg)
+{
+    size_t size = 0;
+    auto [ptr, ec] = std::from_chars(arg.data(), arg.data() + arg.size(), size);
+    if (ec != std::errc() || ptr != arg.data() + arg.size() || size < 1 || size > kMaxOutputBufferSize)
+    {
+        throw std::invalid_argument("Invalid buffer size " + arg + ", expected 1 to " + std::to_string(kMaxOutputBufferSize) + " bytes");
+    }
+    return size;
+}
+
+FdOutputBuffer::FdOutputBuffer(int fd, size_t buffer_size)
+    : fd_(fd), buffer_(std::clamp<size_t>(buffer_size, 1, kMaxOutputBufferSize))
+{
+    setp(buffer_.data(), buffer_.data() + buffer_.size());
+}
+
+FdOutputBuffer::~FdOutputBuffer()
+{
+    // Output that was not finished explicitly can only be reported here.
+    if (!FlushBuffer())
+    {
+        std::cerr << "Failed to write output: " << std::strerror(error_) << std::endl;
+    }
+}
+
+FdOutputBuffer::int_type FdOutputBuffer::overflow(int_type ch)
+{
+    if (!FlushBuffer())
+    {
+        return traits_type::eof();
+    }
+
+    if (!traits_type::eq_int_type(ch, traits_type::eof()))
+    {
+        *pptr() = traits_type::to_char_type(ch);
+        pbump(1);
+    }
+
+    return traits_type::not_eof(ch);
+}
+
+std::streamsize FdOutputBuffer::xsputn(const char *s, std::streamsize n)
+{
+    if (n <= epptr() - pptr())
+    {
+        std::memcpy(pptr(), s, n);
+        pbump(static_cast<int>(n));
+        return n;
+    }
+
+    if (!FlushBuffer())
+    {
+        return 0;
+    }
+
+    // Writes at least as large as the buffer go straight to the file descriptor.
+    if (static_cast<size_t>(n) >= buffer_.size())
+    {
+        return WriteAll(s, n) ? n : 0;
+    }
+
+    std::memcpy(pptr(), s, n);
+    pbump(static_cast<int>(n));
+    return n;
+}
+
+int FdOutputBuffer::sync()
+{
+    return FlushBuffer() ? 0 : -1;
+}
+
+bool FdOutputBuffer::WriteAll(const char *data, size_t size)
+{
+    while (size > 0)
+    {
+        auto written = ::write(fd_, data, size);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (error_ == 0)
+            {
+                error_ = errno;
+            }
+            return false;
+        }
+        data += written;
+        size -= written;
+    }
+    return true;
+}
+
+bool FdOutputBuffer::FlushBuffer()
+{
+    auto size = pptr() - pbase();
+    if (size == 0)
+    {
+        return true;
+    }
+
+    bool ok = WriteAll(pbase(), size);
+    setp(buffer_.data(), buffer_.data() + buffer_.size());
+    return ok;
+}
+
+FdOutputStream::FdOutputStream(int fd, size_t buffer_size)
+    : std::ostream(nullptr), buffer_(fd, buffer_size)
+{
+    rdbuf(&buffer_);
+    exceptions(std::ios::badbit);
+}
+
+bool FdOutputStream::Finish()
+{
+    try
+    {
+        flush();
+    }
+    catch (const std::ios_base::failure &)
+    {
+    }
+
+    if (buffer_.Error() != 0)
+    {
+        std::cerr << "Failed to write output: " << std::strerror(buffer_.Error()) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+FdInputBuffer::FdInputBuffer(int fd, size_t buffer_size)
+    : fd_(fd), buffer_(buffer_size > 0 ? buffer_size : 1)
+{
+    setg(buffer_.data(), buffer_.data(), buffer_.data());
+}
+
+FdInputBuffer::int_type FdInputBuffer::underflow()
+{
+    if (gptr() < egptr())
+    {
+        return traits_type::to_int_type(*gptr());
+    }
+
+    while (true)
+    {
+        auto n = ::read(fd_, buffer_.data(), buffer_.size());
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return traits_type::eof();
+        }
+        setg(buffer_.data(), buffer_.data(), buffer_.data() + n);
+        return traits_type::to_int_type(*gptr());
+    }
+}
+
+FdInputStream::FdInputStream(int fd, size_t buffer_size)
+    : std::istream(nullptr), buffer_(fd, buffer_size)
+{
+    rdbuf(&buffer_);
+}
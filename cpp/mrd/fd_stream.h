@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstddef>
+#include <istream>
+#include <limits>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+// Output stream writing directly to a file descriptor through a large buffer.
+// This bypasses std::cout and its synchronization with stdio, so that the stream tools
+// issue few, large write(2) calls instead of many small ones per item.
+
+constexpr size_t kDefaultOutputBufferSize = 1 << 20;
+
+// std::streambuf moves its put pointer by int offsets, so larger buffers are reduced to this size.
+constexpr size_t kMaxOutputBufferSize = std::numeric_limits<int>::max();
+
+// Parses a --buffer-size argument. Throws std::invalid_argument unless it is a number of bytes
+// from 1 to kMaxOutputBufferSize.
+size_t parse_buffer_size(const std::string &arg);
+
+class FdOutputBuffer : public std::streambuf
+{
+public:
+    FdOutputBuffer(int fd, size_t buffer_size = kDefaultOutputBufferSize);
+    ~FdOutputBuffer() override;
+
+    FdOutputBuffer(const FdOutputBuffer &) = delete;
+    FdOutputBuffer &operator=(const FdOutputBuffer &) = delete;
+
+    // errno of the first failed write, or 0.
+    int Error() const
+    {
+        return error_;
+    }
+
+protected:
+    int_type overflow(int_type ch) override;
+    std::streamsize xsputn(const char *s, std::streamsize n) override;
+    int sync() override;
+
+private:
+    bool WriteAll(const char *data, size_t size);
+    bool FlushBuffer();
+
+    int fd_;
+    int error_ = 0;
+    std::vector<char> buffer_;
+};
+
+class FdOutputStream : public std::ostream
+{
+public:
+    // Write errors set badbit and throw std::ios_base::failure.
+    FdOutputStream(int fd, size_t buffer_size = kDefaultOutputBufferSize);
+
+    // Writes out the buffer. Returns false, after printing the error, if any of the output could not
+    // be written, so that tools can exit with a failure status instead of leaving a truncated stream
+    // behind with status 0.
+    bool Finish();
+
+private:
+    FdOutputBuffer buffer_;
+};
+
+// Input stream reading directly from a file descriptor, such as a socket, through a large buffer.
+class FdInputBuffer : public std::streambuf
+{
+public:
+    FdInputBuffer(int fd, size_t buffer_size = kDefaultOutputBufferSize);
+
+    FdInputBuffer(const FdInputBuffer &) = delete;
+    FdInputBuffer &operator=(const FdInputBuffer &) = delete;
+
+protected:
+    int_type underflow() override;
+
+private:
+    int fd_;
+    std::vector<char> buffer_;
+};
+
+class FdInputStream : public std::istream
+{
+public:
+    // Read errors are reported as the end of the stream.
+    FdInputStream(int fd, size_t buffer_size = kDefaultOutputBufferSize);
+
+private:
+    FdInputBuffer buffer_;
+};
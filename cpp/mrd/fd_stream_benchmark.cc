@@ -0,0 +1,85 @@
+#include "fd_stream.h"
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+// Writes a stream of acquisition-like items to stdout, either through std::cout (as the stream tools
+// did before fd_stream.h) or through FdOutputStream, and reports the number of write(2) calls and the
+// throughput to stderr. Each item is written the way the ISMRMRD and MRD serializers write an
+// acquisition: a message id, a fixed-size header and the data, as separate writes.
+
+namespace
+{
+    void print_usage(const std::string &program_name)
+    {
+        std::cerr << "Usage: " << program_name << " cout|fd [total MB (default: 2048)] [item bytes (default: 65536)] [buffer bytes]" << std::endl;
+    }
+
+    // Number of write-like system calls made by this process so far (syscw in /proc/self/io).
+    long long write_syscalls()
+    {
+        std::ifstream io("/proc/self/io");
+        std::string key;
+        long long value;
+        while (io >> key >> value)
+        {
+            if (key == "syscw:")
+            {
+                return value;
+            }
+        }
+        return -1;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2 || (std::strcmp(argv[1], "cout") != 0 && std::strcmp(argv[1], "fd") != 0))
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    bool use_cout = std::strcmp(argv[1], "cout") == 0;
+    size_t total_bytes = (argc > 2 ? std::stoull(argv[2]) : 2048) << 20;
+    size_t item_bytes = argc > 3 ? std::stoull(argv[3]) : 65536;
+    size_t buffer_size = argc > 4 ? std::stoull(argv[4]) : kDefaultOutputBufferSize;
+
+    std::unique_ptr<FdOutputStream> fd_out;
+    std::ostream *out = &std::cout;
+    if (!use_cout)
+    {
+        fd_out = std::make_unique<FdOutputStream>(STDOUT_FILENO, buffer_size);
+        out = fd_out.get();
+    }
+
+    uint16_t message_id = 1008;
+    std::vector<char> header(340, 'h');
+    std::vector<char> data(item_bytes, 'd');
+    size_t item_total = sizeof(message_id) + header.size() + data.size();
+
+    long long syscalls_before = write_syscalls();
+    auto start = std::chrono::steady_clock::now();
+    size_t written = 0;
+    size_t items = 0;
+    for (; written < total_bytes; written += item_total, items++)
+    {
+        out->write(reinterpret_cast<const char *>(&message_id), sizeof(message_id));
+        out->write(header.data(), header.size());
+        out->write(data.data(), data.size());
+    }
+    bool ok = fd_out ? fd_out->Finish() : static_cast<bool>(out->flush());
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    long long syscalls = write_syscalls() - syscalls_before;
+
+    std::cerr << (use_cout ? "std::cout" : "FdOutputStream (" + std::to_string(buffer_size) + " byte buffer)")
+              << ": " << items << " items, " << (written >> 20) << " MB in " << elapsed.count() << " s ("
+              << (written >> 20) / elapsed.count() << " MB/s), " << syscalls << " write calls ("
+              << static_cast<double>(syscalls) / items << " per item)" << std::endl;
+    return ok ? 0 : 1;
+}
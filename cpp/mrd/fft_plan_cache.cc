@@ -0,0 +1,65 @@
+#include "fft_plan_cache.h"
+#include <functional>
+#include <numeric>
+#include <stdexcept>
+
+FftPlanCache::FftPlanCache(unsigned flags)
+    : flags_(flags)
+{
+    static std::once_flag planner_thread_safe;
+    std::call_once(planner_thread_safe, fftwf_make_planner_thread_safe);
+}
+
+FftPlanCache::~FftPlanCache()
+{
+    for (auto &[key, entry] : plans_)
+    {
+        if (entry->plan)
+        {
+            fftwf_destroy_plan(entry->plan);
+        }
+    }
+}
+
+void FftPlanCache::Transform(std::complex<float> *data, const std::vector<int> &shape, int sign)
+{
+    auto d = reinterpret_cast<fftwf_complex *>(data);
+    fftwf_execute_dft(Plan(shape, sign), d, d);
+}
+
+fftwf_plan FftPlanCache::Plan(const std::vector<int> &shape, int sign)
+{
+    auto key = std::make_pair(shape, sign);
+    Entry *entry;
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        auto it = plans_.find(key);
+        entry = it != plans_.end() ? it->second.get() : nullptr;
+    }
+    if (!entry)
+    {
+        std::lock_guard<std::shared_mutex> lock(mutex_);
+        auto &inserted = plans_[key];
+        if (!inserted)
+        {
+            inserted = std::make_unique<Entry>();
+        }
+        entry = inserted.get();
+    }
+
+    // If planning fails, the exception propagates and the next caller tries again.
+    std::call_once(entry->planned, [&]
+                   {
+        // Planning may overwrite the array, so plans are made on a scratch array. FFTW_UNALIGNED lets the
+        // plan run on arrays with any alignment, such as those of xtensor containers.
+        auto size = std::accumulate(shape.begin(), shape.end(), size_t(1), std::multiplies<size_t>());
+        auto scratch = fftwf_alloc_complex(size);
+        auto plan = fftwf_plan_dft(static_cast<int>(shape.size()), shape.data(), scratch, scratch, sign, flags_ | FFTW_UNALIGNED);
+        fftwf_free(scratch);
+        if (!plan)
+        {
+            throw std::runtime_error("Failed to create FFT plan");
+        }
+        entry->plan = plan; });
+    return entry->plan;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <complex>
+#include <fftw3.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <utility>
+#include <vector>
+
+// FFTW plans for in-place single precision transforms, made once per shape and direction and
+// shared by all threads. Executing a cached plan on new arrays is thread-safe, so transforms with
+// cached plans only share a read lock. A new plan is made outside that lock, and only the threads
+// waiting for the same plan wait for it. The first cache makes the FFTW planner thread-safe for the
+// whole process, including plans made elsewhere (by xtensor-fftw), so it must be created before any
+// threads plan transforms. Transforms are not normalized.
+
+class FftPlanCache
+{
+public:
+    // flags are FFTW planner flags. FFTW_MEASURE finds faster plans but takes longer to plan,
+    // which pays off in a process that serves many scans.
+    explicit FftPlanCache(unsigned flags = FFTW_ESTIMATE);
+    ~FftPlanCache();
+
+    FftPlanCache(const FftPlanCache &) = delete;
+    FftPlanCache &operator=(const FftPlanCache &) = delete;
+
+    // Transforms the row-major array of the given shape in place. sign is FFTW_FORWARD or FFTW_BACKWARD.
+    void Transform(std::complex<float> *data, const std::vector<int> &shape, int sign);
+
+private:
+    struct Entry
+    {
+        std::once_flag planned;
+        fftwf_plan plan = nullptr;
+    };
+
+    fftwf_plan Plan(const std::vector<int> &shape, int sign);
+
+    unsigned flags_;
+    std::shared_mutex mutex_;
+    std::map<std::pair<std::vector<int>, int>, std::unique_ptr<Entry>> plans_;
+};
@@ -0,0 +1,85 @@
+#include "hdf5_part_writer.h"
+#include <filesystem>
+#include <iostream>
+
+Hdf5PartWriter::Hdf5PartWriter(std::string filename, const std::optional<mrd::Header> &header, Hdf5StorageOptions storage, size_t batch_size, bool write_index)
+    : filename_(std::move(filename)), storage_(storage), batch_size_(batch_size), write_index_(write_index)
+{
+    // The generated writer picks its own dataset layout, so non-default storage
+    // settings are applied by repacking the written file into the final one.
+    write_filename_ = storage_.IsDefault() ? filename_ : filename_ + ".tmp";
+    writer_.emplace(write_filename_);
+    writer_->WriteHeader(header);
+    pending_.reserve(batch_size_);
+}
+
+Hdf5PartWriter::~Hdf5PartWriter()
+{
+    if (!closed_)
+    {
+        try
+        {
+            Close();
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Failed to write " << filename_ << ": " << e.what() << std::endl;
+        }
+    }
+}
+
+void Hdf5PartWriter::Write(mrd::StreamItem item)
+{
+    items_++;
+    data_bytes_ += item_data_bytes(item);
+    pending_.push_back(std::move(item));
+    if (pending_.size() >= batch_size_)
+    {
+        WritePending();
+    }
+}
+
+void Hdf5PartWriter::WritePending()
+{
+    if (write_index_)
+    {
+        for (auto &item : pending_)
+        {
+            auto e = make_index_entry(item);
+            e.offset = index_.entries.size();
+            index_.entries.push_back(e);
+        }
+    }
+    writer_->WriteData(pending_);
+    pending_.clear();
+}
+
+void Hdf5PartWriter::Close()
+{
+    closed_ = true;
+
+    if (!pending_.empty())
+    {
+        WritePending();
+    }
+    writer_->EndData();
+    writer_.reset();
+
+    if (!storage_.IsDefault())
+    {
+        repack_hdf5_file(write_filename_, filename_, storage_);
+        std::filesystem::remove(write_filename_);
+    }
+
+    if (write_index_)
+    {
+        write_stream_index(index_path_for(filename_), filename_, index_);
+    }
+}
+
+uint64_t item_data_bytes(const mrd::StreamItem &item)
+{
+    return std::visit([](auto &&arg) -> uint64_t
+                      { return arg.data.size() * sizeof(*arg.data.data()); },
+                      item);
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "generated/hdf5/protocols.h"
+#include "generated/types.h"
+#include "hdf5_storage.h"
+#include "stream_index.h"
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Writes MRD items to one HDF5 file, in batches of batch_size items. Parts are written on the calling
+// thread: HDF5 serializes all calls into the library, so writing several parts from threads of their
+// own would not write any faster.
+
+class Hdf5PartWriter
+{
+public:
+    // Creates the file and writes the header.
+    Hdf5PartWriter(std::string filename, const std::optional<mrd::Header> &header, Hdf5StorageOptions storage, size_t batch_size, bool write_index);
+
+    // Closes the file if Close was not called, printing any error.
+    ~Hdf5PartWriter();
+
+    Hdf5PartWriter(const Hdf5PartWriter &) = delete;
+    Hdf5PartWriter &operator=(const Hdf5PartWriter &) = delete;
+
+    void Write(mrd::StreamItem item);
+
+    // Writes the remaining items and finishes the file, repacking it and writing its index if requested.
+    void Close();
+
+    const std::string &Filename() const
+    {
+        return filename_;
+    }
+
+    size_t Items() const
+    {
+        return items_;
+    }
+
+    // Size of the sample and pixel data written so far.
+    uint64_t DataBytes() const
+    {
+        return data_bytes_;
+    }
+
+private:
+    void WritePending();
+
+    std::string filename_;
+    std::string write_filename_;
+    Hdf5StorageOptions storage_;
+    size_t batch_size_;
+    bool write_index_;
+
+    size_t items_ = 0;
+    uint64_t data_bytes_ = 0;
+    std::vector<mrd::StreamItem> pending_;
+    StreamIndex index_;
+    std::optional<mrd::hdf5::MrdWriter> writer_;
+    bool closed_ = false;
+};
+
+// Size of the data array of an item in bytes.
+uint64_t item_data_bytes(const mrd::StreamItem &item);
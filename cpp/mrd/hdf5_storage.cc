@@ -0,0 +1,303 @@
+#include "hdf5_storage.h"
+#include <algorithm>
+#include <hdf5.h>
+#include <stdexcept>
+#include <vector>
+
+namespace
+{
+    constexpr H5Z_filter_t kLz4FilterId = 32004;
+
+    // Bytes of dataset data read and written at a time while copying.
+    constexpr size_t kCopyBlockBytes = 16 << 20;
+
+    // Owns an HDF5 identifier and closes it with the matching H5*close function.
+    class Handle
+    {
+    public:
+        Handle(hid_t id, herr_t (*close)(hid_t), const char *what)
+            : id_(id), close_(close)
+        {
+            if (id_ < 0)
+            {
+                throw std::runtime_error(std::string("HDF5 error: ") + what);
+            }
+        }
+
+        ~Handle()
+        {
+            close_(id_);
+        }
+
+        Handle(const Handle &) = delete;
+        Handle &operator=(const Handle &) = delete;
+
+        operator hid_t() const
+        {
+            return id_;
+        }
+
+    private:
+        hid_t id_;
+        herr_t (*close_)(hid_t);
+    };
+
+    void check(herr_t status, const char *what)
+    {
+        if (status < 0)
+        {
+            throw std::runtime_error(std::string("HDF5 error: ") + what);
+        }
+    }
+
+    bool has_variable_length_data(hid_t type)
+    {
+        return H5Tdetect_class(type, H5T_VLEN) > 0 || H5Tdetect_class(type, H5T_STRING) > 0;
+    }
+
+    herr_t copy_attribute(hid_t source, const char *name, const H5A_info_t *, void *data)
+    {
+        hid_t destination = *static_cast<hid_t *>(data);
+        try
+        {
+            Handle attr(H5Aopen(source, name, H5P_DEFAULT), H5Aclose, "open attribute");
+            Handle file_type(H5Aget_type(attr), H5Tclose, "get attribute type");
+            Handle mem_type(H5Tget_native_type(file_type, H5T_DIR_DEFAULT), H5Tclose, "get native attribute type");
+            Handle space(H5Aget_space(attr), H5Sclose, "get attribute space");
+
+            auto npoints = H5Sget_simple_extent_npoints(space);
+            std::vector<char> buffer(std::max<size_t>(npoints, 1) * H5Tget_size(mem_type));
+            check(H5Aread(attr, mem_type, buffer.data()), "read attribute");
+
+            Handle copy(H5Acreate2(destination, name, file_type, space, H5P_DEFAULT, H5P_DEFAULT), H5Aclose, "create attribute");
+            check(H5Awrite(copy, mem_type, buffer.data()), "write attribute");
+
+            if (has_variable_length_data(mem_type))
+            {
+                check(H5Dvlen_reclaim(mem_type, space, H5P_DEFAULT, buffer.data()), "reclaim attribute data");
+            }
+        }
+        catch (const std::exception &)
+        {
+            return -1;
+        }
+        return 0;
+    }
+
+    void copy_attributes(hid_t source, hid_t destination)
+    {
+        check(H5Aiterate2(source, H5_INDEX_NAME, H5_ITER_NATIVE, nullptr, copy_attribute, &destination), "copy attributes");
+    }
+
+    // Returns the creation property list for the copy of a dataset with the given extent.
+    hid_t make_creation_plist(hid_t source_dataset, const std::vector<hsize_t> &dims, const std::vector<hsize_t> &maxdims, const Hdf5StorageOptions &options)
+    {
+        hid_t dcpl = H5Dget_create_plist(source_dataset);
+        if (dcpl < 0 || dims.empty())
+        {
+            return dcpl;
+        }
+
+        std::vector<hsize_t> chunk(dims.size());
+        bool chunked = H5Pget_layout(dcpl) == H5D_CHUNKED;
+        if (chunked)
+        {
+            check(H5Pget_chunk(dcpl, static_cast<int>(chunk.size()), chunk.data()), "get chunk size");
+        }
+
+        if (options.chunk_size > 0 || !chunked)
+        {
+            chunk[0] = options.chunk_size > 0 ? options.chunk_size : std::clamp<hsize_t>(dims[0], 1, 1024);
+            for (size_t i = 1; i < dims.size(); i++)
+            {
+                chunk[i] = std::max<hsize_t>(dims[i], 1);
+            }
+        }
+
+        // Chunks may not be larger than fixed maximum dimensions, and empty fixed-size datasets cannot be chunked.
+        for (size_t i = 0; i < dims.size(); i++)
+        {
+            if (maxdims[i] != H5S_UNLIMITED)
+            {
+                if (maxdims[i] == 0)
+                {
+                    return dcpl;
+                }
+                chunk[i] = std::min(chunk[i], maxdims[i]);
+            }
+        }
+
+        check(H5Premove_filter(dcpl, H5Z_FILTER_ALL), "remove filters");
+        check(H5Pset_chunk(dcpl, static_cast<int>(chunk.size()), chunk.data()), "set chunk size");
+
+        if (options.shuffle)
+        {
+            check(H5Pset_shuffle(dcpl), "set shuffle filter");
+        }
+
+        switch (options.compression)
+        {
+        case Hdf5Compression::kDeflate:
+            check(H5Pset_deflate(dcpl, options.deflate_level), "set deflate filter");
+            break;
+        case Hdf5Compression::kLz4:
+            check(H5Pset_filter(dcpl, kLz4FilterId, H5Z_FLAG_MANDATORY, 0, nullptr), "set LZ4 filter");
+            break;
+        case Hdf5Compression::kNone:
+            break;
+        }
+
+        return dcpl;
+    }
+
+    void copy_dataset(hid_t source_file, hid_t destination_file, const char *name, const Hdf5StorageOptions &options)
+    {
+        Handle source(H5Dopen2(source_file, name, H5P_DEFAULT), H5Dclose, "open dataset");
+        Handle file_type(H5Dget_type(source), H5Tclose, "get dataset type");
+        Handle mem_type(H5Tget_native_type(file_type, H5T_DIR_DEFAULT), H5Tclose, "get native dataset type");
+        Handle file_space(H5Dget_space(source), H5Sclose, "get dataset space");
+
+        int rank = H5Sget_simple_extent_ndims(file_space);
+        check(rank, "get dataset rank");
+        std::vector<hsize_t> dims(rank), maxdims(rank);
+        check(H5Sget_simple_extent_dims(file_space, dims.data(), maxdims.data()), "get dataset dimensions");
+
+        Handle dcpl(make_creation_plist(source, dims, maxdims, options), H5Pclose, "create dataset creation properties");
+        Handle destination(H5Dcreate2(destination_file, name, file_type, file_space, H5P_DEFAULT, dcpl, H5P_DEFAULT), H5Dclose, "create dataset");
+        copy_attributes(source, destination);
+
+        bool reclaim = has_variable_length_data(mem_type);
+        size_t item_size = H5Tget_size(mem_type);
+
+        if (rank == 0)
+        {
+            std::vector<char> buffer(item_size);
+            check(H5Dread(source, mem_type, H5S_ALL, H5S_ALL, H5P_DEFAULT, buffer.data()), "read dataset");
+            check(H5Dwrite(destination, mem_type, H5S_ALL, H5S_ALL, H5P_DEFAULT, buffer.data()), "write dataset");
+            if (reclaim)
+            {
+                check(H5Dvlen_reclaim(mem_type, file_space, H5P_DEFAULT, buffer.data()), "reclaim dataset data");
+            }
+            return;
+        }
+
+        // Copy blocks of rows along the first dimension.
+        size_t row_size = item_size;
+        for (int i = 1; i < rank; i++)
+        {
+            row_size *= dims[i];
+        }
+        if (row_size == 0 || dims[0] == 0)
+        {
+            return;
+        }
+
+        hsize_t rows_per_block = std::max<hsize_t>(1, kCopyBlockBytes / row_size);
+        std::vector<char> buffer(std::min(rows_per_block, dims[0]) * row_size);
+        std::vector<hsize_t> start(rank, 0), count(dims);
+
+        for (hsize_t row = 0; row < dims[0]; row += rows_per_block)
+        {
+            start[0] = row;
+            count[0] = std::min(rows_per_block, dims[0] - row);
+
+            Handle mem_space(H5Screate_simple(rank, count.data(), nullptr), H5Sclose, "create memory space");
+            check(H5Sselect_hyperslab(file_space, H5S_SELECT_SET, start.data(), nullptr, count.data(), nullptr), "select rows");
+
+            check(H5Dread(source, mem_type, mem_space, file_space, H5P_DEFAULT, buffer.data()), "read dataset");
+            check(H5Dwrite(destination, mem_type, mem_space, file_space, H5P_DEFAULT, buffer.data()), "write dataset");
+            if (reclaim)
+            {
+                check(H5Dvlen_reclaim(mem_type, mem_space, H5P_DEFAULT, buffer.data()), "reclaim dataset data");
+            }
+        }
+    }
+
+    struct RepackContext
+    {
+        hid_t source_file;
+        hid_t destination_file;
+        const Hdf5StorageOptions *options;
+    };
+
+    herr_t repack_object(hid_t, const char *name, const H5O_info_t *info, void *data)
+    {
+        auto context = static_cast<RepackContext *>(data);
+        try
+        {
+            if (std::string(name) == ".")
+            {
+                Handle source(H5Gopen2(context->source_file, "/", H5P_DEFAULT), H5Gclose, "open root group");
+                Handle destination(H5Gopen2(context->destination_file, "/", H5P_DEFAULT), H5Gclose, "open root group");
+                copy_attributes(source, destination);
+                return 0;
+            }
+
+            switch (info->type)
+            {
+            case H5O_TYPE_GROUP:
+            {
+                Handle source(H5Gopen2(context->source_file, name, H5P_DEFAULT), H5Gclose, "open group");
+                Handle destination(H5Gcreate2(context->destination_file, name, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT), H5Gclose, "create group");
+                copy_attributes(source, destination);
+                break;
+            }
+            case H5O_TYPE_DATASET:
+                copy_dataset(context->source_file, context->destination_file, name, *context->options);
+                break;
+            default:
+                check(H5Ocopy(context->source_file, name, context->destination_file, name, H5P_DEFAULT, H5P_DEFAULT), "copy object");
+                break;
+            }
+        }
+        catch (const std::exception &)
+        {
+            return -1;
+        }
+        return 0;
+    }
+}
+
+void parse_hdf5_compression(const std::string &spec, Hdf5StorageOptions &options)
+{
+    if (spec == "none")
+    {
+        options.compression = Hdf5Compression::kNone;
+    }
+    else if (spec == "lz4")
+    {
+        options.compression = Hdf5Compression::kLz4;
+    }
+    else if (spec == "deflate")
+    {
+        options.compression = Hdf5Compression::kDeflate;
+    }
+    else if (spec.size() == 9 && spec.rfind("deflate:", 0) == 0 && spec[8] >= '0' && spec[8] <= '9')
+    {
+        options.compression = Hdf5Compression::kDeflate;
+        options.deflate_level = spec[8] - '0';
+    }
+    else
+    {
+        throw std::runtime_error("Unknown compression: " + spec);
+    }
+}
+
+void check_hdf5_storage(const Hdf5StorageOptions &options)
+{
+    if (options.compression == Hdf5Compression::kLz4 && H5Zfilter_avail(kLz4FilterId) <= 0)
+    {
+        throw std::runtime_error("The HDF5 LZ4 filter is not available. Set HDF5_PLUGIN_PATH to a directory containing it.");
+    }
+}
+
+void repack_hdf5_file(const std::string &source, const std::string &destination, const Hdf5StorageOptions &options)
+{
+    check_hdf5_storage(options);
+
+    Handle source_file(H5Fopen(source.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT), H5Fclose, "open source file");
+    Handle destination_file(H5Fcreate(destination.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT), H5Fclose, "create destination file");
+
+    RepackContext context{source_file, destination_file, &options};
+    check(H5Ovisit(source_file, H5_INDEX_NAME, H5_ITER_INC, repack_object, &context), "copy file contents");
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Dataset storage settings for MRD HDF5 files. The generated HDF5 writer does not expose
+// dataset creation properties, so these are applied by rewriting a written file.
+
+enum class Hdf5Compression
+{
+    kNone,
+    kDeflate,
+    kLz4, // Requires the HDF5 LZ4 filter plugin (filter id 32004) to be installed
+};
+
+struct Hdf5StorageOptions
+{
+    // Number of items per chunk along the first dimension of each dataset. 0 keeps the writer's chunking.
+    size_t chunk_size = 0;
+    Hdf5Compression compression = Hdf5Compression::kNone;
+    unsigned int deflate_level = 6;
+    bool shuffle = false;
+
+    bool IsDefault() const
+    {
+        return chunk_size == 0 && compression == Hdf5Compression::kNone && !shuffle;
+    }
+};
+
+// Parses a compression specification: "none", "lz4", "deflate" or "deflate:<level>" with a level from 0 to 9.
+// Throws std::runtime_error for unknown specifications.
+void parse_hdf5_compression(const std::string &spec, Hdf5StorageOptions &options);
+
+// Checks that the filters of options are available, so that a missing plugin is reported before
+// anything is written. Throws std::runtime_error if not.
+void check_hdf5_storage(const Hdf5StorageOptions &options);
+
+// Copies all groups, attributes and datasets of the HDF5 file source to a new file destination,
+// creating the datasets with the given chunking and filters.
+// Throws std::runtime_error on failure.
+void repack_hdf5_file(const std::string &source, const std::string &destination, const Hdf5StorageOptions &options);
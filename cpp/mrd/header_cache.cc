@@ -0,0 +1,206 @@
+#include "header_cache.h"
+#include "generated/binary/protocols.h"
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
+
+uint64_t fnv1a_hash(const std::string &s)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : s)
+    {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+namespace
+{
+    std::string hash_string(const std::string &xml)
+    {
+        std::stringstream ss;
+        ss << std::hex;
+        ss.width(16);
+        ss.fill('0');
+        ss << fnv1a_hash(xml);
+        return ss.str();
+    }
+}
+
+HeaderCache::HeaderCache(std::optional<std::filesystem::path> directory, size_t max_entries)
+    : directory_(directory), max_entries_(max_entries > 0 ? max_entries : 1)
+{
+    if (directory_)
+    {
+        std::error_code ec;
+        std::filesystem::create_directories(*directory_, ec);
+        if (ec)
+        {
+            std::cerr << "Warning: not using header cache directory " << *directory_ << ": " << ec.message() << std::endl;
+            directory_.reset();
+        }
+    }
+}
+
+std::pair<mrd::Header, bool> HeaderCache::GetOrConvert(const std::string &xml, const std::function<mrd::Header(const std::string &)> &convert_fn)
+{
+    if (auto h = Find(xml))
+    {
+        return {*h, true};
+    }
+
+    auto h = convert_fn(xml);
+    Insert(xml, h);
+    return {h, false};
+}
+
+std::optional<mrd::Header> HeaderCache::Find(const std::string &xml)
+{
+    if (auto h = FindInMemory(xml))
+    {
+        return h;
+    }
+
+    if (directory_)
+    {
+        if (auto h = FindOnDisk(xml))
+        {
+            InsertInMemory(xml, *h);
+            return h;
+        }
+    }
+
+    return std::nullopt;
+}
+
+void HeaderCache::Insert(const std::string &xml, const mrd::Header &header)
+{
+    InsertInMemory(xml, header);
+    if (directory_)
+    {
+        try
+        {
+            InsertOnDisk(xml, header);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Warning: could not write header cache entry to " << *directory_ << ": " << e.what() << std::endl;
+        }
+    }
+}
+
+std::optional<mrd::Header> HeaderCache::FindInMemory(const std::string &xml)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto it = entries_.find(xml);
+    if (it == entries_.end())
+    {
+        return std::nullopt;
+    }
+
+    lru_.splice(lru_.begin(), lru_, it->second);
+    return it->second->second;
+}
+
+void HeaderCache::InsertInMemory(const std::string &xml, const mrd::Header &header)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto it = entries_.find(xml);
+    if (it != entries_.end())
+    {
+        it->second->second = header;
+        lru_.splice(lru_.begin(), lru_, it->second);
+        return;
+    }
+
+    lru_.emplace_front(xml, header);
+    entries_.emplace(xml, lru_.begin());
+    while (lru_.size() > max_entries_)
+    {
+        entries_.erase(lru_.back().first);
+        lru_.pop_back();
+    }
+}
+
+// Each entry is stored as <hash>.xml (the key, used to rule out hash collisions)
+// and <hash>.mrd (an MRD binary stream containing only the header).
+std::optional<mrd::Header> HeaderCache::FindOnDisk(const std::string &xml)
+{
+    auto base = *directory_ / hash_string(xml);
+    std::ifstream xml_file(base.string() + ".xml", std::ios::binary);
+    if (!xml_file)
+    {
+        return std::nullopt;
+    }
+
+    std::string cached_xml((std::istreambuf_iterator<char>(xml_file)), std::istreambuf_iterator<char>());
+    if (cached_xml != xml)
+    {
+        return std::nullopt;
+    }
+
+    try
+    {
+        std::ifstream header_file(base.string() + ".mrd", std::ios::binary);
+        if (!header_file)
+        {
+            return std::nullopt;
+        }
+
+        mrd::binary::MrdReader r(header_file);
+        std::optional<mrd::Header> h;
+        r.ReadHeader(h);
+
+        mrd::StreamItem v;
+        while (r.ReadData(v))
+        {
+        }
+
+        return h;
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Ignoring unreadable header cache entry " << base << ": " << e.what() << std::endl;
+        return std::nullopt;
+    }
+}
+
+void HeaderCache::InsertOnDisk(const std::string &xml, const mrd::Header &header)
+{
+    auto base = *directory_ / hash_string(xml);
+
+    // Write to temporary files and rename, so that concurrent converters never see partial entries.
+    auto tmp_suffix = ".tmp" + std::to_string(::getpid()) + "_" + std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id()));
+    try
+    {
+        {
+            std::ofstream header_file(base.string() + ".mrd" + tmp_suffix, std::ios::binary);
+            header_file.exceptions(std::ios::failbit | std::ios::badbit);
+            mrd::binary::MrdWriter w(header_file);
+            w.WriteHeader(header);
+            w.EndData();
+        }
+        {
+            std::ofstream xml_file(base.string() + ".xml" + tmp_suffix, std::ios::binary);
+            xml_file.exceptions(std::ios::failbit | std::ios::badbit);
+            xml_file << xml;
+        }
+
+        // The .mrd file is renamed first since lookups are keyed on the presence of the .xml file.
+        std::filesystem::rename(base.string() + ".mrd" + tmp_suffix, base.string() + ".mrd");
+        std::filesystem::rename(base.string() + ".xml" + tmp_suffix, base.string() + ".xml");
+    }
+    catch (...)
+    {
+        std::error_code ec;
+        std::filesystem::remove(base.string() + ".mrd" + tmp_suffix, ec);
+        std::filesystem::remove(base.string() + ".xml" + tmp_suffix, ec);
+        throw;
+    }
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "generated/types.h"
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+// Cache of converted mrd::Header values keyed by the content of the ISMRMRD XML header.
+// The most recently used max_entries headers are kept in memory as whole mrd::Header objects,
+// together with their XML. If a directory is given, entries are also stored on disk as
+// header-only MRD binary streams, so that later converter processes can skip XML parsing.
+// Errors reading or writing the directory only print a warning; the header is then converted
+// as if it were not cached.
+class HeaderCache
+{
+public:
+    static constexpr size_t kDefaultMaxEntries = 64;
+
+    explicit HeaderCache(std::optional<std::filesystem::path> directory = std::nullopt, size_t max_entries = kDefaultMaxEntries);
+
+    // Returns the cached header for xml, or converts it with convert_fn and caches the result.
+    // The bool is true if the header was found in the cache.
+    std::pair<mrd::Header, bool> GetOrConvert(const std::string &xml, const std::function<mrd::Header(const std::string &)> &convert_fn);
+
+    std::optional<mrd::Header> Find(const std::string &xml);
+    void Insert(const std::string &xml, const mrd::Header &header);
+
+private:
+    using Entry = std::pair<std::string, mrd::Header>;
+
+    std::optional<mrd::Header> FindInMemory(const std::string &xml);
+    void InsertInMemory(const std::string &xml, const mrd::Header &header);
+    std::optional<mrd::Header> FindOnDisk(const std::string &xml);
+    void InsertOnDisk(const std::string &xml, const mrd::Header &header);
+
+    std::optional<std::filesystem::path> directory_;
+    size_t max_entries_;
+
+    // Entries in order of use, most recent first, and an index into them by XML.
+    std::list<Entry> lru_;
+    std::unordered_map<std::string, std::list<Entry>::iterator> entries_;
+
+    // Guards lru_ and entries_. Disk reads and writes happen outside of it.
+    std::mutex mutex_;
+};
+
+// 64-bit FNV-1a hash, used to name on-disk cache entries.
+uint64_t fnv1a_hash(const std::string &s);
@@ -0,0 +1,225 @@
+#include "image_encoder.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <zlib.h>
+
+namespace
+{
+    // Thumbnails are written often and read rarely, so speed matters more than size.
+    constexpr int kPngCompressionLevel = 1;
+
+    void append_u32(std::string &out, uint32_t value)
+    {
+        out.push_back(static_cast<char>(value >> 24));
+        out.push_back(static_cast<char>(value >> 16));
+        out.push_back(static_cast<char>(value >> 8));
+        out.push_back(static_cast<char>(value));
+    }
+
+    void write_chunk(std::ofstream &os, const char *type, const std::string &data)
+    {
+        std::string chunk;
+        append_u32(chunk, static_cast<uint32_t>(data.size()));
+        chunk.append(type, 4);
+        chunk.append(data);
+
+        // The CRC covers the chunk type and data, not the length.
+        auto crc = crc32(0, reinterpret_cast<const Bytef *>(chunk.data() + 4), static_cast<uInt>(chunk.size() - 4));
+        append_u32(chunk, static_cast<uint32_t>(crc));
+        os.write(chunk.data(), chunk.size());
+    }
+
+    // Rows of big-endian samples, as both PNG and PGM store them.
+    void append_row(std::string &out, const uint16_t *row, size_t cols, int bit_depth)
+    {
+        if (bit_depth == 8)
+        {
+            for (size_t x = 0; x < cols; x++)
+            {
+                out.push_back(static_cast<char>(row[x]));
+            }
+        }
+        else
+        {
+            for (size_t x = 0; x < cols; x++)
+            {
+                out.push_back(static_cast<char>(row[x] >> 8));
+                out.push_back(static_cast<char>(row[x]));
+            }
+        }
+    }
+
+    void check_bit_depth(int bit_depth)
+    {
+        if (bit_depth != 8 && bit_depth != 16)
+        {
+            throw std::runtime_error("Unsupported bit depth " + std::to_string(bit_depth) + ", expected 8 or 16");
+        }
+    }
+}
+
+std::vector<uint16_t> quantize_frame(const float *pixels, size_t count, float low, float high, int bit_depth)
+{
+    check_bit_depth(bit_depth);
+    const float max_level = static_cast<float>((1 << bit_depth) - 1);
+    const float scale = high > low ? max_level / (high - low) : 0.0f;
+
+    // Adding 0.5 before truncating rounds to the nearest level. The loop body is branch-free
+    // (the comparisons compile to min/max), so that the compiler can vectorize it.
+    const float offset = 0.5f - low * scale;
+    const float top = max_level + 0.5f;
+    std::vector<uint16_t> levels(count);
+    uint16_t *out = levels.data();
+    for (size_t i = 0; i < count; i++)
+    {
+        float level = pixels[i] * scale + offset;
+        level = level > 0.0f ? level : 0.0f;
+        level = level < top ? level : top;
+        out[i] = static_cast<uint16_t>(level);
+    }
+    return levels;
+}
+
+PixelHistogram::PixelHistogram(const float *pixels, size_t count, size_t bins)
+    : pixels_(pixels), count_(count), bins_(std::max<size_t>(bins, 1))
+{
+    float min = std::numeric_limits<float>::infinity();
+    float max = -std::numeric_limits<float>::infinity();
+    for (size_t i = 0; i < count; i++)
+    {
+        if (std::isfinite(pixels[i]))
+        {
+            min = std::min(min, pixels[i]);
+            max = std::max(max, pixels[i]);
+            finite_++;
+        }
+    }
+    if (finite_ > 0)
+    {
+        min_ = min;
+        max_ = max;
+    }
+}
+
+float PixelHistogram::Percentile(double fraction) const
+{
+    // Refining three times resolves 1/bins^3 of the range, beyond float precision for the default.
+    constexpr int kMaxPasses = 3;
+
+    if (finite_ == 0)
+    {
+        return min_;
+    }
+
+    // Rank of the percentile among all finite pixels.
+    const double rank = std::clamp(fraction, 0.0, 1.0) * finite_;
+    double low = min_;
+    double high = max_;
+    std::vector<uint64_t> counts(bins_);
+    for (int pass = 0; pass < kMaxPasses && high > low; pass++)
+    {
+        std::fill(counts.begin(), counts.end(), 0);
+        const double scale = bins_ / (high - low);
+        const size_t last = bins_ - 1;
+        uint64_t below = 0;
+        uint64_t inside = 0;
+        for (size_t i = 0; i < count_; i++)
+        {
+            float p = pixels_[i];
+            if (!std::isfinite(p) || p > high)
+            {
+                continue;
+            }
+            if (p < low)
+            {
+                below++;
+                continue;
+            }
+            auto bin = static_cast<size_t>((p - low) * scale);
+            counts[bin < last ? bin : last]++;
+            inside++;
+        }
+
+        if (inside == 0)
+        {
+            break;
+        }
+
+        double bin_width = (high - low) / bins_;
+        uint64_t before = below;
+        size_t bin = 0;
+        while (bin < last && before + counts[bin] < rank)
+        {
+            before += counts[bin++];
+        }
+
+        low += bin * bin_width;
+        high = low + bin_width;
+        if (counts[bin] * bins_ <= inside || pass == kMaxPasses - 1)
+        {
+            // Few enough pixels in the bin to interpolate within it.
+            return static_cast<float>(low + std::clamp((rank - before) / std::max<uint64_t>(counts[bin], 1), 0.0, 1.0) * bin_width);
+        }
+    }
+    return static_cast<float>(low);
+}
+
+void write_gray_png(const std::string &filename, const uint16_t *pixels, size_t cols, size_t rows, int bit_depth)
+{
+    check_bit_depth(bit_depth);
+
+    // Each row starts with its filter type, which is 0 (none) for all rows.
+    std::string raw;
+    raw.reserve(rows * (1 + cols * bit_depth / 8));
+    for (size_t y = 0; y < rows; y++)
+    {
+        raw.push_back(0);
+        append_row(raw, pixels + y * cols, cols, bit_depth);
+    }
+
+    uLongf compressed_size = compressBound(static_cast<uLong>(raw.size()));
+    std::string compressed(compressed_size, '\0');
+    if (compress2(reinterpret_cast<Bytef *>(compressed.data()), &compressed_size, reinterpret_cast<const Bytef *>(raw.data()), static_cast<uLong>(raw.size()), kPngCompressionLevel) != Z_OK)
+    {
+        throw std::runtime_error("Failed to compress " + filename);
+    }
+    compressed.resize(compressed_size);
+
+    std::string header;
+    append_u32(header, static_cast<uint32_t>(cols));
+    append_u32(header, static_cast<uint32_t>(rows));
+    header.push_back(static_cast<char>(bit_depth));
+    header.push_back(0); // grayscale
+    header.push_back(0); // deflate
+    header.push_back(0); // adaptive filtering
+    header.push_back(0); // no interlace
+
+    std::ofstream os(filename, std::ios::binary);
+    os.write("\x89PNG\r\n\x1a\n", 8);
+    write_chunk(os, "IHDR", header);
+    write_chunk(os, "IDAT", compressed);
+    write_chunk(os, "IEND", "");
+    if (!os)
+    {
+        throw std::runtime_error("Failed to write " + filename);
+    }
+}
+
+void write_gray_pgm(const std::string &filename, const uint16_t *pixels, size_t cols, size_t rows, int bit_depth)
+{
+    check_bit_depth(bit_depth);
+
+    std::string data = "P5\n" + std::to_string(cols) + " " + std::to_string(rows) + "\n" + std::to_string((1 << bit_depth) - 1) + "\n";
+    data.reserve(data.size() + rows * cols * bit_depth / 8);
+    append_row(data, pixels, rows * cols, bit_depth);
+
+    std::ofstream os(filename, std::ios::binary);
+    os.write(data.data(), data.size());
+    if (!os)
+    {
+        throw std::runtime_error("Failed to write " + filename);
+    }
+}
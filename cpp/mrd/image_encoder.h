@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Grayscale image files written without an imaging library: PNG through zlib, and binary PGM.
+// Pixels are 8 or 16 bit, given as uint16_t values in [0, 2^bit_depth - 1].
+
+// Maps pixels in [low, high] linearly to [0, 2^bit_depth - 1] in one pass, clamping values outside
+// of the window and mapping NaN to 0. The pixels are not modified.
+std::vector<uint16_t> quantize_frame(const float *pixels, size_t count, float low, float high, int bit_depth);
+
+// Finds percentiles of pixel values from histograms instead of sorting a copy of the pixels.
+// The first pass finds the range. Each percentile then takes one pass per histogram, and the bin
+// containing it is histogrammed again while it holds more than its share of the pixels, so that a
+// few extreme values do not leave the rest of the image in a single bin. Non-finite values are
+// ignored. The pixels are not copied and must outlive the histogram.
+class PixelHistogram
+{
+public:
+    PixelHistogram(const float *pixels, size_t count, size_t bins = 4096);
+
+    float Min() const
+    {
+        return min_;
+    }
+
+    float Max() const
+    {
+        return max_;
+    }
+
+    // Returns the value below which the given fraction (0 to 1) of the pixels lie.
+    float Percentile(double fraction) const;
+
+private:
+    const float *pixels_;
+    size_t count_;
+    size_t bins_;
+    size_t finite_ = 0;
+    float min_ = 0.0f;
+    float max_ = 0.0f;
+};
+
+// Throws std::runtime_error if the file cannot be written.
+void write_gray_png(const std::string &filename, const uint16_t *pixels, size_t cols, size_t rows, int bit_depth);
+void write_gray_pgm(const std::string &filename, const uint16_t *pixels, size_t cols, size_t rows, int bit_depth);
@@ -0,0 +1,407 @@
+#include "image_meta.h"
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+namespace
+{
+    class MetaParser
+    {
+    public:
+        MetaParser(std::string_view xml)
+            : s_(xml), pos_(0)
+        {
+        }
+
+        void Parse(ImageMeta &meta)
+        {
+            SkipMisc();
+            if (AtEnd())
+            {
+                return;
+            }
+
+            if (!StartTag("ismrmrdMeta"))
+            {
+                SkipMisc();
+                Expect(AtEnd());
+                return;
+            }
+
+            meta.reserve(meta.size() + Count("<meta", pos_, s_.size()));
+
+            while (true)
+            {
+                SkipMisc();
+                if (EndTag("ismrmrdMeta"))
+                {
+                    break;
+                }
+
+                Expect(StartTag("meta"));
+                SkipMisc();
+
+                std::string name;
+                Expect(Element("name", name));
+
+                auto &values = meta[name];
+                auto meta_end = s_.find("</meta", pos_);
+                Expect(meta_end != std::string_view::npos);
+                values.reserve(values.size() + Count("<value", pos_, meta_end));
+
+                while (true)
+                {
+                    SkipMisc();
+                    if (EndTag("meta"))
+                    {
+                        break;
+                    }
+
+                    std::string value;
+                    Expect(Element("value", value));
+                    values.push_back(std::move(value));
+                }
+            }
+
+            SkipMisc();
+            Expect(AtEnd());
+        }
+
+    private:
+        bool AtEnd() const
+        {
+            return pos_ >= s_.size();
+        }
+
+        bool StartsWith(std::string_view prefix) const
+        {
+            return s_.substr(pos_, prefix.size()) == prefix;
+        }
+
+        void Expect(bool condition) const
+        {
+            if (!condition)
+            {
+                throw std::runtime_error("Malformed ISMRMRD meta XML at offset " + std::to_string(pos_));
+            }
+        }
+
+        size_t Count(std::string_view needle, size_t from, size_t to) const
+        {
+            size_t n = 0;
+            for (auto p = s_.find(needle, from); p < to; p = s_.find(needle, p + needle.size()))
+            {
+                n++;
+            }
+            return n;
+        }
+
+        void SkipWhitespace()
+        {
+            while (!AtEnd() && (s_[pos_] == ' ' || s_[pos_] == '\t' || s_[pos_] == '\n' || s_[pos_] == '\r'))
+            {
+                pos_++;
+            }
+        }
+
+        // Skips whitespace, the XML declaration, processing instructions and comments.
+        void SkipMisc()
+        {
+            while (true)
+            {
+                SkipWhitespace();
+                if (StartsWith("<?"))
+                {
+                    SkipPast("?>");
+                }
+                else if (StartsWith("<!--"))
+                {
+                    SkipPast("-->");
+                }
+                else
+                {
+                    return;
+                }
+            }
+        }
+
+        void SkipPast(std::string_view terminator)
+        {
+            auto p = s_.find(terminator, pos_);
+            Expect(p != std::string_view::npos);
+            pos_ = p + terminator.size();
+        }
+
+        // Consumes <tag> or <tag/>. Returns false for the empty element form.
+        bool StartTag(std::string_view tag)
+        {
+            Expect(StartsWith("<") && s_.substr(pos_ + 1, tag.size()) == tag);
+            pos_ += 1 + tag.size();
+            SkipWhitespace();
+            if (StartsWith("/>"))
+            {
+                pos_ += 2;
+                return false;
+            }
+            Expect(StartsWith(">"));
+            pos_++;
+            return true;
+        }
+
+        // Consumes </tag> if it is next in the input.
+        bool EndTag(std::string_view tag)
+        {
+            if (!StartsWith("</") || s_.substr(pos_ + 2, tag.size()) != tag)
+            {
+                return false;
+            }
+            pos_ += 2 + tag.size();
+            SkipWhitespace();
+            Expect(StartsWith(">"));
+            pos_++;
+            return true;
+        }
+
+        // Consumes <tag>text</tag> or <tag/> and stores the decoded text.
+        bool Element(std::string_view tag, std::string &text)
+        {
+            if (!StartsWith("<") || s_.substr(pos_ + 1, tag.size()) != tag)
+            {
+                return false;
+            }
+
+            if (!StartTag(tag))
+            {
+                return true;
+            }
+
+            while (!EndTag(tag))
+            {
+                Expect(!AtEnd());
+                if (StartsWith("<![CDATA["))
+                {
+                    auto begin = pos_ + 9;
+                    SkipPast("]]>");
+                    text.append(s_.substr(begin, pos_ - 3 - begin));
+                }
+                else if (StartsWith("<!--"))
+                {
+                    SkipPast("-->");
+                }
+                else if (StartsWith("<"))
+                {
+                    // Nested elements and mismatched end tags are not valid here.
+                    Expect(false);
+                }
+                else
+                {
+                    auto end = std::min(s_.find('<', pos_), s_.size());
+                    AppendDecoded(s_.substr(pos_, end - pos_), text);
+                    pos_ = end;
+                }
+            }
+
+            // Like pugixml, text consisting only of whitespace is dropped.
+            if (text.find_first_not_of(" \t\n\r") == std::string::npos)
+            {
+                text.clear();
+            }
+            return true;
+        }
+
+        // Appends character data, replacing entity and character references and normalizing line endings.
+        void AppendDecoded(std::string_view raw, std::string &out) const
+        {
+            out.reserve(out.size() + raw.size());
+            for (size_t i = 0; i < raw.size(); i++)
+            {
+                char c = raw[i];
+                if (c == '&')
+                {
+                    auto end = raw.find(';', i);
+                    Expect(end != std::string_view::npos);
+                    AppendEntity(raw.substr(i + 1, end - i - 1), out);
+                    i = end;
+                }
+                else if (c == '\r')
+                {
+                    out.push_back('\n');
+                    if (i + 1 < raw.size() && raw[i + 1] == '\n')
+                    {
+                        i++;
+                    }
+                }
+                else
+                {
+                    out.push_back(c);
+                }
+            }
+        }
+
+        void AppendEntity(std::string_view entity, std::string &out) const
+        {
+            if (entity == "amp")
+            {
+                out.push_back('&');
+            }
+            else if (entity == "lt")
+            {
+                out.push_back('<');
+            }
+            else if (entity == "gt")
+            {
+                out.push_back('>');
+            }
+            else if (entity == "quot")
+            {
+                out.push_back('"');
+            }
+            else if (entity == "apos")
+            {
+                out.push_back('\'');
+            }
+            else
+            {
+                Expect(entity.size() > 1 && entity[0] == '#');
+                bool hex = entity[1] == 'x';
+                auto digits = entity.substr(hex ? 2 : 1);
+                Expect(!digits.empty());
+                uint32_t cp = 0;
+                for (char d : digits)
+                {
+                    uint32_t v;
+                    if (d >= '0' && d <= '9')
+                    {
+                        v = d - '0';
+                    }
+                    else if (hex && d >= 'a' && d <= 'f')
+                    {
+                        v = d - 'a' + 10;
+                    }
+                    else if (hex && d >= 'A' && d <= 'F')
+                    {
+                        v = d - 'A' + 10;
+                    }
+                    else
+                    {
+                        v = 16;
+                    }
+                    Expect(v < (hex ? 16u : 10u) && cp <= 0x10FFFF);
+                    cp = cp * (hex ? 16 : 10) + v;
+                }
+                AppendUtf8(cp, out);
+            }
+        }
+
+        void AppendUtf8(uint32_t cp, std::string &out) const
+        {
+            Expect(cp <= 0x10FFFF);
+            if (cp < 0x80)
+            {
+                out.push_back(static_cast<char>(cp));
+            }
+            else if (cp < 0x800)
+            {
+                out.push_back(static_cast<char>(0xC0 | (cp >> 6)));
+                out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+            }
+            else if (cp < 0x10000)
+            {
+                out.push_back(static_cast<char>(0xE0 | (cp >> 12)));
+                out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+                out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+            }
+            else
+            {
+                out.push_back(static_cast<char>(0xF0 | (cp >> 18)));
+                out.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+                out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+                out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+            }
+        }
+
+        std::string_view s_;
+        size_t pos_;
+    };
+
+    // Escapes character data the way pugixml does for PCDATA.
+    void append_escaped(const std::string &text, std::string &out)
+    {
+        for (char c : text)
+        {
+            unsigned char uc = static_cast<unsigned char>(c);
+            if (c == '&')
+            {
+                out += "&amp;";
+            }
+            else if (c == '<')
+            {
+                out += "&lt;";
+            }
+            else if (c == '>')
+            {
+                out += "&gt;";
+            }
+            else if (uc < 32 && c != '\t' && c != '\n' && c != '\r')
+            {
+                out += "&#";
+                out.push_back(static_cast<char>('0' + uc / 10));
+                out.push_back(static_cast<char>('0' + uc % 10));
+                out.push_back(';');
+            }
+            else
+            {
+                out.push_back(c);
+            }
+        }
+    }
+}
+
+void parse_meta_xml(std::string_view xml, ImageMeta &meta)
+{
+    MetaParser(xml).Parse(meta);
+}
+
+std::string format_meta_xml(const ImageMeta &meta)
+{
+    std::string out = "<?xml version=\"1.0\"?>\n";
+    if (meta.empty())
+    {
+        out += "<ismrmrdMeta />\n";
+        return out;
+    }
+
+    // ISMRMRD::MetaContainer is an ordered map, so entries are written sorted by name.
+    std::vector<const ImageMeta::value_type *> entries;
+    entries.reserve(meta.size());
+    size_t size = out.size() + 32;
+    for (auto &entry : meta)
+    {
+        entries.push_back(&entry);
+        size += 32 + entry.first.size();
+        for (auto &value : entry.second)
+        {
+            size += 20 + value.size();
+        }
+    }
+    std::sort(entries.begin(), entries.end(), [](auto a, auto b)
+              { return a->first < b->first; });
+
+    out.reserve(size);
+    out += "<ismrmrdMeta>\n";
+    for (auto entry : entries)
+    {
+        out += "\t<meta>\n\t\t<name>";
+        append_escaped(entry->first, out);
+        out += "</name>\n";
+        for (auto &value : entry->second)
+        {
+            out += "\t\t<value>";
+            append_escaped(value, out);
+            out += "</value>\n";
+        }
+        out += "\t</meta>\n";
+    }
+    out += "</ismrmrdMeta>\n";
+    return out;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "generated/types.h"
+#include <string>
+#include <string_view>
+
+// Direct conversion between the ISMRMRD image attribute string (the XML written by
+// ISMRMRD::serialize(MetaContainer)) and mrd::Image<T>::meta, without building an
+// ISMRMRD::MetaContainer or a pugixml document.
+//
+// The format is:
+//   <?xml version="1.0"?>
+//   <ismrmrdMeta>
+//       <meta>
+//           <name>...</name>
+//           <value>...</value>
+//           ...
+//       </meta>
+//       ...
+//   </ismrmrdMeta>
+
+using ImageMeta = decltype(mrd::Image<float>::meta);
+
+// Parses the attribute string and appends its values to meta. An empty string yields no entries.
+// Throws std::runtime_error if the string is not a well formed ISMRMRD meta document.
+void parse_meta_xml(std::string_view xml, ImageMeta &meta);
+
+// Serializes meta to an attribute string. The output is identical to ISMRMRD::serialize(MetaContainer),
+// i.e. names are sorted and the document is indented like pugixml's default output.
+std::string format_meta_xml(const ImageMeta &meta);
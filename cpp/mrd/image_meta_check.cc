@@ -0,0 +1,178 @@
+#include "image_meta.h"
+#include "check.h"
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <ismrmrd/meta.h>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Checks that image_meta.h reads and writes the same attribute strings as the ISMRMRD::MetaContainer
+// conversion it replaced, and with --benchmark, compares their speed on meta-heavy images.
+
+namespace
+{
+    // The MetaContainer based conversion used before image_meta.h.
+    ImageMeta reference_parse(const std::string &xml)
+    {
+        ImageMeta meta;
+        ISMRMRD::MetaContainer container;
+        ISMRMRD::deserialize(xml.c_str(), container);
+        for (auto it = container.begin(); it != container.end(); it++)
+        {
+            for (auto it2 = it->second.begin(); it2 != it->second.end(); it2++)
+            {
+                meta[it->first].push_back(it2->as_str());
+            }
+        }
+        return meta;
+    }
+
+    std::string reference_format(const ImageMeta &meta)
+    {
+        ISMRMRD::MetaContainer container;
+        for (auto it = meta.begin(); it != meta.end(); it++)
+        {
+            for (auto it2 = it->second.begin(); it2 != it->second.end(); it2++)
+            {
+                container.append(it->first.c_str(), (*it2).c_str());
+            }
+        }
+        std::stringstream ss;
+        ISMRMRD::serialize(container, ss);
+        return ss.str();
+    }
+
+    ImageMeta parse(const std::string &xml)
+    {
+        ImageMeta meta;
+        parse_meta_xml(xml, meta);
+        return meta;
+    }
+
+    using check::expect;
+    using check::throws;
+
+    // Meta of a typical reconstructed image, with names and values that need escaping.
+    ImageMeta sample_meta()
+    {
+        ImageMeta meta;
+        meta["DataRole"] = {"Image"};
+        meta["ImageProcessingHistory"] = {"FFT", "COMBINE", "SCALE"};
+        meta["WindowCenter"] = {"512"};
+        meta["WindowWidth"] = {"1024.5"};
+        meta["GADGETRON_ImageComment"] = {"T1 map <ms> & \"fit\" 'quality'"};
+        meta["Multiline"] = {"first line\nsecond line\ttabbed"};
+        meta["Unicode"] = {"\xc2\xb5s", "\xe2\x80\x93"};
+        meta["Control"] = {std::string("bell\x07") + "escape\x1b"};
+        meta["a&b<c>"] = {"name needs escaping"};
+        meta["slice_position"] = {"-12.5", "3.25", "100"};
+        return meta;
+    }
+
+    // Many entries with several numeric values each, as written by reconstructions that store
+    // per-image parameters in the meta.
+    ImageMeta heavy_meta(size_t entries)
+    {
+        ImageMeta meta;
+        for (size_t i = 0; i < entries; i++)
+        {
+            auto &values = meta["Parameter_" + std::to_string(i)];
+            for (size_t j = 0; j < 4; j++)
+            {
+                values.push_back(std::to_string(i * 0.125 + j));
+            }
+        }
+        return meta;
+    }
+
+    void check_roundtrip(const ImageMeta &meta, const std::string &what)
+    {
+        auto reference_xml = reference_format(meta);
+        auto xml = format_meta_xml(meta);
+        expect(xml == reference_xml, what + ": format_meta_xml matches ISMRMRD::serialize");
+        expect(parse(reference_xml) == meta, what + ": parse_meta_xml reads ISMRMRD::serialize output");
+        expect(reference_parse(xml) == meta, what + ": ISMRMRD::deserialize reads format_meta_xml output");
+        expect(parse(xml) == reference_parse(reference_xml), what + ": parse_meta_xml matches ISMRMRD::deserialize");
+    }
+
+    void check_malformed()
+    {
+        for (std::string xml : {"<ismrmrdMeta><meta><name>a</name>",
+                                "<ismrmrdMeta><meta><value>1</value></meta></ismrmrdMeta>",
+                                "<ismrmrdMeta><meta><name>a</name><value>1</meta></ismrmrdMeta>",
+                                "<ismrmrdMeta><meta><name>a</name><value>&bogus;</value></meta></ismrmrdMeta>",
+                                "<ismrmrdMeta><meta><name>a</name><value>&#xZZ;</value></meta></ismrmrdMeta>",
+                                "<ismrmrdMeta></ismrmrdMeta>trailing",
+                                "<other/>"})
+        {
+            expect(throws([&]
+                          { parse(xml); }),
+                   "parse_meta_xml rejects \"" + xml + "\"");
+        }
+
+        expect(parse("").empty(), "an empty attribute string has no entries");
+        expect(parse("<?xml version=\"1.0\"?>\n<ismrmrdMeta />\n").empty(), "an empty document has no entries");
+        expect(parse("<ismrmrdMeta><meta><name>a</name><value><![CDATA[<x>]]></value></meta></ismrmrdMeta>") == ImageMeta{{"a", {"<x>"}}},
+               "CDATA is read as text");
+    }
+
+    template <typename F>
+    double time_per_call(size_t iterations, F f)
+    {
+        size_t sink = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < iterations; i++)
+        {
+            sink += f();
+        }
+        std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+        check::benchmark_sink = check::benchmark_sink + sink;
+        return elapsed.count() / iterations;
+    }
+
+    void benchmark(size_t iterations)
+    {
+        for (size_t entries : {10, 100, 500})
+        {
+            auto meta = heavy_meta(entries);
+            auto xml = format_meta_xml(meta);
+            auto report = [&](const char *operation, double reference_us, double direct_us)
+            {
+                std::cout << operation << " (" << entries << " entries, " << xml.size() << " bytes): MetaContainer "
+                          << reference_us << " us, direct " << direct_us << " us (" << reference_us / direct_us << "x)" << std::endl;
+            };
+
+            report("ISMRMRD -> MRD",
+                   time_per_call(iterations, [&]
+                                 { return reference_parse(xml).size(); }),
+                   time_per_call(iterations, [&]
+                                 { return parse(xml).size(); }));
+            report("MRD -> ISMRMRD",
+                   time_per_call(iterations, [&]
+                                 { return reference_format(meta).size(); }),
+                   time_per_call(iterations, [&]
+                                 { return format_meta_xml(meta).size(); }));
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    check_roundtrip(ImageMeta{}, "empty meta");
+    check_roundtrip(sample_meta(), "sample meta");
+    check_roundtrip(heavy_meta(500), "500 entries");
+    check_malformed();
+    if (check::failures > 0)
+    {
+        std::cerr << check::failures << " image meta checks failed" << std::endl;
+        return 1;
+    }
+
+    if (argc > 1 && std::strcmp(argv[1], "--benchmark") == 0)
+    {
+        benchmark(argc > 2 ? std::stoul(argv[2]) : 1000);
+    }
+    return 0;
+}
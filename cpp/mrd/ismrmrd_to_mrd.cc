@@ -1,42 +1,23 @@
 #include "generated/binary/protocols.h"
+#include "channel_mask.h"
+#include "date_time.h"
+#include "fd_stream.h"
+#include "header_cache.h"
+#include "image_meta.h"
+#include "stream_server.h"
+#include <chrono>
 #include <filesystem>
 #include <iostream>
+#include <mutex>
+#include <thread>
 #include <exception>
 #include <ismrmrd/dataset.h>
-#include <ismrmrd/meta.h>
 #include <ismrmrd/serialization_iostream.h>
 #include <ismrmrd/xml.h>
 #include <ismrmrd/version.h>
+#include <unistd.h>
 #include <xtensor/xview.hpp>
 
-yardl::Date date_from_string(const std::string &s)
-{
-    std::stringstream ss{s};
-    yardl::Date d;
-    ss >> date::parse("%F", d);
-
-    if (ss.fail())
-    {
-        throw std::runtime_error("invalid date format");
-    }
-
-    return d;
-}
-
-yardl::Time time_from_string(const std::string &s)
-{
-    std::stringstream ss{s};
-    yardl::Time t;
-    ss >> date::parse("%T", t);
-
-    if (ss.fail())
-    {
-        throw std::runtime_error("invalid time format");
-    }
-
-    return t;
-};
-
 // Convert ISMRMRD::SubjectInformation to mrd::SubjectInformationType
 mrd::SubjectInformationType convert(ISMRMRD::SubjectInformation &subjectInformation)
 {
@@ -1017,7 +998,17 @@ mrd::Acquisition convert(ISMRMRD::Acquisition &acq)
         acquisition.physiology_time_stamp.push_back(p);
     }
 
-    // TODO: Convert channel_mask to channel_order
+    channel_order_from_mask(acq.getHead().channel_mask, acquisition.channel_order);
+    if (!channel_order_matches(acquisition.channel_order, acq.active_channels()))
+    {
+        // A channel_order that does not match the rows of data would make consumers skip the wrong
+        // channels, so the mask is dropped.
+        static std::once_flag warned;
+        std::call_once(warned, [&]
+                       { std::cerr << "Warning: ignoring channel masks that do not match the number of active channels ("
+                                   << acquisition.channel_order.size() << " channels set, " << acq.active_channels() << " active)" << std::endl; });
+        acquisition.channel_order.clear();
+    }
 
     acquisition.discard_pre = acq.discard_pre();
     acquisition.discard_post = acq.discard_post();
@@ -1193,38 +1184,86 @@ mrd::Image<T> convert(ISMRMRD::Image<T> &im)
 
     image.data = xt::view(data, xt::all(), xt::all(), xt::all(), xt::all());
 
-    ISMRMRD::MetaContainer meta;
-    ISMRMRD::deserialize(im.getAttributeString(), meta);
-
-    for (auto it = meta.begin(); it != meta.end(); it++)
+    if (im.getAttributeStringLength() > 0)
     {
-        for (auto it2 = it->second.begin(); it2 != it->second.end(); it2++)
-        {
-            image.meta[it->first].push_back(it2->as_str());
-        }
+        parse_meta_xml(std::string_view(im.getAttributeString(), im.getAttributeStringLength()), image.meta);
     }
 
     return image;
 }
 
-int main()
+// The ISMRMRD protocol header message is a uint16 message id followed by a uint32 length and the XML text.
+// It is read here rather than with ISMRMRD::ProtocolDeserializer so that the raw XML can be used as the
+// header cache key before it is parsed. Returns std::nullopt if the stream does not start with a header.
+std::optional<std::string> read_header_xml(std::istream &is)
 {
-    ISMRMRD::IStreamView rs(std::cin);
-    ISMRMRD::ProtocolDeserializer deserializer(rs);
-    mrd::binary::MrdWriter w(std::cout);
+    if (is.peek() != ISMRMRD::ISMRMRD_MESSAGE_HEADER)
+    {
+        return std::nullopt;
+    }
+
+    uint16_t id;
+    uint32_t size;
+    is.read(reinterpret_cast<char *>(&id), sizeof(id));
+    is.read(reinterpret_cast<char *>(&size), sizeof(size));
+    if (!is || id != ISMRMRD::ISMRMRD_MESSAGE_HEADER)
+    {
+        throw std::runtime_error("Failed to read ISMRMRD header message");
+    }
+
+    std::string xml(size, '\0');
+    is.read(xml.data(), size);
+    if (!is)
+    {
+        throw std::runtime_error("Failed to read ISMRMRD header XML");
+    }
+
+    return xml;
+}
+
+mrd::Header convert_header_xml(const std::string &xml)
+{
+    ISMRMRD::IsmrmrdHeader hdr;
+    ISMRMRD::deserialize(xml.c_str(), hdr);
+    return convert(hdr);
+}
+
+void print_usage(std::string program_name)
+{
+    std::cerr << "Usage: " << program_name << std::endl;
+    std::cerr << "  -c|--header-cache <directory>" << std::endl;
+    std::cerr << "  -b|--buffer-size  <output buffer size in bytes>" << std::endl;
+    std::cerr << "  -v|--verbose" << std::endl;
+    print_server_usage();
+    std::cerr << "  -h|--help" << std::endl;
+}
+
+// Converts one ISMRMRD stream read from in to an MRD stream written to out.
+int convert_stream(std::istream &in, std::ostream &out, HeaderCache &cache, bool verbose)
+{
+    mrd::binary::MrdWriter w(out);
 
     // Some reconstructions return the header but it is not required.
-    if (deserializer.peek() == ISMRMRD::ISMRMRD_MESSAGE_HEADER)
+    auto xml = read_header_xml(in);
+    if (xml)
     {
-        ISMRMRD::IsmrmrdHeader hdr;
-        deserializer.deserialize(hdr);
-        w.WriteHeader(convert(hdr));
+        auto start = std::chrono::steady_clock::now();
+        auto [header, cached] = cache.GetOrConvert(*xml, convert_header_xml);
+        if (verbose)
+        {
+            auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+            std::cerr << "Header conversion took " << elapsed.count() << " us (" << (cached ? "cached" : "not cached") << ")" << std::endl;
+        }
+        w.WriteHeader(header);
     }
     else
     {
         w.WriteHeader(std::nullopt);
     }
 
+    ISMRMRD::IStreamView rs(in);
+    ISMRMRD::ProtocolDeserializer deserializer(rs);
+
     while (deserializer.peek() != ISMRMRD::ISMRMRD_MESSAGE_CLOSE)
     {
         if (deserializer.peek() == ISMRMRD::ISMRMRD_MESSAGE_ACQUISITION)
@@ -1305,3 +1344,131 @@ int main()
 
     return 0;
 }
+
+int main(int argc, char **argv)
+{
+    std::optional<std::filesystem::path> header_cache_dir;
+    size_t buffer_size = kDefaultOutputBufferSize;
+    std::optional<std::string> server_address;
+    size_t threads = std::thread::hardware_concurrency();
+    bool verbose = false;
+
+    std::vector<std::string> args(argv, argv + argc);
+    auto current_arg = args.begin() + 1;
+    while (current_arg != args.end())
+    {
+        if (*current_arg == "--help" || *current_arg == "-h")
+        {
+            print_usage(args[0]);
+            return 0;
+        }
+        else if (*current_arg == "--header-cache" || *current_arg == "-c")
+        {
+            current_arg++;
+            if (current_arg == args.end())
+            {
+                std::cerr << "Missing header cache directory" << std::endl;
+                print_usage(args[0]);
+                return 1;
+            }
+            header_cache_dir = *current_arg;
+            current_arg++;
+        }
+        else if (*current_arg == "--buffer-size" || *current_arg == "-b")
+        {
+            current_arg++;
+            if (current_arg == args.end())
+            {
+                std::cerr << "Missing buffer size" << std::endl;
+                print_usage(args[0]);
+                return 1;
+            }
+            try
+            {
+                buffer_size = parse_buffer_size(*current_arg);
+            }
+            catch (const std::invalid_argument &e)
+            {
+                std::cerr << e.what() << std::endl;
+                print_usage(args[0]);
+                return 1;
+            }
+            current_arg++;
+        }
+        else if (*current_arg == "--verbose" || *current_arg == "-v")
+        {
+            verbose = true;
+            current_arg++;
+        }
+        else if (*current_arg == "--server" || *current_arg == "-s")
+        {
+            current_arg++;
+            if (current_arg == args.end())
+            {
+                std::cerr << "Missing server address" << std::endl;
+                print_usage(args[0]);
+                return 1;
+            }
+            try
+            {
+                check_server_address(*current_arg);
+            }
+            catch (const std::invalid_argument &e)
+            {
+                std::cerr << e.what() << std::endl;
+                print_usage(args[0]);
+                return 1;
+            }
+            server_address = *current_arg;
+            current_arg++;
+        }
+        else if (*current_arg == "--threads" || *current_arg == "-t")
+        {
+            current_arg++;
+            if (current_arg == args.end())
+            {
+                std::cerr << "Missing number of threads" << std::endl;
+                print_usage(args[0]);
+                return 1;
+            }
+            try
+            {
+                threads = parse_server_threads(*current_arg);
+            }
+            catch (const std::invalid_argument &e)
+            {
+                std::cerr << e.what() << std::endl;
+                print_usage(args[0]);
+                return 1;
+            }
+            current_arg++;
+        }
+        else
+        {
+            std::cerr << "Unknown argument: " << *current_arg << std::endl;
+            print_usage(args[0]);
+            return 1;
+        }
+    }
+
+    // The header cache is shared by all connections.
+    HeaderCache cache(header_cache_dir);
+
+    if (server_address)
+    {
+        try
+        {
+            run_stream_server(*server_address, threads, buffer_size, [&](std::istream &in, std::ostream &out)
+                              { convert_stream(in, out, cache, verbose); });
+        }
+        catch (const std::runtime_error &e)
+        {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    }
+
+    FdOutputStream out(STDOUT_FILENO, buffer_size);
+    int result = convert_stream(std::cin, out, cache, verbose);
+    return out.Finish() ? result : 1;
+}
@@ -0,0 +1,87 @@
+#include "mapped_file.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+    // Bytes requested ahead of the read position, and the granularity at which pages behind it are dropped.
+    constexpr size_t kReadAheadWindow = 32 << 20;
+    constexpr size_t kReleaseGranularity = 64 << 20;
+
+    size_t page_align_down(size_t offset)
+    {
+        static const size_t page_size = sysconf(_SC_PAGESIZE);
+        return offset - offset % page_size;
+    }
+}
+
+MappedFile::MappedFile(const std::string &filename)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        throw std::runtime_error("Failed to open " + filename + ": " + std::strerror(errno));
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+    {
+        int error = errno;
+        close(fd);
+        throw std::runtime_error("Failed to stat " + filename + ": " + std::strerror(error));
+    }
+
+    size_ = st.st_size;
+    if (size_ > 0)
+    {
+        void *data = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED)
+        {
+            int error = errno;
+            close(fd);
+            throw std::runtime_error("Failed to map " + filename + ": " + std::strerror(error));
+        }
+        data_ = static_cast<const char *>(data);
+        madvise(data, size_, MADV_SEQUENTIAL);
+    }
+
+    // The mapping stays valid after the descriptor is closed.
+    close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+    if (data_)
+    {
+        munmap(const_cast<char *>(data_), size_);
+    }
+}
+
+void MappedFile::AdviseSequential(size_t offset, size_t release_before)
+{
+    if (!data_)
+    {
+        return;
+    }
+
+    // Advice is only a hint, so failures are ignored.
+    if (offset + kReadAheadWindow / 2 > read_ahead_ && read_ahead_ < size_)
+    {
+        auto start = page_align_down(std::max(read_ahead_, offset));
+        read_ahead_ = std::min(size_, offset + kReadAheadWindow);
+        madvise(const_cast<char *>(data_) + start, read_ahead_ - start, MADV_WILLNEED);
+    }
+
+    release_before = page_align_down(std::min(release_before, size_));
+    if (release_before >= released_ + kReleaseGranularity)
+    {
+        madvise(const_cast<char *>(data_) + released_, release_before - released_, MADV_DONTNEED);
+        released_ = release_before;
+    }
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Read-only memory mapping of a whole file. Mapped pages are shared with the page cache, so several
+// processes reading the same file use a single copy of it.
+
+class MappedFile
+{
+public:
+    // Throws std::runtime_error if the file cannot be opened or mapped.
+    explicit MappedFile(const std::string &filename);
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    const char *Data() const
+    {
+        return data_;
+    }
+
+    size_t Size() const
+    {
+        return size_;
+    }
+
+    // Hints that the file is read front to back: asks the kernel to read ahead of offset,
+    // and to drop pages before release_before from this process. Dropped pages stay in the
+    // page cache and are mapped again if they are accessed.
+    void AdviseSequential(size_t offset, size_t release_before);
+
+private:
+    const char *data_ = nullptr;
+    size_t size_ = 0;
+    size_t released_ = 0;
+    size_t read_ahead_ = 0;
+};
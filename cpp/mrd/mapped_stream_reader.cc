@@ -0,0 +1,350 @@
+#include "mapped_stream_reader.h"
+#include "binary_format.h"
+#include "binary_stream_scanner.h"
+#include "generated/binary/protocols.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <stdexcept>
+#include <streambuf>
+#include <type_traits>
+
+namespace
+{
+    // Input buffer over memory that is not owned.
+    class MemoryBuffer : public std::streambuf
+    {
+    public:
+        MemoryBuffer(const char *data, size_t size)
+        {
+            auto begin = const_cast<char *>(data);
+            setg(begin, begin, begin + size);
+        }
+    };
+
+    // Decodes values of the binary format from a mapped stream.
+    class Cursor : public BinaryDecoder<Cursor>
+    {
+    public:
+        Cursor(const char *data, size_t size, size_t pos)
+            : data_(data), size_(size), pos_(pos)
+        {
+        }
+
+        size_t Position() const
+        {
+            return pos_;
+        }
+
+        uint64_t Offset() const
+        {
+            return pos_;
+        }
+
+        uint8_t Byte()
+        {
+            Require(1);
+            return static_cast<uint8_t>(data_[pos_++]);
+        }
+
+        // Returns a pointer to the next bytes of the stream and moves past them.
+        const char *Take(size_t bytes)
+        {
+            Require(bytes);
+            auto p = data_ + pos_;
+            pos_ += bytes;
+            return p;
+        }
+
+        void Raw(void *values, size_t bytes)
+        {
+            std::memcpy(values, Take(bytes), bytes);
+        }
+
+        void Skip(uint64_t bytes)
+        {
+            Take(bytes);
+        }
+
+    private:
+        void Require(size_t bytes) const
+        {
+            if (bytes > size_ - pos_)
+            {
+                throw std::runtime_error("Unexpected end of MRD stream at offset " + std::to_string(pos_));
+            }
+        }
+
+        const char *data_;
+        size_t size_;
+        size_t pos_;
+    };
+
+    template <typename T, typename Variant>
+    T &get_or_emplace(Variant &v)
+    {
+        if (auto p = std::get_if<T>(&v))
+        {
+            return *p;
+        }
+        return v.template emplace<T>();
+    }
+
+    void read_value(Cursor &c, std::optional<uint32_t> &value)
+    {
+        value = c.OptionalVarint();
+    }
+
+    void read_value(Cursor &c, std::optional<float> &value)
+    {
+        if (c.Byte())
+        {
+            float f;
+            c.Values(&f, 1);
+            value = f;
+        }
+        else
+        {
+            value.reset();
+        }
+    }
+
+    void read_value(Cursor &c, std::vector<uint32_t> &values)
+    {
+        values.resize(c.Varint());
+        for (auto &v : values)
+        {
+            v = static_cast<uint32_t>(c.Varint());
+        }
+    }
+
+    void read_value(Cursor &c, std::vector<int32_t> &values)
+    {
+        values.resize(c.Varint());
+        for (auto &v : values)
+        {
+            v = static_cast<int32_t>(c.Zigzag());
+        }
+    }
+
+    void read_value(Cursor &c, std::vector<float> &values)
+    {
+        values.resize(c.Varint());
+        c.Values(values.data(), values.size());
+    }
+
+    void read_value(Cursor &c, std::string &value)
+    {
+        auto size = c.Varint();
+        value.assign(c.Take(size), size);
+    }
+
+    // Returns a pointer to count values at p, or to a copy of them if p is not suitably aligned.
+    template <typename T>
+    const T *view_or_copy(const char *p, size_t count, std::vector<T> &storage)
+    {
+        if (reinterpret_cast<uintptr_t>(p) % alignof(T) == 0)
+        {
+            return reinterpret_cast<const T *>(p);
+        }
+        storage.resize(count);
+        std::memcpy(storage.data(), p, count * sizeof(T));
+        return storage.data();
+    }
+
+    void read_acquisition(Cursor &c, AcquisitionView &view)
+    {
+        auto &a = view.head;
+        a.flags = c.Varint();
+        read_value(c, a.idx.kspace_encode_step_1);
+        read_value(c, a.idx.kspace_encode_step_2);
+        read_value(c, a.idx.average);
+        read_value(c, a.idx.slice);
+        read_value(c, a.idx.contrast);
+        read_value(c, a.idx.phase);
+        read_value(c, a.idx.repetition);
+        read_value(c, a.idx.set);
+        read_value(c, a.idx.segment);
+        read_value(c, a.idx.user);
+        a.measurement_uid = static_cast<uint32_t>(c.Varint());
+        read_value(c, a.scan_counter);
+        read_value(c, a.acquisition_time_stamp);
+        read_value(c, a.physiology_time_stamp);
+        read_value(c, a.channel_order);
+        read_value(c, a.discard_pre);
+        read_value(c, a.discard_post);
+        read_value(c, a.center_sample);
+        read_value(c, a.encoding_space_ref);
+        read_value(c, a.sample_time_us);
+        c.Values(a.position.data(), 3);
+        c.Values(a.read_dir.data(), 3);
+        c.Values(a.phase_dir.data(), 3);
+        c.Values(a.slice_dir.data(), 3);
+        c.Values(a.patient_table_position.data(), 3);
+        read_value(c, a.user_int);
+        read_value(c, a.user_float);
+
+        view.data_shape = c.ArrayShape<2>();
+        auto samples = view.data_shape[0] * view.data_shape[1];
+        view.data = view_or_copy(c.Take(samples * sizeof(std::complex<float>)), samples, view.aligned_data);
+
+        view.trajectory_shape = c.ArrayShape<2>();
+        samples = view.trajectory_shape[0] * view.trajectory_shape[1];
+        view.trajectory = view_or_copy(c.Take(samples * sizeof(float)), samples, view.aligned_trajectory);
+    }
+
+    void read_waveform(Cursor &c, mrd::Waveform<uint32_t> &w)
+    {
+        w.flags = c.Varint();
+        w.measurement_uid = static_cast<uint32_t>(c.Varint());
+        w.scan_counter = static_cast<uint32_t>(c.Varint());
+        w.time_stamp = static_cast<uint32_t>(c.Varint());
+        c.Values(&w.sample_time_us, 1);
+        w.waveform_id = static_cast<uint32_t>(c.Varint());
+        w.data.resize(c.ArrayShape<2>());
+        c.Values(w.data.data(), w.data.size());
+    }
+
+    template <typename T>
+    void read_image(Cursor &c, mrd::Image<T> &im)
+    {
+        im.flags = c.Varint();
+        im.measurement_uid = static_cast<uint32_t>(c.Varint());
+        c.Values(im.field_of_view.data(), 3);
+        c.Values(im.position.data(), 3);
+        c.Values(im.col_dir.data(), 3);
+        c.Values(im.line_dir.data(), 3);
+        c.Values(im.slice_dir.data(), 3);
+        c.Values(im.patient_table_position.data(), 3);
+        read_value(c, im.average);
+        read_value(c, im.slice);
+        read_value(c, im.contrast);
+        read_value(c, im.phase);
+        read_value(c, im.repetition);
+        read_value(c, im.set);
+        read_value(c, im.acquisition_time_stamp);
+        for (auto &t : im.physiology_time_stamp)
+        {
+            t = static_cast<uint32_t>(c.Varint());
+        }
+        im.image_type = static_cast<mrd::ImageType>(c.Zigzag());
+        read_value(c, im.image_index);
+        read_value(c, im.image_series_index);
+        read_value(c, im.user_int);
+        read_value(c, im.user_float);
+        im.data.resize(c.ArrayShape<4>());
+        c.Values(im.data.data(), im.data.size());
+
+        im.meta.clear();
+        auto count = c.Varint();
+        im.meta.reserve(count);
+        for (uint64_t i = 0; i < count; i++)
+        {
+            std::string name;
+            read_value(c, name);
+            auto &values = im.meta[name];
+            values.resize(c.Varint());
+            for (auto &value : values)
+            {
+                read_value(c, value);
+            }
+        }
+    }
+}
+
+mrd::Acquisition AcquisitionView::ToAcquisition() const
+{
+    mrd::Acquisition a = head;
+    a.data.resize(data_shape);
+    std::copy(data, data + a.data.size(), a.data.data());
+    a.trajectory.resize(trajectory_shape);
+    std::copy(trajectory, trajectory + a.trajectory.size(), a.trajectory.data());
+    return a;
+}
+
+MappedStreamReader::MappedStreamReader(const std::string &filename)
+    : file_(filename)
+{
+    MemoryBuffer buffer(file_.Data(), file_.Size());
+    std::istream in(&buffer);
+    {
+        mrd::binary::MrdReader r(in);
+        r.ReadHeader(header_);
+    }
+
+    // The items start right after the preamble, which is as long as its re-encoding.
+    auto preamble = serialize_stream_preamble(header_);
+    if (preamble.size() > file_.Size() || std::memcmp(preamble.data(), file_.Data(), preamble.size()) != 0)
+    {
+        throw std::runtime_error("Unexpected encoding of the MRD stream header in " + filename);
+    }
+    pos_ = preamble.size();
+}
+
+bool MappedStreamReader::ReadData(MappedStreamItem &item)
+{
+    if (at_end_)
+    {
+        return false;
+    }
+
+    Cursor c(file_.Data(), file_.Size(), pos_);
+    while (items_left_in_block_ == 0)
+    {
+        items_left_in_block_ = c.Varint();
+        if (items_left_in_block_ == 0)
+        {
+            at_end_ = true;
+            return false;
+        }
+    }
+
+    auto item_start = c.Position();
+    auto type = c.Varint();
+    if (type == 0)
+    {
+        read_acquisition(c, get_or_emplace<AcquisitionView>(item));
+    }
+    else
+    {
+        auto &decoded = get_or_emplace<mrd::StreamItem>(item);
+        switch (type)
+        {
+        case 1:
+            read_waveform(c, get_or_emplace<mrd::Waveform<uint32_t>>(decoded));
+            break;
+        case 2:
+            read_image(c, get_or_emplace<mrd::Image<uint16_t>>(decoded));
+            break;
+        case 3:
+            read_image(c, get_or_emplace<mrd::Image<int16_t>>(decoded));
+            break;
+        case 4:
+            read_image(c, get_or_emplace<mrd::Image<uint32_t>>(decoded));
+            break;
+        case 5:
+            read_image(c, get_or_emplace<mrd::Image<int32_t>>(decoded));
+            break;
+        case 6:
+            read_image(c, get_or_emplace<mrd::Image<float>>(decoded));
+            break;
+        case 7:
+            read_image(c, get_or_emplace<mrd::Image<double>>(decoded));
+            break;
+        case 8:
+            read_image(c, get_or_emplace<mrd::Image<std::complex<float>>>(decoded));
+            break;
+        case 9:
+            read_image(c, get_or_emplace<mrd::Image<std::complex<double>>>(decoded));
+            break;
+        default:
+            throw std::runtime_error("Unknown item type " + std::to_string(type) + " at offset " + std::to_string(item_start));
+        }
+    }
+
+    items_left_in_block_--;
+    pos_ = c.Position();
+    file_.AdviseSequential(pos_, item_start);
+    return true;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "generated/types.h"
+#include "mapped_file.h"
+#include <array>
+#include <complex>
+#include <optional>
+#include <string>
+#include <variant>
+#include <vector>
+
+// Reader for MRD binary stream files that maps the file into memory instead of reading it through
+// a std::istream. Acquisition data and trajectories are returned as pointers into the mapping, so
+// the samples are never copied. All other items are decoded into the generated types.
+
+// An acquisition whose data and trajectory are not owned. The pointers stay valid until the reader
+// is destroyed, or, for data that had to be copied to meet alignment, until the next acquisition is read.
+struct AcquisitionView
+{
+    // All fields except data and trajectory, which are left empty.
+    mrd::Acquisition head;
+
+    const std::complex<float> *data = nullptr;
+    std::array<size_t, 2> data_shape{}; // coils, samples
+
+    const float *trajectory = nullptr;
+    std::array<size_t, 2> trajectory_shape{}; // basis, samples
+
+    size_t Coils() const
+    {
+        return data_shape[0];
+    }
+
+    size_t Samples() const
+    {
+        return data_shape[1];
+    }
+
+    // Returns an owning copy of the acquisition.
+    mrd::Acquisition ToAcquisition() const;
+
+    // Storage for samples that are not suitably aligned in the mapping.
+    std::vector<std::complex<float>> aligned_data;
+    std::vector<float> aligned_trajectory;
+};
+
+using MappedStreamItem = std::variant<AcquisitionView, mrd::StreamItem>;
+
+class MappedStreamReader
+{
+public:
+    // Throws std::runtime_error if the file cannot be mapped or does not start with a valid MRD header.
+    explicit MappedStreamReader(const std::string &filename);
+
+    const std::optional<mrd::Header> &Header() const
+    {
+        return header_;
+    }
+
+    // Reads the next item. Acquisitions are returned as AcquisitionView, other items as mrd::StreamItem.
+    // Returns false at the end of the stream. Throws std::runtime_error if the stream is malformed.
+    bool ReadData(MappedStreamItem &item);
+
+private:
+    MappedFile file_;
+    std::optional<mrd::Header> header_;
+    size_t pos_ = 0;
+    uint64_t items_left_in_block_ = 0;
+    bool at_end_ = false;
+};
@@ -1,18 +1,148 @@
 #include "generated/binary/protocols.h"
 #include "generated/hdf5/protocols.h"
+#include "stream_index.h"
 #include <filesystem>
 #include <iostream>
+#include <stdexcept>
+
+// Writes the selected items while building the index of the file, which takes a full pass over its items.
+StreamIndex build_index_and_select(const std::string& filename, const IndexSelection& selection, mrd::binary::MrdWriter& w) {
+  mrd::hdf5::MrdReader r(filename);
+  std::optional<mrd::Header> h;
+  r.ReadHeader(h);
+  w.WriteHeader(h);
+
+  StreamIndex index;
+  mrd::StreamItem v;
+  while (r.ReadData(v)) {
+    auto e = make_index_entry(v);
+    e.offset = index.entries.size();
+    index.entries.push_back(e);
+    if (selection.Matches(e, e.offset)) {
+      w.WriteData(v);
+    }
+  }
+  w.EndData();
+  return index;
+}
+
+// Whether the entries of an HDF5 file index are numbered in order, as they are when the index is intact.
+bool index_is_consistent(const StreamIndex& index) {
+  for (size_t i = 0; i < index.entries.size(); i++) {
+    if (index.entries[i].offset != i) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void print_usage(std::string program_name) {
+  std::cerr << "Usage: " << program_name << " [options] <filename>" << std::endl;
+  std::cerr << "  -i|--index <index file> (default: <filename>.mrdidx, built on first use)" << std::endl;
+  std::cerr << "  -h|--help" << std::endl;
+  IndexSelection::PrintUsage();
+}
 
 int main(int argc, char** argv) {
-  if (argc < 2) {
-    std::cerr << "Usage: " << argv[0] << " <filename>" << std::endl;
+  std::string filename;
+  std::optional<std::filesystem::path> index_file;
+  IndexSelection selection;
+
+  std::vector<std::string> args(argv, argv + argc);
+  auto current_arg = args.begin() + 1;
+  while (current_arg != args.end()) {
+    if (*current_arg == "--help" || *current_arg == "-h") {
+      print_usage(args[0]);
+      return 0;
+    } else if (*current_arg == "--index" || *current_arg == "-i") {
+      current_arg++;
+      if (current_arg == args.end()) {
+        std::cerr << "Missing index file" << std::endl;
+        print_usage(args[0]);
+        return 1;
+      }
+      index_file = *current_arg;
+      current_arg++;
+    } else {
+      try {
+        if (selection.ParseArg(current_arg, args.end())) {
+          continue;
+        }
+      } catch (const std::runtime_error& e) {
+        std::cerr << e.what() << std::endl;
+        print_usage(args[0]);
+        return 1;
+      }
+
+      if (filename.empty() && current_arg->rfind("-", 0) != 0) {
+        filename = *current_arg;
+        current_arg++;
+      } else {
+        std::cerr << "Unknown argument: " << *current_arg << std::endl;
+        print_usage(args[0]);
+        return 1;
+      }
+    }
+  }
+
+  if (filename.empty()) {
+    print_usage(args[0]);
     return 1;
   }
 
-  std::string filename = argv[1];
+  if (selection.Empty()) {
+    mrd::hdf5::MrdReader r(filename);
+    mrd::binary::MrdWriter w(std::cout);
+    r.CopyTo(w);
+    return 0;
+  }
+
+  if (!index_file) {
+    index_file = index_path_for(filename);
+  }
 
-  mrd::hdf5::MrdReader r(filename);
   mrd::binary::MrdWriter w(std::cout);
-  r.CopyTo(w);
+
+  auto index = read_stream_index(*index_file, filename);
+  if (index && !index_is_consistent(*index)) {
+    std::cerr << "Ignoring corrupt index " << index_file->string() << std::endl;
+    index.reset();
+  }
+  if (!index) {
+    index = build_index_and_select(filename, selection, w);
+    std::cout.flush();
+
+    // The selected items have been written, so failing to save the index only costs a rebuild next time.
+    try {
+      write_stream_index(*index_file, filename, *index);
+    } catch (const std::exception& e) {
+      std::cerr << "Warning: could not write index " << index_file->string() << ": " << e.what() << std::endl;
+    }
+    return 0;
+  }
+
+  std::vector<uint64_t> selected;
+  for (size_t i = 0; i < index->entries.size(); i++) {
+    if (selection.Matches(index->entries[i], i)) {
+      selected.push_back(i);
+    }
+  }
+
+  // The generated reader only reads items in order, so read in file order, stopping after the last selected item.
+  mrd::hdf5::MrdReader r(filename);
+  std::optional<mrd::Header> h;
+  r.ReadHeader(h);
+  w.WriteHeader(h);
+
+  mrd::StreamItem v;
+  size_t next = 0;
+  for (size_t i = 0; next < selected.size() && r.ReadData(v); i++) {
+    if (i == selected[next]) {
+      w.WriteData(v);
+      next++;
+    }
+  }
+
+  w.EndData();
   return 0;
 }
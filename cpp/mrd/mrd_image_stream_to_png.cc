@@ -1,21 +1,430 @@
 #include "generated/binary/protocols.h"
+#include "image_encoder.h"
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
 #include <filesystem>
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
 #include <Magick++.h>
 #include <fmt/format.h>
+#include <xtensor/xmath.hpp>
 
-// Read a stream of MRD images and write them out at PNG files.
-int main(int argc, char **argv)
+// An image to export, converted to float, with dimensions (channel, slice, row, col).
+struct ExportJob
+{
+    size_t index;
+    xt::xtensor<float, 4> data;
+
+    // Set when the window is estimated over the series rather than from this image alone.
+    std::optional<std::pair<float, float>> window;
+};
+
+// Jobs handed from the reader to the encoding threads. The queue is bounded so that
+// a fast reader does not hold a whole series in memory.
+class ExportQueue
+{
+public:
+    explicit ExportQueue(size_t capacity)
+        : capacity_(capacity)
+    {
+    }
+
+    void Push(ExportJob job)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        changed_.wait(lock, [this]
+                      { return jobs_.size() < capacity_; });
+        jobs_.push_back(std::move(job));
+        lock.unlock();
+        changed_.notify_all();
+    }
+
+    // Returns false once the queue is closed and empty.
+    bool Pop(ExportJob &job)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        changed_.wait(lock, [this]
+                      { return closed_ || !jobs_.empty(); });
+        if (jobs_.empty())
+        {
+            return false;
+        }
+        job = std::move(jobs_.front());
+        jobs_.pop_front();
+        lock.unlock();
+        changed_.notify_all();
+        return true;
+    }
+
+    void Close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closed_ = true;
+        }
+        changed_.notify_all();
+    }
+
+private:
+    size_t capacity_;
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    std::deque<ExportJob> jobs_;
+    bool closed_ = false;
+};
+
+template <typename T>
+xt::xtensor<float, 4> to_float(const mrd::ImageData<T> &data)
+{
+    if constexpr (std::is_same_v<T, std::complex<float>> || std::is_same_v<T, std::complex<double>>)
+    {
+        return xt::cast<float>(xt::abs(data));
+    }
+    else
+    {
+        return xt::cast<float>(data);
+    }
+}
+
+enum class ImageFormat
+{
+    kPng,
+    kPgm,
+    kMagick,
+};
+
+struct ExportOptions
 {
     std::string prefix = "image_";
-    if (argc > 2)
+    bool mosaic = false;
+    ImageFormat format = ImageFormat::kPng;
+    int bit_depth = 8;
+
+    // Window given as low:high pixel values, or as low:high percentiles of each image.
+    // Without either, images are scaled from 0 to their maximum.
+    std::optional<std::pair<float, float>> window;
+    std::optional<std::pair<double, double>> percentiles;
+
+    // Smooth the window over the images of each series instead of scaling each image on its own.
+    bool series = false;
+};
+
+// Returns the window of an image, computed from the whole image so that its frames are comparable.
+std::pair<float, float> image_window(const xt::xtensor<float, 4> &data, const ExportOptions &options)
+{
+    if (options.window)
+    {
+        return *options.window;
+    }
+
+    PixelHistogram histogram(data.data(), data.size());
+    if (options.percentiles)
+    {
+        return {histogram.Percentile(options.percentiles->first / 100), histogram.Percentile(options.percentiles->second / 100)};
+    }
+    return {0.0f, histogram.Max()};
+}
+
+// Running estimate of the window of a series, so that the brightness of its images does not jump
+// when a single image has a different range. Updated by the reader in stream order.
+class SeriesWindow
+{
+public:
+    std::pair<float, float> Update(std::pair<float, float> window)
+    {
+        if (!estimate_)
+        {
+            estimate_ = window;
+        }
+        else
+        {
+            estimate_->first += kWeight * (window.first - estimate_->first);
+            estimate_->second += kWeight * (window.second - estimate_->second);
+        }
+        return *estimate_;
+    }
+
+private:
+    // Weight of the newest image in the moving average.
+    static constexpr float kWeight = 0.2f;
+
+    std::optional<std::pair<float, float>> estimate_;
+};
+
+// Writes a frame of float pixels, mapping the window [low, high] to black and white.
+void write_frame(const float *pixels, size_t cols, size_t rows, float low, float high, const ExportOptions &options, const std::string &filename)
+{
+    if (options.format == ImageFormat::kMagick)
+    {
+        float scale = high > low ? 1.0f / (high - low) : 0.0f;
+        std::vector<float> scaled(cols * rows);
+        for (size_t i = 0; i < scaled.size(); i++)
+        {
+            scaled[i] = std::clamp((pixels[i] - low) * scale, 0.0f, 1.0f);
+        }
+
+        Magick::Image image(cols, rows, "I", Magick::FloatPixel, scaled.data());
+        image.write(filename);
+        return;
+    }
+
+    auto levels = quantize_frame(pixels, cols * rows, low, high, options.bit_depth);
+    if (options.format == ImageFormat::kPng)
+    {
+        write_gray_png(filename, levels.data(), cols, rows, options.bit_depth);
+    }
+    else
+    {
+        write_gray_pgm(filename, levels.data(), cols, rows, options.bit_depth);
+    }
+}
+
+// Tiles the frames (all channels and slices) of an image into one frame, row by row.
+std::vector<float> make_mosaic(const xt::xtensor<float, 4> &data, size_t &mosaic_cols, size_t &mosaic_rows)
+{
+    size_t frames = data.shape(0) * data.shape(1);
+    size_t rows = data.shape(2);
+    size_t cols = data.shape(3);
+    size_t tiles_x = static_cast<size_t>(std::ceil(std::sqrt(static_cast<double>(frames))));
+    size_t tiles_y = (frames + tiles_x - 1) / tiles_x;
+
+    mosaic_cols = tiles_x * cols;
+    mosaic_rows = tiles_y * rows;
+    std::vector<float> mosaic(mosaic_cols * mosaic_rows, 0.0f);
+    for (size_t f = 0; f < frames; f++)
+    {
+        const float *frame = data.data() + f * rows * cols;
+        size_t x0 = (f % tiles_x) * cols;
+        size_t y0 = (f / tiles_x) * rows;
+        for (size_t y = 0; y < rows; y++)
+        {
+            std::copy(frame + y * cols, frame + (y + 1) * cols, mosaic.data() + (y0 + y) * mosaic_cols + x0);
+        }
+    }
+    return mosaic;
+}
+
+// Writes one file per channel and slice, or one mosaic of all of them. Images with a single
+// frame keep the plain <prefix><index> name.
+void export_image(const ExportJob &job, const ExportOptions &options)
+{
+    auto &data = job.data;
+    size_t channels = data.shape(0);
+    size_t slices = data.shape(1);
+    size_t rows = data.shape(2);
+    size_t cols = data.shape(3);
+    if (data.size() == 0)
+    {
+        return;
+    }
+
+    auto [low, high] = job.window ? *job.window : image_window(data, options);
+
+    auto extension = options.format == ImageFormat::kPgm ? "pgm" : "png";
+    if (channels * slices == 1)
+    {
+        write_frame(data.data(), cols, rows, low, high, options, fmt::format("{}{:06d}.{}", options.prefix, job.index, extension));
+    }
+    else if (options.mosaic)
     {
-        std::cerr << "Usage: " << argv[0] << " <prefix>" << std::endl;
-        return 1;
+        size_t mosaic_cols, mosaic_rows;
+        auto pixels = make_mosaic(data, mosaic_cols, mosaic_rows);
+        write_frame(pixels.data(), mosaic_cols, mosaic_rows, low, high, options, fmt::format("{}{:06d}.{}", options.prefix, job.index, extension));
     }
-    else if (argc == 2)
+    else
     {
-        prefix = argv[1];
+        for (size_t c = 0; c < channels; c++)
+        {
+            for (size_t s = 0; s < slices; s++)
+            {
+                const float *frame = data.data() + (c * slices + s) * rows * cols;
+                write_frame(frame, cols, rows, low, high, options, fmt::format("{}{:06d}_c{:02d}_s{:03d}.{}", options.prefix, job.index, c, s, extension));
+            }
+        }
+    }
+}
+
+// Parses <a>:<b>.
+template <typename T>
+std::pair<T, T> parse_pair(const std::string &arg)
+{
+    auto colon = arg.find(':');
+    if (colon == std::string::npos)
+    {
+        throw std::invalid_argument("expected <low>:<high>, got " + arg);
+    }
+    return {static_cast<T>(std::stod(arg.substr(0, colon))), static_cast<T>(std::stod(arg.substr(colon + 1)))};
+}
+
+void print_usage(std::string program_name)
+{
+    std::cerr << "Usage: " << program_name << " [options] [<prefix>]" << std::endl;
+    std::cerr << "  Writes the images of an MRD stream read from stdin as <prefix><index>.png or .pgm (default prefix: image_)" << std::endl;
+    std::cerr << "  Images with several channels or slices are written as <prefix><index>_c<channel>_s<slice>.png or .pgm" << std::endl;
+    std::cerr << "  -f|--format <png|pgm|magick> (built-in PNG or PGM encoder, or ImageMagick, default: png)" << std::endl;
+    std::cerr << "  -d|--bit-depth <8|16> (default: 8, magick only supports 8)" << std::endl;
+    std::cerr << "  -w|--window <low>:<high> (pixel values shown as black and white)" << std::endl;
+    std::cerr << "  -l|--window-level <width>:<level> (window given by its width and center)" << std::endl;
+    std::cerr << "  -p|--percentile <low>:<high> (window from percentiles of each image, e.g. 1:99)" << std::endl;
+    std::cerr << "  -s|--series (smooth the window over the images of each series, for consistent scaling)" << std::endl;
+    std::cerr << "  -m|--mosaic (write all channels and slices of an image as one tiled image)" << std::endl;
+    std::cerr << "  -a|--any-type (convert integer and complex images instead of failing, complex images by magnitude)" << std::endl;
+    std::cerr << "  -t|--threads <number of encoding threads> (default: number of cores)" << std::endl;
+    std::cerr << "  -h|--help" << std::endl;
+}
+
+// Read a stream of MRD images and write them out as PNG or PGM files.
+int main(int argc, char **argv)
+{
+    ExportOptions options;
+    bool prefix_set = false;
+    bool any_type = false;
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+
+    std::vector<std::string> args(argv, argv + argc);
+    auto current_arg = args.begin() + 1;
+    while (current_arg != args.end())
+    {
+        if (*current_arg == "--help" || *current_arg == "-h")
+        {
+            print_usage(args[0]);
+            return 0;
+        }
+        else if (*current_arg == "--mosaic" || *current_arg == "-m")
+        {
+            options.mosaic = true;
+            current_arg++;
+        }
+        else if (*current_arg == "--format" || *current_arg == "-f")
+        {
+            current_arg++;
+            if (current_arg == args.end())
+            {
+                std::cerr << "Missing format" << std::endl;
+                print_usage(args[0]);
+                return 1;
+            }
+            if (*current_arg == "png")
+            {
+                options.format = ImageFormat::kPng;
+            }
+            else if (*current_arg == "pgm")
+            {
+                options.format = ImageFormat::kPgm;
+            }
+            else if (*current_arg == "magick")
+            {
+                options.format = ImageFormat::kMagick;
+            }
+            else
+            {
+                std::cerr << "Unknown format: " << *current_arg << std::endl;
+                print_usage(args[0]);
+                return 1;
+            }
+            current_arg++;
+        }
+        else if (*current_arg == "--bit-depth" || *current_arg == "-d")
+        {
+            current_arg++;
+            if (current_arg == args.end() || (*current_arg != "8" && *current_arg != "16"))
+            {
+                std::cerr << "Bit depth must be 8 or 16" << std::endl;
+                print_usage(args[0]);
+                return 1;
+            }
+            options.bit_depth = std::stoi(*current_arg);
+            current_arg++;
+        }
+        else if (*current_arg == "--series" || *current_arg == "-s")
+        {
+            options.series = true;
+            current_arg++;
+        }
+        else if (*current_arg == "--window" || *current_arg == "-w" || *current_arg == "--window-level" || *current_arg == "-l" || *current_arg == "--percentile" || *current_arg == "-p")
+        {
+            bool percentile = *current_arg == "--percentile" || *current_arg == "-p";
+            bool window_level = *current_arg == "--window-level" || *current_arg == "-l";
+            current_arg++;
+            if (current_arg == args.end())
+            {
+                std::cerr << "Missing window" << std::endl;
+                print_usage(args[0]);
+                return 1;
+            }
+            try
+            {
+                if (percentile)
+                {
+                    options.percentiles = parse_pair<double>(*current_arg);
+                }
+                else if (window_level)
+                {
+                    auto [width, level] = parse_pair<float>(*current_arg);
+                    options.window = std::make_pair(level - width / 2, level + width / 2);
+                }
+                else
+                {
+                    options.window = parse_pair<float>(*current_arg);
+                }
+            }
+            catch (const std::exception &e)
+            {
+                std::cerr << "Invalid window: " << e.what() << std::endl;
+                print_usage(args[0]);
+                return 1;
+            }
+            current_arg++;
+        }
+        else if (*current_arg == "--any-type" || *current_arg == "-a")
+        {
+            any_type = true;
+            current_arg++;
+        }
+        else if (*current_arg == "--threads" || *current_arg == "-t")
+        {
+            current_arg++;
+            if (current_arg == args.end())
+            {
+                std::cerr << "Missing number of threads" << std::endl;
+                print_usage(args[0]);
+                return 1;
+            }
+            threads = std::max<size_t>(1, std::stoul(*current_arg));
+            current_arg++;
+        }
+        else if (!prefix_set && current_arg->rfind("-", 0) != 0)
+        {
+            options.prefix = *current_arg;
+            prefix_set = true;
+            current_arg++;
+        }
+        else
+        {
+            std::cerr << "Unknown argument: " << *current_arg << std::endl;
+            print_usage(args[0]);
+            return 1;
+        }
+    }
+
+    if (options.format == ImageFormat::kMagick)
+    {
+        if (options.bit_depth != 8)
+        {
+            std::cerr << "The magick format only supports a bit depth of 8" << std::endl;
+            return 1;
+        }
+
+        Magick::InitializeMagick(argv[0]);
+
+        // Images are encoded in parallel by our own threads, not by ImageMagick's.
+        Magick::ResourceLimits::thread(1);
     }
 
     mrd::binary::MrdReader r(std::cin);
@@ -23,28 +432,84 @@ int main(int argc, char **argv)
     std::optional<mrd::Header> h;
     r.ReadHeader(h);
 
+    ExportQueue queue(2 * threads);
+    std::mutex error_mutex;
+    bool failed = false;
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < threads; i++)
+    {
+        workers.emplace_back([&]
+                             {
+            ExportJob job;
+            while (queue.Pop(job))
+            {
+                try
+                {
+                    export_image(job, options);
+                }
+                catch (const std::exception &e)
+                {
+                    std::lock_guard<std::mutex> lock(error_mutex);
+                    std::cerr << "Failed to write image " << job.index << ": " << e.what() << std::endl;
+                    failed = true;
+                }
+            } });
+    }
+
+    // File names follow the order of the stream, whichever thread finishes first.
     mrd::StreamItem v;
-    int image_count = 0;
+    std::map<uint32_t, SeriesWindow> series_windows;
+    size_t image_count = 0;
+    int status = 0;
     while (r.ReadData(v))
     {
-        if (!std::holds_alternative<mrd::Image<float>>(v))
+        if (!std::holds_alternative<mrd::Image<float>>(v) && !any_type)
         {
-            std::cerr << "Stream must contain only floating point images" << std::endl;
-            return 1;
+            std::cerr << "Stream must contain only floating point images (use --any-type to convert other images)" << std::endl;
+            status = 1;
+            break;
         }
 
-        auto &img = std::get<mrd::Image<float>>(v);
+        if (std::holds_alternative<mrd::Acquisition>(v) || std::holds_alternative<mrd::Waveform<uint32_t>>(v))
+        {
+            continue;
+        }
 
-        // Scale image
-        auto max_value = xt::amax(img.data)();
-        img.data *= 1.0 / max_value;
+        std::optional<uint32_t> series_index;
+        auto data = std::visit([&](auto &&arg) -> xt::xtensor<float, 4>
+                               {
+            using T = std::decay_t<decltype(arg)>;
+            if constexpr (std::is_same_v<T, mrd::Acquisition> || std::is_same_v<T, mrd::Waveform<uint32_t>>)
+            {
+                return {};
+            }
+            else if constexpr (std::is_same_v<T, mrd::Image<float>>)
+            {
+                series_index = arg.image_series_index;
+                return std::move(arg.data);
+            }
+            else
+            {
+                series_index = arg.image_series_index;
+                return to_float(arg.data);
+            } },
+                               v);
 
-        Magick::Image image(img.Cols(), img.Rows(), "I", Magick::FloatPixel, img.data.data());
+        // The series estimate depends on the order of the images, so it is updated here rather than
+        // by the encoding threads. A fixed window needs no estimate.
+        std::optional<std::pair<float, float>> window;
+        if (options.series && !options.window && data.size() > 0)
+        {
+            window = series_windows[series_index.value_or(0)].Update(image_window(data, options));
+        }
+        queue.Push({image_count++, std::move(data), window});
+    }
 
-        // Use fmt to generate filename from prefix and increment with 6 digits (e.g. prefix_000001.png)
-        std::string filename = fmt::format("{}{:06d}.png", prefix, image_count++);
-        image.write(filename);
+    queue.Close();
+    for (auto &worker : workers)
+    {
+        worker.join();
     }
 
-    return 0;
+    return failed ? 1 : status;
 }
@@ -5,12 +5,25 @@
 #include "generated/hdf5/protocols.h"
 #include "generated/protocols.h"
 #include "generated/types.h"
+#include "fd_stream.h"
+#include "fft_plan_cache.h"
+#include "philox_noise.h"
 #include "shepp_logan_phantom.h"
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <limits>
+#include <mutex>
+#include <optional>
 #include <random>
+#include <thread>
 #include <xtensor-fftw/basic.hpp>
 #include <xtensor-fftw/helper.hpp>
 #include <xtensor/xio.hpp>
 #include <xtensor/xview.hpp>
+#include <unistd.h>
 
 using namespace mrd;
 
@@ -19,18 +32,354 @@ xt::xtensor<std::complex<float>, 4> fftshift(xt::xtensor<std::complex<float>, 4>
   return xt::roll(xt::roll(x, x.shape(3) / 2, 3), x.shape(2) / 2, 2);
 }
 
-xt::xtensor<std::complex<float>, 4> generate_noise(std::array<size_t, 4> shape, float sigma, float mean = 0.0)
+struct SamplingOptions
 {
-  xt::xtensor<std::complex<float>, 4> noise = xt::zeros<std::complex<float>>(shape);
-  std::random_device rd{};
-  std::mt19937 gen;
-  gen.seed(rd());
-  std::normal_distribution<> d{mean, sigma};
-  std::generate(noise.begin(), noise.end(), [&d, &gen]()
-                { return std::complex<float>(d(gen), d(gen)); });
-  return noise;
+  uint32_t acceleration = 1;
+  bool variable_density = false;
+  double partial_fourier = 1.0;
+  uint32_t acs = 0;
+};
+
+// A line of encode step 1 that is acquired, with its calibration flags.
+struct SampledLine
+{
+  uint32_t line;
+  uint64_t flags;
+};
+
+// Lines of encode step 1 to acquire, in order. Uniform undersampling keeps every R-th line counted
+// from the center. Variable density keeps each line with a probability that falls off with distance
+// from the center, scaled so that matrix / R lines are kept on average. Partial Fourier skips the
+// first lines, and the center acs lines are always acquired for calibration.
+std::vector<SampledLine> sampling_pattern(uint32_t matrix, const SamplingOptions &options, uint64_t seed)
+{
+  int center = matrix / 2;
+  std::vector<bool> imaging(matrix);
+  if (options.variable_density)
+  {
+    auto density = [&](uint32_t line, double scale)
+    {
+      double distance = std::abs(static_cast<int>(line) - center) / (0.5 * matrix);
+      return std::min(1.0, scale * (1 - distance) * (1 - distance));
+    };
+    auto expected = [&](double scale)
+    {
+      double sum = 0;
+      for (uint32_t line = 0; line < matrix; line++)
+      {
+        sum += density(line, scale);
+      }
+      return sum;
+    };
+
+    double low = 0, high = 1;
+    while (expected(high) < 1.0 * matrix / options.acceleration && high < 1e6)
+    {
+      high *= 2;
+    }
+    for (int i = 0; i < 50; i++)
+    {
+      double mid = (low + high) / 2;
+      if (expected(mid) < 1.0 * matrix / options.acceleration)
+      {
+        low = mid;
+      }
+      else
+      {
+        high = mid;
+      }
+    }
+
+    std::mt19937_64 gen(seed);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    for (uint32_t line = 0; line < matrix; line++)
+    {
+      imaging[line] = uniform(gen) < density(line, high);
+    }
+    imaging[center] = true;
+  }
+  else
+  {
+    for (uint32_t line = 0; line < matrix; line++)
+    {
+      imaging[line] = (static_cast<int>(line) - center) % static_cast<int>(options.acceleration) == 0;
+    }
+  }
+
+  uint32_t first = matrix - static_cast<uint32_t>(std::lround(options.partial_fourier * matrix));
+  uint32_t first_acs = center - std::min<uint32_t>(options.acs, matrix) / 2;
+  std::vector<SampledLine> sampled;
+  for (uint32_t line = first; line < matrix; line++)
+  {
+    bool calibration = line >= first_acs && line < first_acs + options.acs;
+    if (calibration && imaging[line])
+    {
+      sampled.push_back({line, static_cast<uint64_t>(AcquisitionFlags::kIsParallelCalibrationAndImaging)});
+    }
+    else if (calibration)
+    {
+      sampled.push_back({line, static_cast<uint64_t>(AcquisitionFlags::kIsParallelCalibration)});
+    }
+    else if (imaging[line])
+    {
+      sampled.push_back({line, 0});
+    }
+  }
+  return sampled;
+}
+
+constexpr double kPi = 3.14159265358979323846;
+
+// Golden-angle radial spokes or interleaves of an Archimedean spiral. Sample locations are in cycles
+// per pixel of the recon matrix, from -0.5 to 0.5, and are computed for each readout as it is
+// generated, so the number of spokes is not limited by memory.
+class NonCartesianTrajectory
+{
+public:
+  NonCartesianTrajectory(Trajectory type, uint32_t matrix, uint32_t spokes)
+      : type_(type), matrix_(matrix), spokes_(spokes)
+  {
+    if (type_ == Trajectory::kSpiral)
+    {
+      // Turns of each interleave are spokes / matrix apart, so that the interleaves together
+      // sample k-space at the Nyquist rate. Samples are spread evenly along the spiral, half a pixel
+      // (of k-space, in cycles per field of view) apart like the oversampled Cartesian readouts.
+      // The first interleave is stored, and the others are rotations of it.
+      turns_ = 0.5 * matrix_ / spokes_;
+      auto speed = [&](double t)
+      {
+        return 0.5 * matrix_ * std::sqrt(1 + (2 * kPi * turns_ * t) * (2 * kPi * turns_ * t));
+      };
+      for (double t = 0; t < 1; t += 0.5 / speed(t + 0.25 / speed(t)))
+      {
+        spiral_x_.push_back(static_cast<float>(0.5 * t * std::cos(2 * kPi * turns_ * t)));
+        spiral_y_.push_back(static_cast<float>(0.5 * t * std::sin(2 * kPi * turns_ * t)));
+      }
+      samples_ = spiral_x_.size();
+    }
+    else
+    {
+      samples_ = 2 * matrix_;
+    }
+  }
+
+  size_t Samples() const
+  {
+    return samples_;
+  }
+
+  // Fills kx and ky with the samples of readout n, counted over all repetitions. Golden-angle spokes
+  // keep rotating from one repetition to the next, and spiral interleaves are repeated.
+  void Fill(uint64_t n, float *kx, float *ky) const
+  {
+    if (type_ == Trajectory::kSpiral)
+    {
+      double rotation = 2 * kPi * (n % spokes_) / spokes_;
+      float cos_rotation = static_cast<float>(std::cos(rotation));
+      float sin_rotation = static_cast<float>(std::sin(rotation));
+      for (size_t i = 0; i < samples_; i++)
+      {
+        kx[i] = spiral_x_[i] * cos_rotation - spiral_y_[i] * sin_rotation;
+        ky[i] = spiral_x_[i] * sin_rotation + spiral_y_[i] * cos_rotation;
+      }
+    }
+    else
+    {
+      double angle = std::fmod(n * kGoldenAngle, kPi);
+      float cos_angle = static_cast<float>(std::cos(angle));
+      float sin_angle = static_cast<float>(std::sin(angle));
+      for (size_t i = 0; i < samples_; i++)
+      {
+        float k = (1.0f * i - matrix_) / samples_;
+        kx[i] = k * cos_angle;
+        ky[i] = k * sin_angle;
+      }
+    }
+  }
+
+  TrajectoryDescriptionType Description() const
+  {
+    TrajectoryDescriptionType description;
+    if (type_ == Trajectory::kSpiral)
+    {
+      description.identifier = "ArchimedeanSpiral";
+      description.user_parameter_long.push_back({"interleaves", spokes_});
+      description.user_parameter_double.push_back({"turns", turns_});
+    }
+    else
+    {
+      description.identifier = "GoldenAngleRadial";
+      description.user_parameter_long.push_back({"spokes", spokes_});
+      description.user_parameter_double.push_back({"angle_increment_deg", kGoldenAngle * 180 / kPi});
+    }
+    description.user_parameter_long.push_back({"samples", static_cast<int64_t>(samples_)});
+    description.comment = "k-space locations in cycles per pixel of the recon matrix, from -0.5 to 0.5";
+    return description;
+  }
+
+private:
+  static constexpr double kGoldenAngle = 1.9416110387254665; // pi * (sqrt(5) - 1) / 2
+
+  Trajectory type_;
+  uint32_t matrix_;
+  uint32_t spokes_;
+  size_t samples_;
+  double turns_ = 0;
+  std::vector<float> spiral_x_;
+  std::vector<float> spiral_y_;
+};
+
+// Ticks of acquisition and waveform time stamps, as on the scanners ISMRMRD data usually comes from.
+constexpr double kTickMs = 2.5;
+constexpr double kRrIntervalMs = 1000.0; // 60 beats per minute
+constexpr double kBreathMs = 4000.0;     // 15 breaths per minute
+
+struct TimingOptions
+{
+  double tr_ms = 5.0;
+  bool real_time = false;
+  double jitter_ms = 0.0;
+  uint64_t burst = 1;
+  bool ecg = false;
+  bool respiratory = false;
+};
+
+// Simulated scan time. Line n is acquired n * TR after the start of the scan, and time stamps count
+// ticks since midnight (UTC) of the wall clock time at the start.
+class ScanClock
+{
+public:
+  explicit ScanClock(double tr_ms)
+      : tr_ms_(tr_ms), start_(std::chrono::steady_clock::now())
+  {
+    auto since_epoch = std::chrono::system_clock::now().time_since_epoch();
+    double ms = std::chrono::duration<double, std::milli>(since_epoch).count();
+    start_ms_of_day_ = std::fmod(ms, 24 * 3600 * 1000.0);
+  }
+
+  double LineMs(uint64_t n) const
+  {
+    return n * tr_ms_;
+  }
+
+  uint32_t Ticks(double scan_ms) const
+  {
+    return static_cast<uint32_t>((start_ms_of_day_ + scan_ms) / kTickMs);
+  }
+
+  void SleepUntil(double scan_ms) const
+  {
+    std::this_thread::sleep_until(start_ + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double, std::milli>(scan_ms)));
+  }
+
+private:
+  double tr_ms_;
+  std::chrono::steady_clock::time_point start_;
+  double start_ms_of_day_;
+};
+
+// Synthetic ECG: a baseline with a narrow R wave at the start of every RR interval.
+uint32_t ecg_sample(double scan_ms)
+{
+  double phase = std::fmod(scan_ms, kRrIntervalMs);
+  double distance = std::min(phase, kRrIntervalMs - phase);
+  return static_cast<uint32_t>(2048 + 1500 * std::exp(-0.5 * (distance / 8) * (distance / 8)));
+}
+
+// Synthetic respiratory bellows signal.
+uint32_t respiratory_sample(double scan_ms)
+{
+  return static_cast<uint32_t>(2048 + 1000 * std::sin(2 * 3.14159265359 * scan_ms / kBreathMs));
 }
 
+// A physiological signal written as blocks of samples, with the waveform ids of ISMRMRD (0 is ECG,
+// 2 is respiratory).
+struct WaveformSource
+{
+  uint32_t id;
+  uint32_t sample_time_us;
+  uint32_t samples_per_block;
+  uint32_t (*sample)(double scan_ms);
+  double next_block_ms = 0;
+
+  double BlockMs() const
+  {
+    return samples_per_block * sample_time_us / 1000.0;
+  }
+
+  Waveform<uint32_t> NextBlock(const ScanClock &clock, uint32_t scan_counter)
+  {
+    Waveform<uint32_t> waveform;
+    waveform.scan_counter = scan_counter;
+    waveform.time_stamp = clock.Ticks(next_block_ms);
+    waveform.sample_time_us = static_cast<float>(sample_time_us);
+    waveform.waveform_id = id;
+    std::array<size_t, 2> shape = {1, samples_per_block};
+    waveform.data.resize(shape);
+    for (uint32_t i = 0; i < samples_per_block; i++)
+    {
+      waveform.data(0, i) = sample(next_block_ms + i * sample_time_us / 1000.0);
+    }
+    next_block_ms += BlockMs();
+    return waveform;
+  }
+};
+
+// Acquisitions handed from the generating threads to the writer. Line n goes to slot n % size, so
+// the writer takes lines in order while the threads fill the following ones, and the data of each
+// slot is allocated once.
+class AcquisitionRing
+{
+public:
+  explicit AcquisitionRing(size_t size)
+      : slots_(size), filled_(size, 0)
+  {
+  }
+
+  // Waits until the slot of line n has been written and returns it for filling.
+  Acquisition &Acquire(uint64_t n)
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    changed_.wait(lock, [&]
+                  { return n < released_ + slots_.size(); });
+    return slots_[n % slots_.size()];
+  }
+
+  void Publish(uint64_t n)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      filled_[n % slots_.size()] = n + 1;
+    }
+    changed_.notify_all();
+  }
+
+  // Waits until line n has been filled.
+  Acquisition &Next(uint64_t n)
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    changed_.wait(lock, [&]
+                  { return filled_[n % slots_.size()] == n + 1; });
+    return slots_[n % slots_.size()];
+  }
+
+  void Release(uint64_t n)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      released_ = n + 1;
+    }
+    changed_.notify_all();
+  }
+
+private:
+  std::vector<Acquisition> slots_;
+  std::vector<uint64_t> filled_; // line + 1 of the line in each slot
+  uint64_t released_ = 0;
+  std::mutex mutex_;
+  std::condition_variable changed_;
+};
+
 // This is a quick and dirty implementation. Unnecessary copies, etc.
 mrd::ImageData<std::complex<float>> generate_coil_kspace(size_t matrix, size_t ncoils, bool zero_pad = true)
 {
@@ -55,6 +404,125 @@ mrd::ImageData<std::complex<float>> generate_coil_kspace(size_t matrix, size_t n
   return fftshift(coils);
 }
 
+// Same k-space as generate_coil_kspace, evaluated analytically at each sample instead of by FFT of a
+// rasterized phantom. Lines are divided among threads.
+mrd::ImageData<std::complex<float>> generate_analytic_kspace(size_t matrix, size_t ncoils, size_t threads)
+{
+  auto ellipses = modified_shepp_logan_ellipses();
+  AnalyticKspace analytic(ellipses, ncoils, 1.5);
+
+  // The phantom spans [-1, 1] (a field of view of 2) in y and is zero padded to 4 in x, and the
+  // FFT sums pixels of area (2 / matrix)^2 and is normalized by the square root of its size.
+  size_t samples = 2 * matrix;
+  float scale = (matrix * matrix / 4.0f) / std::sqrt(1.0f * samples * matrix);
+
+  std::array<size_t, 4> shape = {ncoils, 1, matrix, samples};
+  mrd::ImageData<std::complex<float>> kspace = xt::zeros<std::complex<float>>(shape);
+  std::vector<std::thread> workers;
+  for (size_t t = 0; t < threads; t++)
+  {
+    workers.emplace_back([&, t]
+                         {
+      std::vector<float> kx(samples);
+      std::vector<float> ky(samples);
+      std::vector<std::complex<float>> values(ncoils * samples);
+      for (size_t line = t; line < matrix; line += threads)
+      {
+        for (size_t i = 0; i < samples; i++)
+        {
+          kx[i] = (1.0f * i - matrix) / 4;
+          ky[i] = (1.0f * line - matrix / 2) / 2;
+        }
+        analytic.evaluate(kx.data(), ky.data(), samples, values.data());
+        for (size_t c = 0; c < ncoils; c++)
+        {
+          for (size_t i = 0; i < samples; i++)
+          {
+            kspace(c, 0, line, i) = values[c * samples + i] * scale;
+          }
+        }
+      } });
+  }
+  for (auto &worker : workers)
+  {
+    worker.join();
+  }
+  return kspace;
+}
+
+// 3D k-space of the 3D phantom, with the readout zero padded to 2x like the 2D k-space. The volume
+// of each coil is transformed in place in the output, and coils are divided among threads.
+mrd::ImageData<std::complex<float>> generate_coil_kspace_3d(size_t matrix, size_t ncoils, size_t threads)
+{
+  auto phan = shepp_logan_phantom_3d(matrix, threads);
+
+  // Rings of at most 8 coils along z, so that coils also differ in z.
+  unsigned int rings = (ncoils + 7) / 8;
+  size_t samples = 2 * matrix;
+  size_t volume = matrix * matrix * samples;
+  float scale = 1.0f / std::sqrt(1.0f * volume);
+  std::array<size_t, 4> shape = {ncoils, matrix, matrix, samples};
+  mrd::ImageData<std::complex<float>> kspace(shape);
+
+  FftPlanCache fft_plans;
+  std::atomic<size_t> next_coil = 0;
+  std::vector<std::thread> workers;
+  for (size_t t = 0; t < std::min(threads, ncoils); t++)
+  {
+    workers.emplace_back([&]
+                         {
+      for (size_t c = next_coil++; c < ncoils; c = next_coil++)
+      {
+        std::complex<float> *coil = &kspace(c, 0, 0, 0);
+        std::fill(coil, coil + volume, std::complex<float>(0.0f));
+
+        // Voxels are written shifted by half of each dimension, so that the origin is at index 0,
+        // and with alternating signs, which shifts the origin of the transform to the center.
+        // Together they replace the fftshifts around the transform (for even matrix sizes).
+        for (size_t z = 0; z < matrix; z++)
+        {
+          float z_co = (1.0f * z - (matrix >> 1)) / (matrix >> 1);
+          size_t mz = (z + matrix / 2) % matrix;
+          for (size_t y = 0; y < matrix; y++)
+          {
+            float y_co = (1.0f * y - (matrix >> 1)) / (matrix >> 1);
+            size_t my = (y + matrix / 2) % matrix;
+            for (size_t x = 0; x < matrix; x++)
+            {
+              std::complex<float> value = phan(0, z, y, x);
+              if (value == std::complex<float>(0.0f))
+              {
+                continue;
+              }
+              float x_co = (1.0f * x - (matrix >> 1)) / (matrix >> 1);
+              size_t mx = (x + matrix / 2 + matrix) % samples;
+              value *= birdcage_sensitivity_3d(x_co, y_co, z_co, c, ncoils, rings, 1.5) * scale;
+              coil[(mz * matrix + my) * samples + mx] = (mx + my + mz) % 2 ? -value : value;
+            }
+          }
+        }
+        fft_plans.Transform(coil, {static_cast<int>(matrix), static_cast<int>(matrix), static_cast<int>(samples)}, FFTW_FORWARD);
+      } });
+  }
+  for (auto &worker : workers)
+  {
+    worker.join();
+  }
+  return kspace;
+}
+
+// Parses an integer option value. Throws std::invalid_argument unless it is a number from min to max.
+uint32_t parse_integer(const std::string &arg, const std::string &what, uint32_t min, uint32_t max = std::numeric_limits<int32_t>::max())
+{
+  uint32_t value = 0;
+  auto [ptr, ec] = std::from_chars(arg.data(), arg.data() + arg.size(), value);
+  if (ec != std::errc() || ptr != arg.data() + arg.size() || value < min || value > max)
+  {
+    throw std::invalid_argument("Invalid " + what + " " + arg + ", expected " + std::to_string(min) + " to " + std::to_string(max));
+  }
+  return value;
+}
+
 void print_usage(std::string program_name)
 {
   std::cerr << "Usage: " << program_name << std::endl;
@@ -62,7 +530,25 @@ void print_usage(std::string program_name)
   std::cerr << "  -c|--coils       <number of coils>" << std::endl;
   std::cerr << "  -m|--matrix      <matrix size>" << std::endl;
   std::cerr << "  -r|--repetitions <number of repetitions>" << std::endl;
+  std::cerr << "  -a|--analytic    (evaluate k-space analytically instead of by FFT of a rasterized phantom)" << std::endl;
+  std::cerr << "  -n|--noise-sigma <standard deviation of the noise>" << std::endl;
+  std::cerr << "  --seed           <seed of the noise> (default: random)" << std::endl;
+  std::cerr << "  -T|--tr          <time between lines in ms> (default: 5)" << std::endl;
+  std::cerr << "  --real-time      (write lines at the pace of the TR instead of as fast as possible)" << std::endl;
+  std::cerr << "  -j|--jitter      <maximum random delay of each burst in ms, with --real-time>" << std::endl;
+  std::cerr << "  -B|--burst       <number of lines sent together, with --real-time> (default: 1)" << std::endl;
+  std::cerr << "  --ecg            (interleave ECG waveforms, and set physiology time stamps)" << std::endl;
+  std::cerr << "  --respiratory    (interleave respiratory waveforms)" << std::endl;
+  std::cerr << "  -R|--acceleration <acceleration factor R along encode step 1> (default: 1)" << std::endl;
+  std::cerr << "  --variable-density (sample lines randomly, denser at the center, with R as the mean acceleration)" << std::endl;
+  std::cerr << "  -p|--partial-fourier <fraction of the lines, from 0.5 to 1, of which the first are skipped>" << std::endl;
+  std::cerr << "  -L|--acs         <number of calibration lines at the center> (default: 0)" << std::endl;
+  std::cerr << "  --trajectory     <cartesian|radial|spiral> (default: cartesian)" << std::endl;
+  std::cerr << "  --spokes         <number of radial spokes or spiral interleaves> (default: matrix * pi / 2 spokes, matrix / 16 interleaves)" << std::endl;
+  std::cerr << "  -3|--3d          (3D phantom, with one acquisition per encode step 1 and 2)" << std::endl;
+  std::cerr << "  -t|--threads     <number of threads> (default: number of cores)" << std::endl;
   std::cerr << "  -s|--stdout" << std::endl;
+  std::cerr << "  -b|--buffer-size <output buffer size in bytes, with --stdout>" << std::endl;
   std::cerr << "  -h|--help" << std::endl;
 }
 
@@ -74,6 +560,16 @@ int main(int argc, char **argv)
   float noise_sigma = 0.05;
   std::string filename = "mrd_testdata.h5";
   bool use_stdout = false;
+  size_t buffer_size = kDefaultOutputBufferSize;
+  bool analytic = false;
+  bool volume = false;
+  std::optional<uint64_t> seed;
+  TimingOptions timing;
+  bool paced_options = false;
+  SamplingOptions sampling;
+  Trajectory trajectory = Trajectory::kCartesian;
+  uint32_t spokes = 0;
+  size_t threads = std::max(1u, std::thread::hardware_concurrency());
 
   std::vector<std::string> args(argv, argv + argc);
   auto current_arg = args.begin() + 1;
@@ -105,7 +601,16 @@ int main(int argc, char **argv)
         print_usage(args[0]);
         return 1;
       }
-      ncoils = std::stoi(*current_arg);
+      try
+      {
+        ncoils = parse_integer(*current_arg, "number of coils", 1);
+      }
+      catch (const std::invalid_argument &e)
+      {
+        std::cerr << e.what() << std::endl;
+        print_usage(args[0]);
+        return 1;
+      }
       current_arg++;
     }
     else if (*current_arg == "--matrix" || *current_arg == "-m")
@@ -117,7 +622,16 @@ int main(int argc, char **argv)
         print_usage(args[0]);
         return 1;
       }
-      matrix = std::stoi(*current_arg);
+      try
+      {
+        matrix = parse_integer(*current_arg, "matrix size", 1);
+      }
+      catch (const std::invalid_argument &e)
+      {
+        std::cerr << e.what() << std::endl;
+        print_usage(args[0]);
+        return 1;
+      }
       current_arg++;
     }
     else if (*current_arg == "--repetitions" || *current_arg == "-r")
@@ -129,7 +643,16 @@ int main(int argc, char **argv)
         print_usage(args[0]);
         return 1;
       }
-      repetitions = std::stoi(*current_arg);
+      try
+      {
+        repetitions = parse_integer(*current_arg, "number of repetitions", 1);
+      }
+      catch (const std::invalid_argument &e)
+      {
+        std::cerr << e.what() << std::endl;
+        print_usage(args[0]);
+        return 1;
+      }
       current_arg++;
     }
     else if (*current_arg == "--noise-sigma" || *current_arg == "-n")
@@ -144,11 +667,228 @@ int main(int argc, char **argv)
       noise_sigma = std::stof(*current_arg);
       current_arg++;
     }
+    else if (*current_arg == "--analytic" || *current_arg == "-a")
+    {
+      analytic = true;
+      current_arg++;
+    }
+    else if (*current_arg == "--3d" || *current_arg == "-3")
+    {
+      volume = true;
+      current_arg++;
+    }
+    else if (*current_arg == "--threads" || *current_arg == "-t")
+    {
+      current_arg++;
+      if (current_arg == args.end())
+      {
+        std::cerr << "Missing number of threads" << std::endl;
+        print_usage(args[0]);
+        return 1;
+      }
+      threads = std::max<size_t>(1, std::stoul(*current_arg));
+      current_arg++;
+    }
+    else if (*current_arg == "--tr" || *current_arg == "-T")
+    {
+      current_arg++;
+      if (current_arg == args.end())
+      {
+        std::cerr << "Missing TR" << std::endl;
+        print_usage(args[0]);
+        return 1;
+      }
+      timing.tr_ms = std::stod(*current_arg);
+      current_arg++;
+    }
+    else if (*current_arg == "--jitter" || *current_arg == "-j")
+    {
+      current_arg++;
+      if (current_arg == args.end())
+      {
+        std::cerr << "Missing jitter" << std::endl;
+        print_usage(args[0]);
+        return 1;
+      }
+      timing.jitter_ms = std::stod(*current_arg);
+      paced_options = true;
+      current_arg++;
+    }
+    else if (*current_arg == "--burst" || *current_arg == "-B")
+    {
+      current_arg++;
+      if (current_arg == args.end())
+      {
+        std::cerr << "Missing burst size" << std::endl;
+        print_usage(args[0]);
+        return 1;
+      }
+      timing.burst = std::max<uint64_t>(1, std::stoull(*current_arg));
+      paced_options = true;
+      current_arg++;
+    }
+    else if (*current_arg == "--acceleration" || *current_arg == "-R")
+    {
+      current_arg++;
+      if (current_arg == args.end())
+      {
+        std::cerr << "Missing acceleration factor" << std::endl;
+        print_usage(args[0]);
+        return 1;
+      }
+      try
+      {
+        sampling.acceleration = parse_integer(*current_arg, "acceleration factor", 1);
+      }
+      catch (const std::invalid_argument &e)
+      {
+        std::cerr << e.what() << std::endl;
+        print_usage(args[0]);
+        return 1;
+      }
+      current_arg++;
+    }
+    else if (*current_arg == "--partial-fourier" || *current_arg == "-p")
+    {
+      current_arg++;
+      if (current_arg == args.end())
+      {
+        std::cerr << "Missing partial Fourier fraction" << std::endl;
+        print_usage(args[0]);
+        return 1;
+      }
+      sampling.partial_fourier = std::stod(*current_arg);
+      current_arg++;
+    }
+    else if (*current_arg == "--acs" || *current_arg == "-L")
+    {
+      current_arg++;
+      if (current_arg == args.end())
+      {
+        std::cerr << "Missing number of calibration lines" << std::endl;
+        print_usage(args[0]);
+        return 1;
+      }
+      try
+      {
+        sampling.acs = parse_integer(*current_arg, "number of calibration lines", 0);
+      }
+      catch (const std::invalid_argument &e)
+      {
+        std::cerr << e.what() << std::endl;
+        print_usage(args[0]);
+        return 1;
+      }
+      current_arg++;
+    }
+    else if (*current_arg == "--trajectory")
+    {
+      current_arg++;
+      if (current_arg == args.end())
+      {
+        std::cerr << "Missing trajectory" << std::endl;
+        print_usage(args[0]);
+        return 1;
+      }
+      if (*current_arg == "cartesian")
+      {
+        trajectory = Trajectory::kCartesian;
+      }
+      else if (*current_arg == "radial")
+      {
+        trajectory = Trajectory::kGoldenangle;
+      }
+      else if (*current_arg == "spiral")
+      {
+        trajectory = Trajectory::kSpiral;
+      }
+      else
+      {
+        std::cerr << "Unknown trajectory: " << *current_arg << std::endl;
+        print_usage(args[0]);
+        return 1;
+      }
+      current_arg++;
+    }
+    else if (*current_arg == "--spokes")
+    {
+      current_arg++;
+      if (current_arg == args.end())
+      {
+        std::cerr << "Missing number of spokes" << std::endl;
+        print_usage(args[0]);
+        return 1;
+      }
+      try
+      {
+        spokes = parse_integer(*current_arg, "number of spokes", 1);
+      }
+      catch (const std::invalid_argument &e)
+      {
+        std::cerr << e.what() << std::endl;
+        print_usage(args[0]);
+        return 1;
+      }
+      current_arg++;
+    }
+    else if (*current_arg == "--variable-density")
+    {
+      sampling.variable_density = true;
+      current_arg++;
+    }
+    else if (*current_arg == "--real-time")
+    {
+      timing.real_time = true;
+      current_arg++;
+    }
+    else if (*current_arg == "--ecg")
+    {
+      timing.ecg = true;
+      current_arg++;
+    }
+    else if (*current_arg == "--respiratory")
+    {
+      timing.respiratory = true;
+      current_arg++;
+    }
+    else if (*current_arg == "--seed")
+    {
+      current_arg++;
+      if (current_arg == args.end())
+      {
+        std::cerr << "Missing seed" << std::endl;
+        print_usage(args[0]);
+        return 1;
+      }
+      seed = std::stoull(*current_arg);
+      current_arg++;
+    }
     else if (*current_arg == "--stdout" || *current_arg == "-s")
     {
       use_stdout = true;
       current_arg++;
     }
+    else if (*current_arg == "--buffer-size" || *current_arg == "-b")
+    {
+      current_arg++;
+      if (current_arg == args.end())
+      {
+        std::cerr << "Missing buffer size" << std::endl;
+        print_usage(args[0]);
+        return 1;
+      }
+      try
+      {
+        buffer_size = parse_buffer_size(*current_arg);
+      }
+      catch (const std::invalid_argument &e)
+      {
+        std::cerr << e.what() << std::endl;
+        print_usage(args[0]);
+        return 1;
+      }
+      current_arg++;
+    }
     else
     {
       std::cerr << "Unknown argument: " << *current_arg << std::endl;
@@ -157,16 +897,64 @@ int main(int argc, char **argv)
     }
   }
 
+  if (paced_options && !timing.real_time)
+  {
+    std::cerr << "--jitter and --burst require --real-time" << std::endl;
+    return 1;
+  }
+
+  if (volume && analytic)
+  {
+    std::cerr << "--analytic is only supported for 2D phantoms" << std::endl;
+    return 1;
+  }
+  if (volume && matrix % 2 != 0)
+  {
+    std::cerr << "3D phantoms require an even matrix size" << std::endl;
+    return 1;
+  }
+
+  if (sampling.partial_fourier < 0.5 || sampling.partial_fourier > 1)
+  {
+    std::cerr << "The partial Fourier fraction must be between 0.5 and 1" << std::endl;
+    return 1;
+  }
+  if (sampling.acceleration > matrix)
+  {
+    std::cerr << "The acceleration factor must be between 1 and the matrix size" << std::endl;
+    return 1;
+  }
+  if (sampling.acs > matrix)
+  {
+    std::cerr << "The number of calibration lines must be between 0 and the matrix size" << std::endl;
+    return 1;
+  }
+
+  bool cartesian = trajectory == Trajectory::kCartesian;
+  if (!cartesian && (volume || sampling.acceleration > 1 || sampling.variable_density || sampling.partial_fourier < 1 || sampling.acs > 0))
+  {
+    std::cerr << "Radial and spiral trajectories are only supported for fully sampled 2D phantoms" << std::endl;
+    return 1;
+  }
+  if (spokes == 0)
+  {
+    spokes = trajectory == Trajectory::kSpiral ? std::max(1u, matrix / 16) : static_cast<uint32_t>(std::lround(kPi / 2 * matrix));
+  }
+  NonCartesianTrajectory readouts(trajectory, matrix, spokes);
+
   // Parameters
   float fov = 300;
   float slice_thickness = 5;
+  uint32_t partitions = volume ? matrix : 1;
 
   std::remove(filename.c_str());
+  std::unique_ptr<FdOutputStream> out;
   std::unique_ptr<MrdWriterBase> w;
 
   if (use_stdout)
   {
-    w = std::make_unique<mrd::binary::MrdWriter>(std::cout);
+    out = std::make_unique<FdOutputStream>(STDOUT_FILENO, buffer_size);
+    w = std::make_unique<mrd::binary::MrdWriter>(*out);
   }
   else
   {
@@ -178,47 +966,252 @@ int main(int argc, char **argv)
   subject.patient_id = "1234BGVF";
   subject.patient_name = "John Doe";
 
-  EncodingSpaceType e;
-  e.matrix_size = {2 * matrix, matrix, 1};
-  e.field_of_view_mm = {2 * fov, fov, slice_thickness};
-
   EncodingSpaceType r;
-  r.matrix_size = {matrix, matrix, 1};
-  r.field_of_view_mm = {fov, fov, slice_thickness};
+  r.matrix_size = {matrix, matrix, partitions};
+  r.field_of_view_mm = {fov, fov, volume ? fov : slice_thickness};
+
+  // Cartesian readouts are oversampled 2x, and non-Cartesian data is gridded to the recon space.
+  EncodingSpaceType e = r;
+  if (cartesian)
+  {
+    e.matrix_size = {2 * matrix, matrix, partitions};
+    e.field_of_view_mm = {2 * fov, fov, volume ? fov : slice_thickness};
+  }
+
+  // std::random_device may open a device or fail on some platforms, so it is only used without --seed.
+  uint64_t noise_seed;
+  if (seed)
+  {
+    noise_seed = *seed;
+  }
+  else
+  {
+    std::random_device rd;
+    noise_seed = (uint64_t(rd()) << 32) | rd();
+  }
+  std::vector<SampledLine> sampled;
+  if (cartesian)
+  {
+    sampled = sampling_pattern(matrix, sampling, noise_seed);
+  }
+  else
+  {
+    for (uint32_t spoke = 0; spoke < spokes; spoke++)
+    {
+      sampled.push_back({spoke, 0});
+    }
+  }
+  uint32_t lines = cartesian ? matrix : spokes;
 
   EncodingType enc;
-  enc.trajectory = Trajectory::kCartesian;
+  enc.trajectory = trajectory;
   enc.encoded_space = e;
   enc.recon_space = r;
+  if (cartesian)
+  {
+    enc.encoding_limits.kspace_encoding_step_0 = LimitType{0, 2 * matrix - 1, matrix};
+    enc.encoding_limits.kspace_encoding_step_1 = LimitType{sampled.front().line, sampled.back().line, matrix / 2};
+  }
+  else
+  {
+    uint32_t samples = static_cast<uint32_t>(readouts.Samples());
+    enc.encoding_limits.kspace_encoding_step_0 = LimitType{0, samples - 1, trajectory == Trajectory::kSpiral ? 0 : matrix};
+    enc.encoding_limits.kspace_encoding_step_1 = LimitType{0, spokes - 1, 0};
+    enc.trajectory_description = readouts.Description();
+  }
+  enc.encoding_limits.kspace_encoding_step_2 = LimitType{0, partitions - 1, volume ? partitions / 2 : 0};
+  enc.encoding_limits.slice = LimitType{0, 0, 0};
+  enc.encoding_limits.repetition = LimitType{0, repetitions - 1, 0};
+  if (sampling.acceleration > 1 || sampling.acs > 0)
+  {
+    ParallelImagingType parallel_imaging;
+    parallel_imaging.acceleration_factor.kspace_encoding_step_1 = sampling.acceleration;
+    parallel_imaging.acceleration_factor.kspace_encoding_step_2 = 1;
+    if (sampling.acs > 0)
+    {
+      parallel_imaging.calibration_mode = CalibrationMode::kEmbedded;
+    }
+    enc.parallel_imaging = parallel_imaging;
+  }
   h.encoding.push_back(enc);
 
+  if (timing.ecg)
+  {
+    WaveformInformationType ecg;
+    ecg.waveform_name = "ECG";
+    ecg.waveform_type = WaveformType::kEcg;
+    h.waveform_information.push_back(ecg);
+  }
+  if (timing.respiratory)
+  {
+    WaveformInformationType respiratory;
+    respiratory.waveform_name = "Respiratory";
+    respiratory.waveform_type = WaveformType::kRespiratory;
+    h.waveform_information.push_back(respiratory);
+  }
+
   w->WriteHeader(h);
 
   // phantom k-space
-  auto phan = generate_coil_kspace(matrix, ncoils);
+  mrd::ImageData<std::complex<float>> phan;
+  if (volume)
+  {
+    phan = generate_coil_kspace_3d(matrix, ncoils, threads);
+  }
+  else if (cartesian)
+  {
+    phan = analytic ? generate_analytic_kspace(matrix, ncoils, threads) : generate_coil_kspace(matrix, ncoils);
+  }
+
+  // Non-Cartesian readouts are evaluated analytically as they are generated, with the scaling of
+  // generate_analytic_kspace.
+  auto ellipses = modified_shepp_logan_ellipses();
+  std::optional<AnalyticKspace> model;
+  if (!cartesian)
+  {
+    model.emplace(ellipses, ncoils, 1.5);
+  }
+  float model_scale = (matrix * matrix / 4.0f) / std::sqrt(2.0f * matrix * matrix);
 
-  for (unsigned int r = 0; r < repetitions; r++)
+  // Noise depends only on the seed and the position of each line, so the output does not depend
+  // on the number of threads.
+  PhiloxNoise noise(noise_seed, noise_sigma);
+
+  // Lines are generated by a pool of threads ahead of the writer, into a ring of reused
+  // acquisitions, so memory does not grow with the number of repetitions.
+  uint64_t total_lines = uint64_t(repetitions) * partitions * sampled.size();
+  AcquisitionRing ring(std::max<size_t>(64, 4 * threads));
+  std::atomic<uint64_t> next_line = 0;
+  std::vector<std::thread> workers;
+  for (size_t t = 0; t < threads; t++)
+  {
+    workers.emplace_back([&]
+                         {
+      std::vector<float> kx(readouts.Samples());
+      std::vector<float> ky(readouts.Samples());
+      for (uint64_t n = next_line++; n < total_lines; n = next_line++)
+      {
+        size_t index = n % sampled.size();
+        uint32_t line = sampled[index].line;
+        uint32_t partition = (n / sampled.size()) % partitions;
+        uint32_t r = n / (uint64_t(sampled.size()) * partitions);
+
+        Acquisition &a = ring.Acquire(n);
+        a.flags = decltype(a.flags){};
+        a.flags |= sampled[index].flags;
+        if (index == 0)
+        {
+          a.flags |= static_cast<uint64_t>(AcquisitionFlags::kFirstInEncodeStep1);
+        }
+        if (index == sampled.size() - 1)
+        {
+          a.flags |= static_cast<uint64_t>(AcquisitionFlags::kLastInEncodeStep1);
+        }
+        if (volume && partition == 0)
+        {
+          a.flags |= static_cast<uint64_t>(AcquisitionFlags::kFirstInEncodeStep2);
+        }
+        if (volume && partition == partitions - 1)
+        {
+          a.flags |= static_cast<uint64_t>(AcquisitionFlags::kLastInEncodeStep2);
+        }
+        a.idx.kspace_encode_step_1 = line;
+        a.idx.kspace_encode_step_2 = partition;
+        a.idx.slice = 0;
+        a.idx.repetition = r;
+
+        if (cartesian)
+        {
+          // Assigning a view of the same shape reuses the acquisition's data.
+          a.data = xt::view(phan, xt::all(), partition, line, xt::all());
+        }
+        else
+        {
+          // The analytic model takes cycles per unit of the phantom, which spans [-1, 1] of the
+          // field of view of 2.
+          readouts.Fill(n, kx.data(), ky.data());
+          a.trajectory.resize(std::array<size_t, 2>{2, kx.size()});
+          a.data.resize(std::array<size_t, 2>{ncoils, kx.size()});
+          for (size_t i = 0; i < kx.size(); i++)
+          {
+            a.trajectory(0, i) = kx[i];
+            a.trajectory(1, i) = ky[i];
+            kx[i] *= matrix / 2.0f;
+            ky[i] *= matrix / 2.0f;
+          }
+          model->evaluate(kx.data(), ky.data(), kx.size(), a.data.data());
+          a.data *= model_scale;
+          if (trajectory == Trajectory::kGoldenangle)
+          {
+            a.center_sample = matrix;
+          }
+        }
+        noise.Add(a.data.data(), a.data.size(), (uint64_t(r) * partitions + partition) * lines + line);
+        ring.Publish(n);
+      } });
+  }
+
+  // The writer adds the scanner timing: time stamps and scan counters, physiological waveforms and,
+  // with --real-time, the pace of the output.
+  ScanClock clock(timing.tr_ms);
+  std::mt19937_64 jitter_gen(noise_seed);
+  std::uniform_real_distribution<double> jitter(0.0, timing.jitter_ms);
+  std::vector<WaveformSource> waveforms;
+  if (timing.ecg)
   {
-    auto noise = generate_noise(phan.shape(), noise_sigma);
-    auto kspace = xt::xtensor<std::complex<float>, 4>(phan) + noise;
-    for (size_t line = 0; line < matrix; line++)
+    waveforms.push_back({0, 2500, 8, ecg_sample});
+  }
+  if (timing.respiratory)
+  {
+    waveforms.push_back({2, 20000, 5, respiratory_sample});
+  }
+
+  for (uint64_t n = 0; n < total_lines; n++)
+  {
+    // A burst is sent when its last line has been acquired, plus a random delay.
+    uint64_t burst_end = std::min<uint64_t>((n / timing.burst + 1) * timing.burst, total_lines) - 1;
+    if (timing.real_time && n % timing.burst == 0)
     {
-      Acquisition a;
-      if (line == 0)
+      clock.SleepUntil(clock.LineMs(burst_end) + jitter(jitter_gen));
+    }
+
+    // Waveform blocks are written once all of their samples have been acquired.
+    double acquired_ms = clock.LineMs(n);
+    for (auto &source : waveforms)
+    {
+      while (source.next_block_ms + source.BlockMs() <= acquired_ms)
       {
-        a.flags |= static_cast<uint64_t>(AcquisitionFlags::kFirstInEncodeStep1);
+        w->WriteData(source.NextBlock(clock, static_cast<uint32_t>(n)));
       }
-      if (line == matrix - 1)
+    }
+
+    Acquisition &a = ring.Next(n);
+    a.scan_counter = static_cast<uint32_t>(n);
+    a.acquisition_time_stamp = clock.Ticks(acquired_ms);
+    if (timing.ecg)
+    {
+      a.physiology_time_stamp = {static_cast<uint32_t>(std::fmod(acquired_ms, kRrIntervalMs) / kTickMs)};
+    }
+    w->WriteData(a);
+    ring.Release(n);
+
+    if (timing.real_time && n == burst_end)
+    {
+      w->Flush();
+      if (out)
       {
-        a.flags |= static_cast<uint64_t>(AcquisitionFlags::kLastInEncodeStep1);
+        out->flush();
       }
-      a.idx.kspace_encode_step_1 = line;
-      a.idx.kspace_encode_step_2 = 0;
-      a.idx.slice = 0;
-      a.idx.repetition = r;
-      a.data = xt::view(kspace, xt::all(), 0, line, xt::all());
-      w->WriteData(a);
     }
   }
+  for (auto &worker : workers)
+  {
+    worker.join();
+  }
   w->EndData();
+  if (out && !out->Finish())
+  {
+    return 1;
+  }
+  return 0;
 }
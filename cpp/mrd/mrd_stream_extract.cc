@@ -0,0 +1,131 @@
+#include "binary_stream_scanner.h"
+#include "fd_stream.h"
+#include "stream_index.h"
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <unistd.h>
+
+// Copies size bytes starting at offset from in to out.
+void copy_range(std::istream& in, std::ostream& out, uint64_t offset, uint64_t size) {
+  static std::vector<char> buffer(1 << 20);
+  in.seekg(offset);
+  while (size > 0) {
+    auto n = std::min<uint64_t>(size, buffer.size());
+    if (!in.read(buffer.data(), n)) {
+      throw std::runtime_error("Unexpected end of file at offset " + std::to_string(offset));
+    }
+    out.write(buffer.data(), n);
+    offset += n;
+    size -= n;
+  }
+}
+
+void print_usage(std::string program_name) {
+  std::cerr << "Usage: " << program_name << " [options] <filename>" << std::endl;
+  std::cerr << "  Writes the selected items of an MRD binary stream file to stdout" << std::endl;
+  std::cerr << "  -i|--index <index file> (default: <filename>.mrdidx, built on first use)" << std::endl;
+  std::cerr << "  -b|--buffer-size <output buffer size in bytes>" << std::endl;
+  std::cerr << "  -h|--help" << std::endl;
+  IndexSelection::PrintUsage();
+}
+
+int main(int argc, char** argv) {
+  std::string filename;
+  std::optional<std::filesystem::path> index_file;
+  size_t buffer_size = kDefaultOutputBufferSize;
+  IndexSelection selection;
+
+  std::vector<std::string> args(argv, argv + argc);
+  auto current_arg = args.begin() + 1;
+  while (current_arg != args.end()) {
+    if (*current_arg == "--help" || *current_arg == "-h") {
+      print_usage(args[0]);
+      return 0;
+    } else if (*current_arg == "--index" || *current_arg == "-i") {
+      current_arg++;
+      if (current_arg == args.end()) {
+        std::cerr << "Missing index file" << std::endl;
+        print_usage(args[0]);
+        return 1;
+      }
+      index_file = *current_arg;
+      current_arg++;
+    } else if (*current_arg == "--buffer-size" || *current_arg == "-b") {
+      current_arg++;
+      if (current_arg == args.end()) {
+        std::cerr << "Missing buffer size" << std::endl;
+        print_usage(args[0]);
+        return 1;
+      }
+      try {
+        buffer_size = parse_buffer_size(*current_arg);
+      } catch (const std::invalid_argument& e) {
+        std::cerr << e.what() << std::endl;
+        print_usage(args[0]);
+        return 1;
+      }
+      current_arg++;
+    } else if (selection.ParseArg(current_arg, args.end())) {
+      continue;
+    } else if (filename.empty() && current_arg->rfind("-", 0) != 0) {
+      filename = *current_arg;
+      current_arg++;
+    } else {
+      std::cerr << "Unknown argument: " << *current_arg << std::endl;
+      print_usage(args[0]);
+      return 1;
+    }
+  }
+
+  if (filename.empty()) {
+    print_usage(args[0]);
+    return 1;
+  }
+
+  if (!index_file) {
+    index_file = index_path_for(filename);
+  }
+
+  std::ifstream in(filename, std::ios::binary);
+  if (!in) {
+    std::cerr << "Failed to open " << filename << std::endl;
+    return 1;
+  }
+
+  auto index = read_stream_index(*index_file, filename);
+  if (!index) {
+    index = index_binary_stream(in);
+    write_stream_index(*index_file, filename, *index);
+    in.clear();
+  }
+
+  auto& entries = index->entries;
+  std::vector<bool> selected(entries.size());
+  for (size_t i = 0; i < entries.size(); i++) {
+    selected[i] = selection.Matches(entries[i], i);
+  }
+
+  FdOutputStream out(STDOUT_FILENO, buffer_size);
+  copy_range(in, out, 0, index->header_size);
+
+  // Selected items that are adjacent in the file are copied as one block of the stream.
+  for (size_t i = 0; i < entries.size();) {
+    if (!selected[i]) {
+      i++;
+      continue;
+    }
+
+    size_t end = i + 1;
+    while (end < entries.size() && selected[end] && entries[end].offset == entries[end - 1].offset + entries[end - 1].size) {
+      end++;
+    }
+
+    write_varint(out, end - i);
+    copy_range(in, out, entries[i].offset, entries[end - 1].offset + entries[end - 1].size - entries[i].offset);
+    i = end;
+  }
+
+  write_varint(out, 0);
+  return out.Finish() ? 0 : 1;
+}
@@ -0,0 +1,132 @@
+#include "binary_stream_scanner.h"
+#include "fd_stream.h"
+#include "stream_filter.h"
+#include <iostream>
+#include <optional>
+#include <unistd.h>
+
+// Kept items are written in blocks of about this many bytes.
+constexpr size_t kBlockBytes = 1 << 20;
+
+void print_usage(std::string program_name) {
+  std::cerr << "Usage: " << program_name << " [options] <expression>" << std::endl;
+  std::cerr << "  Copies the items of an MRD binary stream from stdin to stdout that match the expression," << std::endl;
+  std::cerr << "  e.g. '!isNoiseMeasurement && !isDummyscanData' or 'type == Acquisition && slice == 0'" << std::endl;
+  std::cerr << "  -b|--buffer-size <output buffer size in bytes>" << std::endl;
+  std::cerr << "  -v|--verbose (print the number of kept and dropped items)" << std::endl;
+  std::cerr << "  -h|--help" << std::endl;
+  print_stream_filter_names();
+}
+
+int main(int argc, char** argv) {
+  std::string expression;
+  size_t buffer_size = kDefaultOutputBufferSize;
+  bool verbose = false;
+
+  std::vector<std::string> args(argv, argv + argc);
+  auto current_arg = args.begin() + 1;
+  while (current_arg != args.end()) {
+    if (*current_arg == "--help" || *current_arg == "-h") {
+      print_usage(args[0]);
+      return 0;
+    } else if (*current_arg == "--buffer-size" || *current_arg == "-b") {
+      current_arg++;
+      if (current_arg == args.end()) {
+        std::cerr << "Missing buffer size" << std::endl;
+        print_usage(args[0]);
+        return 1;
+      }
+      try {
+        buffer_size = parse_buffer_size(*current_arg);
+      } catch (const std::invalid_argument& e) {
+        std::cerr << e.what() << std::endl;
+        print_usage(args[0]);
+        return 1;
+      }
+      current_arg++;
+    } else if (*current_arg == "--verbose" || *current_arg == "-v") {
+      verbose = true;
+      current_arg++;
+    } else if (expression.empty()) {
+      // Expressions may start with '!', but never with '-'.
+      if (current_arg->rfind("-", 0) == 0) {
+        std::cerr << "Unknown argument: " << *current_arg << std::endl;
+        print_usage(args[0]);
+        return 1;
+      }
+      expression = *current_arg;
+      current_arg++;
+    } else {
+      std::cerr << "Unknown argument: " << *current_arg << std::endl;
+      print_usage(args[0]);
+      return 1;
+    }
+  }
+
+  if (expression.empty()) {
+    print_usage(args[0]);
+    return 1;
+  }
+
+  std::optional<StreamFilter> filter;
+  try {
+    filter.emplace(expression);
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  BinaryStreamScanner scanner(std::cin);
+  FdOutputStream out(STDOUT_FILENO, buffer_size);
+  auto preamble = serialize_stream_preamble(scanner.Header());
+  out.write(preamble.data(), preamble.size());
+
+  // Items are copied as they were encoded. Rejected items are dropped again from the block right after
+  // scanning, so only the fields the filter looks at are ever decoded.
+  std::string block;
+  block.reserve(2 * kBlockBytes);
+  uint64_t block_items = 0;
+  uint64_t kept = 0;
+  uint64_t dropped = 0;
+  StreamIndexEntry entry;
+
+  auto flush = [&]() {
+    if (block_items > 0) {
+      write_varint(out, block_items);
+      out.write(block.data(), block.size());
+      block.clear();
+      block_items = 0;
+    }
+  };
+
+  while (true) {
+    auto mark = block.size();
+    if (!scanner.Next(entry, &block)) {
+      break;
+    }
+
+    if (!filter->Matches(entry)) {
+      block.resize(mark);
+      dropped++;
+      continue;
+    }
+
+    kept++;
+    block_items++;
+    if (block.size() >= kBlockBytes) {
+      flush();
+    }
+  }
+
+  flush();
+  write_varint(out, 0);
+  if (!out.Finish()) {
+    return 1;
+  }
+
+  if (verbose) {
+    std::cerr << "Kept " << kept << " items, dropped " << dropped << std::endl;
+  }
+
+  return 0;
+}
@@ -0,0 +1,96 @@
+#include "binary_stream_scanner.h"
+#include "stream_index.h"
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+void print_usage(std::string program_name) {
+  std::cerr << "Usage: " << program_name << " [options] [<filename>]" << std::endl;
+  std::cerr << "  Writes the index of an MRD binary stream file to <filename>.mrdidx" << std::endl;
+  std::cerr << "  -w|--write <filename> (read the stream from stdin, write it to <filename> and index it)" << std::endl;
+  std::cerr << "  -o|--output <index file>" << std::endl;
+  std::cerr << "  -v|--verbose" << std::endl;
+  std::cerr << "  -h|--help" << std::endl;
+}
+
+int main(int argc, char** argv) {
+  std::string filename;
+  std::string write_filename;
+  std::optional<std::filesystem::path> index_file;
+  bool verbose = false;
+
+  std::vector<std::string> args(argv, argv + argc);
+  auto current_arg = args.begin() + 1;
+  while (current_arg != args.end()) {
+    if (*current_arg == "--help" || *current_arg == "-h") {
+      print_usage(args[0]);
+      return 0;
+    } else if (*current_arg == "--write" || *current_arg == "-w") {
+      current_arg++;
+      if (current_arg == args.end()) {
+        std::cerr << "Missing output filename" << std::endl;
+        print_usage(args[0]);
+        return 1;
+      }
+      write_filename = *current_arg;
+      current_arg++;
+    } else if (*current_arg == "--output" || *current_arg == "-o") {
+      current_arg++;
+      if (current_arg == args.end()) {
+        std::cerr << "Missing index file" << std::endl;
+        print_usage(args[0]);
+        return 1;
+      }
+      index_file = *current_arg;
+      current_arg++;
+    } else if (*current_arg == "--verbose" || *current_arg == "-v") {
+      verbose = true;
+      current_arg++;
+    } else if (filename.empty() && current_arg->rfind("-", 0) != 0) {
+      filename = *current_arg;
+      current_arg++;
+    } else {
+      std::cerr << "Unknown argument: " << *current_arg << std::endl;
+      print_usage(args[0]);
+      return 1;
+    }
+  }
+
+  if (filename.empty() == write_filename.empty()) {
+    print_usage(args[0]);
+    return 1;
+  }
+
+  auto data_file = filename.empty() ? write_filename : filename;
+  auto start = std::chrono::steady_clock::now();
+
+  StreamIndex index;
+  {
+    std::ifstream file;
+    std::ofstream output;
+    if (!filename.empty()) {
+      file.open(filename, std::ios::binary);
+      if (!file) {
+        std::cerr << "Failed to open " << filename << std::endl;
+        return 1;
+      }
+      index = index_binary_stream(file);
+    } else {
+      output.exceptions(std::ios::badbit | std::ios::failbit);
+      output.open(write_filename, std::ios::binary);
+      index = index_binary_stream(std::cin, &output);
+    }
+  }
+
+  write_stream_index(index_file.value_or(index_path_for(data_file)), data_file, index);
+
+  if (verbose) {
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    auto megabytes = std::filesystem::file_size(data_file) / 1e6;
+    std::cerr << "Indexed " << index.entries.size() << " items (" << megabytes << " MB) in " << elapsed.count() << " s, "
+              << megabytes / elapsed.count() << " MB/s" << std::endl;
+  }
+
+  return 0;
+}
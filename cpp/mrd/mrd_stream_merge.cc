@@ -0,0 +1,255 @@
+#include "binary_stream_scanner.h"
+#include "fd_stream.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <queue>
+#include <unistd.h>
+
+// Merged items are written in blocks of at most about this many bytes.
+constexpr size_t kBlockBytes = 1 << 20;
+
+// Acquisition and waveform time stamps count ticks of 2.5 ms since midnight, so they wrap around once a day.
+constexpr int64_t kTicksPerDay = 24 * 60 * 60 * 400;
+
+// Returns time_stamp, moved by whole days to within half a day of reference.
+int64_t unwrap_time_stamp(uint32_t time_stamp, int64_t reference) {
+  int64_t time = time_stamp;
+  time += (reference - time) / kTicksPerDay * kTicksPerDay;
+  if (time - reference > kTicksPerDay / 2) {
+    time -= kTicksPerDay;
+  } else if (reference - time > kTicksPerDay / 2) {
+    time += kTicksPerDay;
+  }
+  return time;
+}
+
+// One of the merged streams, holding the item that is next in line.
+struct Input {
+  std::string path;
+  int fd = -1;
+  std::unique_ptr<FdInputStream> stream;
+  std::unique_ptr<BinaryStreamScanner> scanner;
+  StreamIndexEntry entry;
+  std::string bytes;
+  int64_t time = std::numeric_limits<int64_t>::min();
+  bool timed = false;
+  uint64_t items = 0;
+
+  ~Input() {
+    if (fd > STDIN_FILENO) {
+      close(fd);
+    }
+  }
+
+  // Reads the next item. Items without a time stamp keep the time of the item before them, so that they
+  // stay next to it in the merged stream. A time stamp that is smaller than the one before it by more than
+  // half a day is taken to have wrapped at midnight. The first time stamp of the input is placed within half
+  // a day of reference, the first time stamp of all inputs, so inputs that start on either side of midnight
+  // are ordered correctly too.
+  bool Next(std::optional<int64_t>& reference) {
+    bytes.clear();
+    if (!scanner->Next(entry, &bytes)) {
+      return false;
+    }
+    if (entry.time_stamp != kNoCounter) {
+      if (!reference) {
+        reference = entry.time_stamp;
+      }
+      time = unwrap_time_stamp(entry.time_stamp, timed ? time : *reference);
+      timed = true;
+    }
+    items++;
+    return true;
+  }
+};
+
+// Returns the header of the base input, with the waveform information of the other inputs added to it.
+std::optional<mrd::Header> reconcile_headers(const std::vector<Input>& inputs, size_t base) {
+  std::optional<mrd::Header> header = inputs[base].scanner->Header();
+  if (!header) {
+    return header;
+  }
+
+  for (size_t i = 0; i < inputs.size(); i++) {
+    auto& other = inputs[i].scanner->Header();
+    if (i == base || !other) {
+      continue;
+    }
+
+    for (auto& w : other->waveform_information) {
+      auto& existing = header->waveform_information;
+      if (std::none_of(existing.begin(), existing.end(), [&](auto& e) { return e.waveform_name == w.waveform_name; })) {
+        existing.push_back(w);
+      }
+    }
+
+    auto compared = *other;
+    compared.waveform_information = header->waveform_information;
+    if (!(compared == *header)) {
+      std::cerr << "Warning: the header of " << inputs[i].path << " differs from the header of " << inputs[base].path
+                << ", which is used" << std::endl;
+    }
+  }
+
+  return header;
+}
+
+void print_usage(std::string program_name) {
+  std::cerr << "Usage: " << program_name << " [options] <input>..." << std::endl;
+  std::cerr << "  Merges MRD binary streams (files, named pipes or - for stdin) by time stamp and writes the result to stdout" << std::endl;
+  std::cerr << "  Each input must be ordered by time stamp. Items with equal time stamps are taken from earlier inputs first." << std::endl;
+  std::cerr << "  Time stamps may wrap at midnight, but the inputs must start within 12 hours of each other." << std::endl;
+  std::cerr << "  -H|--header <input number> (input whose header is used, default: the first input with a header)" << std::endl;
+  std::cerr << "  -b|--buffer-size <output buffer size in bytes>" << std::endl;
+  std::cerr << "  -v|--verbose (print the number of items taken from each input)" << std::endl;
+  std::cerr << "  -h|--help" << std::endl;
+}
+
+int main(int argc, char** argv) {
+  std::vector<std::string> paths;
+  std::optional<size_t> header_input;
+  size_t buffer_size = kDefaultOutputBufferSize;
+  bool verbose = false;
+
+  std::vector<std::string> args(argv, argv + argc);
+  auto current_arg = args.begin() + 1;
+  while (current_arg != args.end()) {
+    if (*current_arg == "--help" || *current_arg == "-h") {
+      print_usage(args[0]);
+      return 0;
+    } else if (*current_arg == "--header" || *current_arg == "-H") {
+      current_arg++;
+      if (current_arg == args.end()) {
+        std::cerr << "Missing input number" << std::endl;
+        print_usage(args[0]);
+        return 1;
+      }
+      header_input = std::stoul(*current_arg);
+      current_arg++;
+    } else if (*current_arg == "--buffer-size" || *current_arg == "-b") {
+      current_arg++;
+      if (current_arg == args.end()) {
+        std::cerr << "Missing buffer size" << std::endl;
+        print_usage(args[0]);
+        return 1;
+      }
+      try {
+        buffer_size = parse_buffer_size(*current_arg);
+      } catch (const std::invalid_argument& e) {
+        std::cerr << e.what() << std::endl;
+        print_usage(args[0]);
+        return 1;
+      }
+      current_arg++;
+    } else if (*current_arg == "--verbose" || *current_arg == "-v") {
+      verbose = true;
+      current_arg++;
+    } else if (*current_arg == "-" || current_arg->rfind("-", 0) != 0) {
+      paths.push_back(*current_arg);
+      current_arg++;
+    } else {
+      std::cerr << "Unknown argument: " << *current_arg << std::endl;
+      print_usage(args[0]);
+      return 1;
+    }
+  }
+
+  if (paths.empty()) {
+    print_usage(args[0]);
+    return 1;
+  }
+
+  if (std::count(paths.begin(), paths.end(), "-") > 1) {
+    std::cerr << "stdin can only be merged once" << std::endl;
+    return 1;
+  }
+
+  if (header_input && *header_input >= paths.size()) {
+    std::cerr << "Invalid input number " << *header_input << ", there are " << paths.size() << " inputs" << std::endl;
+    return 1;
+  }
+
+  // Merged items are written out whenever an input has to wait for its next item, so that a live merge, e.g. of
+  // a sparse waveform stream with acquisitions, does not hold back what has been merged until a block is full.
+  FdOutputStream out(STDOUT_FILENO, buffer_size);
+  std::string block;
+  block.reserve(2 * kBlockBytes);
+  uint64_t block_items = 0;
+  auto flush = [&]() {
+    if (block_items > 0) {
+      write_varint(out, block_items);
+      out.write(block.data(), block.size());
+      block.clear();
+      block_items = 0;
+    }
+    out.flush();
+  };
+
+  std::vector<Input> inputs(paths.size());
+  for (size_t i = 0; i < paths.size(); i++) {
+    auto& input = inputs[i];
+    input.path = paths[i];
+    input.fd = input.path == "-" ? STDIN_FILENO : open(input.path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (input.fd < 0) {
+      std::cerr << "Failed to open " << input.path << ": " << std::strerror(errno) << std::endl;
+      return 1;
+    }
+    input.stream = std::make_unique<FdInputStream>(input.fd);
+    input.scanner = std::make_unique<BinaryStreamScanner>(*input.stream, nullptr, flush);
+  }
+
+  if (!header_input) {
+    auto with_header = std::find_if(inputs.begin(), inputs.end(), [](auto& input) { return input.scanner->Header().has_value(); });
+    header_input = with_header == inputs.end() ? 0 : with_header - inputs.begin();
+  }
+
+  auto preamble = serialize_stream_preamble(reconcile_headers(inputs, *header_input));
+  out.write(preamble.data(), preamble.size());
+
+  // Each input holds only its next item, so memory use does not depend on how far apart the inputs are in time.
+  // An input that is slow to deliver its next item holds up the merge instead of the others being buffered.
+  using HeapEntry = std::pair<int64_t, size_t>;
+  std::priority_queue<HeapEntry, std::vector<HeapEntry>, std::greater<HeapEntry>> heap;
+  std::optional<int64_t> reference;
+  for (size_t i = 0; i < inputs.size(); i++) {
+    if (inputs[i].Next(reference)) {
+      heap.emplace(inputs[i].time, i);
+    }
+  }
+
+  while (!heap.empty()) {
+    auto i = heap.top().second;
+    heap.pop();
+
+    auto& input = inputs[i];
+    block.append(input.bytes);
+    block_items++;
+    if (block.size() >= kBlockBytes) {
+      flush();
+    }
+
+    if (input.Next(reference)) {
+      heap.emplace(input.time, i);
+    }
+  }
+
+  flush();
+  write_varint(out, 0);
+  if (!out.Finish()) {
+    return 1;
+  }
+
+  if (verbose) {
+    for (auto& input : inputs) {
+      std::cerr << input.path << ": " << input.items << " items" << std::endl;
+    }
+  }
+
+  return 0;
+}
@@ -1,23 +1,71 @@
 #include "generated/binary/protocols.h"
 #include "generated/protocols.h"
 #include "generated/types.h"
-#include <xtensor-fftw/basic.hpp>
+#include "fd_stream.h"
+#include "fft_plan_cache.h"
+#include "mapped_stream_reader.h"
+#include "stream_server.h"
+#include <memory>
+#include <stdexcept>
+#include <thread>
 #include <xtensor-fftw/helper.hpp>
+#include <xtensor/xadapt.hpp>
 #include <xtensor/xstrided_view.hpp>
 #include <xtensor/xview.hpp>
+#include <unistd.h>
 
 xt::xtensor<std::complex<float>, 4> fftshift(xt::xtensor<std::complex<float>, 4> x)
 {
-  return xt::roll(xt::roll(x, x.shape(3) / 2, 3), x.shape(2) / 2, 2);
+  x = xt::roll(xt::roll(x, x.shape(3) / 2, 3), x.shape(2) / 2, 2);
+  if (x.shape(1) > 1)
+  {
+    x = xt::roll(x, x.shape(1) / 2, 1);
+  }
+  return x;
 }
 
-int main()
+// Centered 1D transform. Inverse transforms are scaled by 1/N, as with xtensor-fftw.
+xt::xarray<std::complex<float>> centered_fft(FftPlanCache &fft_plans, xt::xarray<std::complex<float>> x, int sign)
 {
-  mrd::binary::MrdReader r(std::cin);
-  mrd::binary::MrdWriter w(std::cout);
+  x = xt::fftw::ifftshift(x);
+  fft_plans.Transform(x.data(), {static_cast<int>(x.size())}, sign);
+  if (sign == FFTW_BACKWARD)
+  {
+    x /= static_cast<float>(x.size());
+  }
+  return xt::fftw::fftshift(x);
+}
+
+void print_usage(std::string program_name)
+{
+  std::cerr << "Usage: " << program_name << std::endl;
+  std::cerr << "  -i|--input <MRD binary stream file> (default: stdin)" << std::endl;
+  std::cerr << "  -b|--buffer-size <output buffer size in bytes>" << std::endl;
+  print_server_usage();
+  std::cerr << "  -h|--help" << std::endl;
+}
+
+// Reconstructs the acquisitions of one stream, read from input_file if given and from in otherwise,
+// and writes the images to out.
+int reconstruct(std::istream &in, std::ostream &out, const std::optional<std::string> &input_file, FftPlanCache &fft_plans)
+{
+  mrd::binary::MrdWriter w(out);
+
+  // Files are mapped and their acquisition data used in place, stdin is read through the generated reader.
+  std::unique_ptr<MappedStreamReader> mapped_reader;
+  std::unique_ptr<mrd::binary::MrdReader> r;
 
   std::optional<mrd::Header> ho;
-  r.ReadHeader(ho);
+  if (input_file)
+  {
+    mapped_reader = std::make_unique<MappedStreamReader>(*input_file);
+    ho = mapped_reader->Header();
+  }
+  else
+  {
+    r = std::make_unique<mrd::binary::MrdReader>(in);
+    r->ReadHeader(ho);
+  }
 
   if (!ho)
   {
@@ -27,63 +75,116 @@ int main()
 
   auto h = ho.value();
 
+  // Lines are stored at their encode steps, which only Cartesian acquisitions have.
+  if (h.encoding.empty() || h.encoding[0].trajectory != mrd::Trajectory::kCartesian)
+  {
+    std::cerr << "Only Cartesian acquisitions can be reconstructed" << std::endl;
+    return 1;
+  }
+
   // Just copy the header
   w.WriteHeader(h);
 
-  // When we have aliased types, we will use that.
-  mrd::StreamItem v;
+  // 3D acquisitions flag the first and last line of every partition, so the volume starts and ends
+  // with the first and last partition.
+  bool volume = h.encoding[0].recon_space.matrix_size.z > 1;
+  auto first_in_volume = [&](const mrd::Acquisition &a)
+  {
+    return a.flags.HasFlags(mrd::AcquisitionFlags::kFirstInEncodeStep1) && (!volume || a.flags.HasFlags(mrd::AcquisitionFlags::kFirstInEncodeStep2));
+  };
+  auto last_in_volume = [&](const mrd::Acquisition &a)
+  {
+    return a.flags.HasFlags(mrd::AcquisitionFlags::kLastInEncodeStep1) && (!volume || a.flags.HasFlags(mrd::AcquisitionFlags::kLastInEncodeStep2));
+  };
+
   xt::xtensor<std::complex<float>, 4> buffer;
-  while (r.ReadData(v))
+  auto process_acquisition = [&](const mrd::Acquisition &a, const auto &data)
   {
-    if (std::holds_alternative<mrd::Acquisition>(v))
+    // if this is the first line, we need to allocate the buffer
+    if (first_in_volume(a) || a.flags.HasFlags(mrd::AcquisitionFlags::kFirstInSlice))
+    {
+      std::array<size_t, 4> shape = {data.shape()[0], h.encoding[0].recon_space.matrix_size.z, h.encoding[0].recon_space.matrix_size.y, h.encoding[0].recon_space.matrix_size.x};
+      buffer = xt::zeros<std::complex<float>>(shape);
+    }
+
+    auto step_1 = a.idx.kspace_encode_step_1.value();
+    auto step_2 = a.idx.kspace_encode_step_2.value();
+    if (data.shape()[0] != buffer.shape()[0])
     {
-      auto a = std::get<mrd::Acquisition>(v);
-      // if this is the first line, we need to allocate the buffer
-      if (a.flags.HasFlags(mrd::AcquisitionFlags::kFirstInEncodeStep1) || a.flags.HasFlags(mrd::AcquisitionFlags::kFirstInSlice))
+      throw std::runtime_error("Acquisition with " + std::to_string(data.shape()[0]) + " coils before the first line of its slice or with a different number of coils");
+    }
+    if (step_1 >= buffer.shape()[2] || step_2 >= buffer.shape()[1])
+    {
+      throw std::runtime_error("Encode step " + std::to_string(step_1) + ", " + std::to_string(step_2) + " is outside of the " +
+                               std::to_string(buffer.shape()[2]) + " x " + std::to_string(buffer.shape()[1]) + " recon matrix");
+    }
+
+    auto line = xt::view(buffer, xt::all(), step_2, step_1, xt::all());
+
+    // Remove oversampling
+    if (data.shape()[1] > h.encoding[0].recon_space.matrix_size.x)
+    {
+      auto x_pad = (data.shape()[1] - h.encoding[0].recon_space.matrix_size.x) / 2;
+      for (size_t c = 0; c < data.shape()[0]; c++)
       {
-        std::array<size_t, 4> shape = {a.data.shape()[0], h.encoding[0].recon_space.matrix_size.z, h.encoding[0].recon_space.matrix_size.y, h.encoding[0].recon_space.matrix_size.x};
-        buffer = xt::zeros<std::complex<float>>(shape);
+        auto ft_line = xt::xarray<std::complex<float>>(xt::view(data, c, xt::all()));
+        ft_line = centered_fft(fft_plans, ft_line, FFTW_BACKWARD);
+        ft_line = xt::view(ft_line, xt::range(x_pad, h.encoding[0].recon_space.matrix_size.x + x_pad));
+        ft_line = centered_fft(fft_plans, ft_line, FFTW_FORWARD);
+        xt::view(line, c, xt::all()) = ft_line;
       }
+    }
+    else
+    {
+      // copy the data into the buffer
+      line = data;
+    }
 
-      // Remove oversampling
-      if (a.Samples() > h.encoding[0].recon_space.matrix_size.x)
+    // if this is the last line, we need to write the buffer
+    if (last_in_volume(a) || a.flags.HasFlags(mrd::AcquisitionFlags::kLastInSlice))
+    {
+      buffer = fftshift(buffer);
+      int nz = static_cast<int>(buffer.shape()[1]);
+      int ny = static_cast<int>(buffer.shape()[2]);
+      int nx = static_cast<int>(buffer.shape()[3]);
+      for (unsigned int c = 0; c < buffer.shape()[0]; c++)
       {
-        auto new_shape = a.data.shape();
-        new_shape[1] = h.encoding[0].recon_space.matrix_size.x;
-        auto x_pad = (a.data.shape()[1] - h.encoding[0].recon_space.matrix_size.x) / 2;
-        xt::xtensor<std::complex<float>, 2> new_data = xt::zeros<std::complex<float>>(new_shape);
-        for (size_t c = 0; c < a.Coils(); c++)
-        {
-          auto ft_line = xt::xarray<std::complex<float>>(xt::view(a.data, c, xt::all()));
-          ft_line = xt::fftw::fftshift(xt::fftw::ifft(xt::fftw::ifftshift(ft_line)));
-          ft_line = xt::view(ft_line, xt::range(x_pad, h.encoding[0].recon_space.matrix_size.x + x_pad));
-          ft_line = xt::fftw::fftshift(xt::fftw::fft(xt::fftw::ifftshift(ft_line)));
-          xt::view(new_data, c, xt::all()) = ft_line;
-        }
-        a.data = new_data;
+        // The volume of each channel is contiguous in the buffer, so it is transformed in place.
+        fft_plans.Transform(&buffer(c, 0, 0, 0), {nz, ny, nx}, FFTW_BACKWARD);
+        xt::view(buffer, c, xt::all(), xt::all(), xt::all()) /= static_cast<float>(nz * ny * nx);
       }
+      buffer = fftshift(buffer);
 
-      // copy the data into the buffer
-      xt::view(buffer, xt::all(), a.idx.kspace_encode_step_2.value(), a.idx.kspace_encode_step_1.value(), xt::all()) = xt::xarray<std::complex<float>>(a.data);
+      std::array<size_t, 4> image_shape = {1, buffer.shape()[1], buffer.shape()[2], buffer.shape()[3]};
+      auto pixel_data = xt::sqrt(xt::abs(xt::sum(buffer * xt::conj(buffer), 0)));
+      mrd::Image<float> im;
+      im.data = xt::zeros<float>(image_shape);
+      im.image_type = mrd::ImageType::kMagnitude;
+      xt::view(im.data, 0, xt::all(), xt::all(), xt::all()) = pixel_data;
+      w.WriteData(im);
+    }
+  };
 
-      // if this is the last line, we need to write the buffer
-      if (a.flags.HasFlags(mrd::AcquisitionFlags::kLastInEncodeStep1) || a.flags.HasFlags(mrd::AcquisitionFlags::kLastInSlice))
+  if (mapped_reader)
+  {
+    MappedStreamItem item;
+    while (mapped_reader->ReadData(item))
+    {
+      if (auto a = std::get_if<AcquisitionView>(&item))
+      {
+        process_acquisition(a->head, xt::adapt(a->data, a->Coils() * a->Samples(), xt::no_ownership(), a->data_shape));
+      }
+    }
+  }
+  else
+  {
+    // When we have aliased types, we will use that.
+    mrd::StreamItem v;
+    while (r->ReadData(v))
+    {
+      if (auto a = std::get_if<mrd::Acquisition>(&v))
       {
-        buffer = fftshift(buffer);
-        for (unsigned int c = 0; c < buffer.shape()[0]; c++)
-        {
-          auto tmp1 = xt::fftw::ifft2(xt::xarray<std::complex<float>>(xt::view(buffer, c, 0, xt::all(), xt::all())));
-          xt::view(buffer, c, 0, xt::all(), xt::all()) = tmp1;
-        }
-        buffer = fftshift(buffer);
-
-        std::array<size_t, 4> image_shape = {1, buffer.shape()[1], buffer.shape()[2], buffer.shape()[3]};
-        auto pixel_data = xt::sqrt(xt::abs(xt::sum(buffer * xt::conj(buffer), 0)));
-        mrd::Image<float> im;
-        im.data = xt::zeros<float>(image_shape);
-        im.image_type = mrd::ImageType::kMagnitude;
-        xt::view(im.data, 0, xt::all(), xt::all(), xt::all()) = pixel_data;
-        w.WriteData(im);
+        process_acquisition(*a, a->data);
       }
     }
   }
@@ -92,3 +193,140 @@ int main()
 
   return 0;
 }
+
+int main(int argc, char **argv)
+{
+  size_t buffer_size = kDefaultOutputBufferSize;
+  std::optional<std::string> input_file;
+  std::optional<std::string> server_address;
+  size_t threads = std::thread::hardware_concurrency();
+
+  std::vector<std::string> args(argv, argv + argc);
+  auto current_arg = args.begin() + 1;
+  while (current_arg != args.end())
+  {
+    if (*current_arg == "--help" || *current_arg == "-h")
+    {
+      print_usage(args[0]);
+      return 0;
+    }
+    else if (*current_arg == "--input" || *current_arg == "-i")
+    {
+      current_arg++;
+      if (current_arg == args.end())
+      {
+        std::cerr << "Missing input file" << std::endl;
+        print_usage(args[0]);
+        return 1;
+      }
+      input_file = *current_arg;
+      current_arg++;
+    }
+    else if (*current_arg == "--buffer-size" || *current_arg == "-b")
+    {
+      current_arg++;
+      if (current_arg == args.end())
+      {
+        std::cerr << "Missing buffer size" << std::endl;
+        print_usage(args[0]);
+        return 1;
+      }
+      try
+      {
+        buffer_size = parse_buffer_size(*current_arg);
+      }
+      catch (const std::invalid_argument &e)
+      {
+        std::cerr << e.what() << std::endl;
+        print_usage(args[0]);
+        return 1;
+      }
+      current_arg++;
+    }
+    else if (*current_arg == "--server" || *current_arg == "-s")
+    {
+      current_arg++;
+      if (current_arg == args.end())
+      {
+        std::cerr << "Missing server address" << std::endl;
+        print_usage(args[0]);
+        return 1;
+      }
+      try
+      {
+        check_server_address(*current_arg);
+      }
+      catch (const std::invalid_argument &e)
+      {
+        std::cerr << e.what() << std::endl;
+        print_usage(args[0]);
+        return 1;
+      }
+      server_address = *current_arg;
+      current_arg++;
+    }
+    else if (*current_arg == "--threads" || *current_arg == "-t")
+    {
+      current_arg++;
+      if (current_arg == args.end())
+      {
+        std::cerr << "Missing number of threads" << std::endl;
+        print_usage(args[0]);
+        return 1;
+      }
+      try
+      {
+        threads = parse_server_threads(*current_arg);
+      }
+      catch (const std::invalid_argument &e)
+      {
+        std::cerr << e.what() << std::endl;
+        print_usage(args[0]);
+        return 1;
+      }
+      current_arg++;
+    }
+    else
+    {
+      std::cerr << "Unknown argument: " << *current_arg << std::endl;
+      print_usage(args[0]);
+      return 1;
+    }
+  }
+
+  if (server_address)
+  {
+    if (input_file)
+    {
+      std::cerr << "--input cannot be used with --server" << std::endl;
+      return 1;
+    }
+
+    // Plans are shared by all connections and made once per shape, so they are worth measuring.
+    FftPlanCache fft_plans(FFTW_MEASURE);
+    try
+    {
+      run_stream_server(*server_address, threads, buffer_size, [&](std::istream &in, std::ostream &out)
+                        { reconstruct(in, out, std::nullopt, fft_plans); });
+    }
+    catch (const std::runtime_error &e)
+    {
+      std::cerr << e.what() << std::endl;
+      return 1;
+    }
+  }
+
+  FftPlanCache fft_plans;
+  FdOutputStream out(STDOUT_FILENO, buffer_size);
+  int result;
+  try
+  {
+    result = reconstruct(std::cin, out, input_file, fft_plans);
+  }
+  catch (const std::exception &e)
+  {
+    std::cerr << e.what() << std::endl;
+    result = 1;
+  }
+  return out.Finish() ? result : 1;
+}
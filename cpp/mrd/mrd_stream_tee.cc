@@ -0,0 +1,154 @@
+#include "binary_format.h"
+#include "binary_stream_scanner.h"
+#include "tee_output.h"
+#include <csignal>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+
+// Items are forwarded in blocks of about this many bytes, which are also the unit that is dropped or spilled.
+constexpr size_t kBlockBytes = 1 << 20;
+
+std::shared_ptr<const std::string> make_block(uint64_t items, const std::string& bytes) {
+  auto block = std::make_shared<std::string>();
+  block->reserve(bytes.size() + 10);
+  append_varint(*block, items);
+  block->append(bytes);
+  return block;
+}
+
+void print_usage(std::string program_name) {
+  std::cerr << "Usage: " << program_name << " [options] <output>..." << std::endl;
+  std::cerr << "  Copies an MRD binary stream from stdin to each output (files, named pipes or - for stdout)" << std::endl;
+  std::cerr << "  -p|--policy <block|drop|spill> (what to do when an output lags behind, default: block)" << std::endl;
+  std::cerr << "  -q|--queue-size <MB> (buffered per output, default: 64)" << std::endl;
+  std::cerr << "  -s|--spill-dir <directory> (for --policy spill, default: the system temporary directory)" << std::endl;
+  std::cerr << "  -v|--verbose (print what each output received)" << std::endl;
+  std::cerr << "  -h|--help" << std::endl;
+}
+
+int main(int argc, char** argv) {
+  std::vector<std::string> paths;
+  LagPolicy policy = LagPolicy::kBlock;
+  size_t queue_size = 64;
+  std::string spill_directory;
+  bool verbose = false;
+
+  std::vector<std::string> args(argv, argv + argc);
+  auto current_arg = args.begin() + 1;
+  while (current_arg != args.end()) {
+    if (*current_arg == "--help" || *current_arg == "-h") {
+      print_usage(args[0]);
+      return 0;
+    } else if (*current_arg == "--policy" || *current_arg == "-p") {
+      current_arg++;
+      if (current_arg == args.end()) {
+        std::cerr << "Missing policy" << std::endl;
+        print_usage(args[0]);
+        return 1;
+      }
+      if (*current_arg == "block") {
+        policy = LagPolicy::kBlock;
+      } else if (*current_arg == "drop") {
+        policy = LagPolicy::kDrop;
+      } else if (*current_arg == "spill") {
+        policy = LagPolicy::kSpill;
+      } else {
+        std::cerr << "Unknown policy: " << *current_arg << std::endl;
+        print_usage(args[0]);
+        return 1;
+      }
+      current_arg++;
+    } else if (*current_arg == "--queue-size" || *current_arg == "-q") {
+      current_arg++;
+      if (current_arg == args.end()) {
+        std::cerr << "Missing queue size" << std::endl;
+        print_usage(args[0]);
+        return 1;
+      }
+      queue_size = std::stoul(*current_arg);
+      current_arg++;
+    } else if (*current_arg == "--spill-dir" || *current_arg == "-s") {
+      current_arg++;
+      if (current_arg == args.end()) {
+        std::cerr << "Missing spill directory" << std::endl;
+        print_usage(args[0]);
+        return 1;
+      }
+      spill_directory = *current_arg;
+      current_arg++;
+    } else if (*current_arg == "--verbose" || *current_arg == "-v") {
+      verbose = true;
+      current_arg++;
+    } else if (*current_arg == "-" || current_arg->rfind("-", 0) != 0) {
+      paths.push_back(*current_arg);
+      current_arg++;
+    } else {
+      std::cerr << "Unknown argument: " << *current_arg << std::endl;
+      print_usage(args[0]);
+      return 1;
+    }
+  }
+
+  if (paths.empty()) {
+    print_usage(args[0]);
+    return 1;
+  }
+
+  if (spill_directory.empty()) {
+    spill_directory = std::filesystem::temp_directory_path().string();
+  }
+
+  // A consumer that exits early fails only its own output instead of terminating the tee.
+  std::signal(SIGPIPE, SIG_IGN);
+
+  std::vector<std::unique_ptr<TeeOutput>> outputs;
+  for (auto& path : paths) {
+    outputs.push_back(std::make_unique<TeeOutput>(path, queue_size << 20, policy, spill_directory));
+  }
+
+  auto write_all = [&](std::shared_ptr<const std::string> chunk, uint64_t items, bool required) {
+    for (auto& output : outputs) {
+      output->Write(chunk, items, required);
+    }
+  };
+
+  BinaryStreamScanner scanner(std::cin);
+  write_all(std::make_shared<const std::string>(serialize_stream_preamble(scanner.Header())), 0, true);
+
+  // Items are forwarded as they were encoded, in blocks that all outputs share.
+  std::string bytes;
+  bytes.reserve(2 * kBlockBytes);
+  uint64_t items = 0;
+  StreamIndexEntry entry;
+  while (scanner.Next(entry, &bytes)) {
+    items++;
+    if (bytes.size() >= kBlockBytes) {
+      write_all(make_block(items, bytes), items, false);
+      bytes.clear();
+      items = 0;
+    }
+  }
+
+  if (items > 0) {
+    write_all(make_block(items, bytes), items, false);
+  }
+  write_all(make_block(0, ""), 0, true);
+
+  int status = 0;
+  for (auto& output : outputs) {
+    try {
+      output->Close();
+    } catch (const std::exception& e) {
+      std::cerr << e.what() << std::endl;
+      status = 1;
+    }
+
+    if (verbose) {
+      std::cerr << output->Path() << ": " << output->WrittenItems() << " items written, " << output->DroppedItems()
+                << " dropped, " << output->SpilledBytes() / 1e6 << " MB spilled" << std::endl;
+    }
+  }
+
+  return status;
+}
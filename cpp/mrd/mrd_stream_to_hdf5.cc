@@ -1,18 +1,333 @@
 #include "generated/binary/protocols.h"
-#include "generated/hdf5/protocols.h"
+#include "hdf5_part_writer.h"
+#include "hdf5_storage.h"
+#include "stream_index.h"
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
 #include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <stdexcept>
+
+enum class SplitMode { kNone, kSeries, kType, kSize };
+
+// Number of items after which a series part that has not been written to is finished.
+constexpr size_t kIdlePartItems = 1024;
+
+// Largest --split size in MB whose size in bytes fits in 64 bits.
+constexpr uint64_t kMaxSplitMegabytes = std::numeric_limits<uint64_t>::max() >> 20;
+
+struct ManifestEntry {
+  std::string key;
+  std::string filename;
+  size_t items;
+  bool complete;
+};
+
+// Images are split by image_series_index, all other items go to a part of their own.
+std::string series_key(const mrd::StreamItem& item) {
+  return std::visit(
+      [](auto&& arg) -> std::string {
+        using T = std::decay_t<decltype(arg)>;
+        if constexpr (std::is_same_v<T, mrd::Acquisition> || std::is_same_v<T, mrd::Waveform<uint32_t>>) {
+          return "raw";
+        } else if (arg.image_series_index) {
+          return "series-" + std::to_string(*arg.image_series_index);
+        } else {
+          return "series-none";
+        }
+      },
+      item);
+}
+
+std::string type_key(const mrd::StreamItem& item) {
+  std::string key = kStreamItemTypeNames[item.index()];
+  std::replace(key.begin(), key.end(), '<', '-');
+  key.erase(std::remove(key.begin(), key.end(), '>'), key.end());
+  return key;
+}
+
+// Inserts the key before the extension: images.h5 -> images.series-1.h5
+std::string part_filename_for(const std::string& filename, const std::string& key) {
+  std::filesystem::path path(filename);
+  return path.replace_filename(path.stem().string() + "." + key + path.extension().string()).string();
+}
+
+// Parses a positive integer option value, throwing std::invalid_argument if it is not one or exceeds max.
+uint64_t parse_positive(const std::string& value, const std::string& what, uint64_t max) {
+  uint64_t n = 0;
+  auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), n);
+  if (ec != std::errc() || ptr != value.data() + value.size() || n == 0 || n > max) {
+    throw std::invalid_argument("Invalid " + what + " " + value + ", expected 1 to " + std::to_string(max));
+  }
+  return n;
+}
+
+std::string json_string(const std::string& s) {
+  std::string out = "\"";
+  for (char c : s) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char escaped[8];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned int>(c));
+      out += escaped;
+    } else {
+      out += c;
+    }
+  }
+  return out + "\"";
+}
+
+// Writes <filename>.manifest.json, listing the part files and whether they are complete.
+// The manifest is replaced atomically, so readers never see a partial one.
+void write_manifest(const std::string& filename, const std::vector<ManifestEntry>& manifest) {
+  auto manifest_filename = filename + ".manifest.json";
+  auto tmp_filename = manifest_filename + ".tmp";
+  {
+    std::ofstream os(tmp_filename);
+    os << "{\n  \"parts\": [";
+    for (size_t i = 0; i < manifest.size(); i++) {
+      auto& e = manifest[i];
+      os << (i > 0 ? "," : "") << "\n    {\"key\": " << json_string(e.key)
+         << ", \"file\": " << json_string(std::filesystem::path(e.filename).filename().string())
+         << ", \"items\": " << e.items
+         << ", \"complete\": " << (e.complete ? "true" : "false") << "}";
+    }
+    os << "\n  ]\n}\n";
+    if (!os) {
+      throw std::runtime_error("Failed to write " + tmp_filename);
+    }
+  }
+  std::filesystem::rename(tmp_filename, manifest_filename);
+}
+
+void print_usage(std::string program_name) {
+  std::cerr << "Usage: " << program_name << " [options] <filename>" << std::endl;
+  std::cerr << "  -c|--chunk-size  <items per dataset chunk>" << std::endl;
+  std::cerr << "  -z|--compression <none|deflate[:level]|lz4>" << std::endl;
+  std::cerr << "  -s|--shuffle" << std::endl;
+  std::cerr << "  -b|--batch-size  <items per write>" << std::endl;
+  std::cerr << "  -i|--index       (write <filename>.mrdidx for selective reads with mrd_hdf5_to_stream)" << std::endl;
+  std::cerr << "  -p|--split <series|type|size:<MB>> (write parts <name>.<part>.h5 and <filename>.manifest.json)" << std::endl;
+  std::cerr << "  -h|--help" << std::endl;
+}
 
 int main(int argc, char** argv) {
-  if (argc < 2) {
-    std::cerr << "Usage: " << argv[0] << " <filename>" << std::endl;
+  Hdf5StorageOptions storage;
+  size_t batch_size = 1;
+  bool write_index = false;
+  SplitMode split = SplitMode::kNone;
+  uint64_t split_bytes = 0;
+  std::string filename;
+
+  std::vector<std::string> args(argv, argv + argc);
+  auto current_arg = args.begin() + 1;
+  while (current_arg != args.end()) {
+    if (*current_arg == "--help" || *current_arg == "-h") {
+      print_usage(args[0]);
+      return 0;
+    } else if (*current_arg == "--chunk-size" || *current_arg == "-c") {
+      current_arg++;
+      if (current_arg == args.end()) {
+        std::cerr << "Missing chunk size" << std::endl;
+        print_usage(args[0]);
+        return 1;
+      }
+      try {
+        storage.chunk_size = parse_positive(*current_arg, "chunk size", std::numeric_limits<uint32_t>::max());
+      } catch (const std::invalid_argument& e) {
+        std::cerr << e.what() << std::endl;
+        print_usage(args[0]);
+        return 1;
+      }
+      current_arg++;
+    } else if (*current_arg == "--compression" || *current_arg == "-z") {
+      current_arg++;
+      if (current_arg == args.end()) {
+        std::cerr << "Missing compression" << std::endl;
+        print_usage(args[0]);
+        return 1;
+      }
+      try {
+        parse_hdf5_compression(*current_arg, storage);
+      } catch (const std::runtime_error& e) {
+        std::cerr << e.what() << std::endl;
+        print_usage(args[0]);
+        return 1;
+      }
+      current_arg++;
+    } else if (*current_arg == "--shuffle" || *current_arg == "-s") {
+      storage.shuffle = true;
+      current_arg++;
+    } else if (*current_arg == "--batch-size" || *current_arg == "-b") {
+      current_arg++;
+      if (current_arg == args.end()) {
+        std::cerr << "Missing batch size" << std::endl;
+        print_usage(args[0]);
+        return 1;
+      }
+      try {
+        batch_size = parse_positive(*current_arg, "batch size", std::numeric_limits<uint32_t>::max());
+      } catch (const std::invalid_argument& e) {
+        std::cerr << e.what() << std::endl;
+        print_usage(args[0]);
+        return 1;
+      }
+      current_arg++;
+    } else if (*current_arg == "--index" || *current_arg == "-i") {
+      write_index = true;
+      current_arg++;
+    } else if (*current_arg == "--split" || *current_arg == "-p") {
+      current_arg++;
+      if (current_arg == args.end()) {
+        std::cerr << "Missing split mode" << std::endl;
+        print_usage(args[0]);
+        return 1;
+      }
+      if (*current_arg == "series") {
+        split = SplitMode::kSeries;
+      } else if (*current_arg == "type") {
+        split = SplitMode::kType;
+      } else if (current_arg->rfind("size:", 0) == 0) {
+        split = SplitMode::kSize;
+        try {
+          split_bytes = parse_positive(current_arg->substr(5), "split size", kMaxSplitMegabytes) << 20;
+        } catch (const std::invalid_argument& e) {
+          std::cerr << e.what() << std::endl;
+          print_usage(args[0]);
+          return 1;
+        }
+      } else {
+        std::cerr << "Unknown split mode: " << *current_arg << std::endl;
+        print_usage(args[0]);
+        return 1;
+      }
+      current_arg++;
+    } else if (filename.empty() && current_arg->rfind("-", 0) != 0) {
+      filename = *current_arg;
+      current_arg++;
+    } else {
+      std::cerr << "Unknown argument: " << *current_arg << std::endl;
+      print_usage(args[0]);
+      return 1;
+    }
+  }
+
+  if (filename.empty()) {
+    print_usage(args[0]);
+    return 1;
+  }
+
+  try {
+    check_hdf5_storage(storage);
+  } catch (const std::runtime_error& e) {
+    std::cerr << e.what() << std::endl;
     return 1;
   }
 
-  std::string filename = argv[1];
+  std::vector<ManifestEntry> manifest;
+  struct Part {
+    size_t manifest_index;
+    std::unique_ptr<Hdf5PartWriter> writer;
+    size_t last_item;  // Number of the last item written to the part
+  };
+  std::map<std::string, Part> parts;
+  std::map<std::string, size_t> part_files;  // Number of files opened per key
+  size_t size_part_number = 0;
+  size_t item_number = 0;
+
+  // Finishes the file of an open part and records it as complete.
+  auto close_part = [&](std::map<std::string, Part>::iterator it) {
+    auto& part = it->second;
+    part.writer->Close();
+    manifest[part.manifest_index].items = part.writer->Items();
+    manifest[part.manifest_index].complete = true;
+    if (split != SplitMode::kNone) {
+      write_manifest(filename, manifest);
+    }
+    parts.erase(it);
+  };
 
   mrd::binary::MrdReader r(std::cin);
-  mrd::hdf5::MrdWriter w(filename);
-  r.CopyTo(w);
+  std::optional<mrd::Header> h;
+  r.ReadHeader(h);
+
+  // A key whose part was finished before the end of the stream continues in a new file: images.series-1.1.h5
+  auto open_part = [&](const std::string& key) {
+    auto file_number = part_files[key]++;
+    auto part_key = file_number == 0 ? key : key + "." + std::to_string(file_number);
+    auto part_filename = split == SplitMode::kNone ? filename : part_filename_for(filename, part_key);
+    manifest.push_back({key, part_filename, 0, false});
+    auto writer = std::make_unique<Hdf5PartWriter>(part_filename, h, storage, batch_size, write_index);
+    auto it = parts.emplace(key, Part{manifest.size() - 1, std::move(writer), item_number}).first;
+    if (split != SplitMode::kNone) {
+      write_manifest(filename, manifest);
+    }
+    return it;
+  };
+
+  // Without splitting, the file is written even if the stream has no items.
+  if (split == SplitMode::kNone) {
+    open_part("all");
+  }
+
+  std::vector<mrd::StreamItem> batch;
+  batch.reserve(batch_size);
+  while (r.ReadData(batch)) {
+    for (auto& item : batch) {
+      std::string key;
+      switch (split) {
+        case SplitMode::kNone:
+          key = "all";
+          break;
+        case SplitMode::kSeries:
+          key = series_key(item);
+          break;
+        case SplitMode::kType:
+          key = type_key(item);
+          break;
+        case SplitMode::kSize:
+          key = "part-" + std::to_string(size_part_number);
+          break;
+      }
+
+      auto it = parts.find(key);
+      if (it == parts.end()) {
+        it = open_part(key);
+      }
+
+      auto& writer = it->second.writer;
+      writer->Write(std::move(item));
+      it->second.last_item = item_number++;
+
+      if (split == SplitMode::kSize && writer->DataBytes() >= split_bytes) {
+        close_part(it);
+        size_part_number++;
+      }
+    }
+
+    // Series that have not been written to for a while are finished, so that their files are
+    // complete before the stream ends.
+    if (split == SplitMode::kSeries) {
+      for (auto it = parts.begin(); it != parts.end();) {
+        auto next = std::next(it);
+        if (item_number - it->second.last_item > kIdlePartItems) {
+          close_part(it);
+        }
+        it = next;
+      }
+    }
+  }
+
+  while (!parts.empty()) {
+    close_part(parts.begin());
+  }
+
   return 0;
 }
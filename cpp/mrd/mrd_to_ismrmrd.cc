@@ -1,28 +1,22 @@
 #include "generated/binary/protocols.h"
+#include "channel_mask.h"
+#include "date_time.h"
+#include "fd_stream.h"
+#include "image_meta.h"
+#include "stream_server.h"
+#include <algorithm>
 #include <filesystem>
 #include <iostream>
+#include <mutex>
+#include <thread>
 #include <exception>
 #include <ismrmrd/dataset.h>
-#include <ismrmrd/meta.h>
 #include <ismrmrd/serialization_iostream.h>
 #include <ismrmrd/xml.h>
 #include <ismrmrd/version.h>
+#include <unistd.h>
 #include <xtensor/xview.hpp>
 
-std::string date_to_string(const yardl::Date &d)
-{
-    std::stringstream ss;
-    ss << date::format("%F", d);
-    return ss.str();
-}
-
-std::string time_to_string(const yardl::Time &t)
-{
-    std::stringstream ss;
-    ss << date::format("%T", t);
-    return ss.str();
-};
-
 // Convert mrd::SubjectInformationType to ISMRMRD::SubjectInformation
 ISMRMRD::SubjectInformation convert(mrd::SubjectInformationType &subjectInformation)
 {
@@ -1045,7 +1039,8 @@ ISMRMRD::EncodingCounters convert(mrd::EncodingCounters &e)
 }
 
 // Convert mrd::Acquisition to ISMRMRD::Acquisition
-ISMRMRD::Acquisition convert(mrd::Acquisition &acq)
+// receiver_channels is the number of receiver channels in the system (from the header), if known.
+ISMRMRD::Acquisition convert(mrd::Acquisition &acq, std::optional<uint32_t> receiver_channels = std::nullopt)
 {
     ISMRMRD::Acquisition acquisition;
     ISMRMRD::AcquisitionHeader hdr;
@@ -1069,6 +1064,32 @@ ISMRMRD::Acquisition convert(mrd::Acquisition &acq)
     hdr.number_of_samples = acq.data.shape()[1];
     hdr.active_channels = acq.data.shape()[0];
     hdr.available_channels = acq.data.shape()[0];
+    if (receiver_channels && *receiver_channels > hdr.available_channels)
+    {
+        hdr.available_channels = *receiver_channels;
+    }
+    // A channel_order that does not match the rows of data would make consumers skip the wrong
+    // channels, so no mask is written for it.
+    bool use_channel_order = channel_order_matches(acq.channel_order, hdr.active_channels);
+    if (!use_channel_order)
+    {
+        static std::once_flag warned;
+        std::call_once(warned, [&]
+                       { std::cerr << "Warning: ignoring channel_order that does not match the number of channels ("
+                                   << acq.channel_order.size() << " channels listed, " << hdr.active_channels << " in the data)" << std::endl; });
+    }
+    if (use_channel_order && !acq.channel_order.empty())
+    {
+        auto max_channel = *std::max_element(acq.channel_order.begin(), acq.channel_order.end());
+        if (max_channel >= hdr.available_channels)
+        {
+            hdr.available_channels = max_channel + 1;
+        }
+    }
+    if (use_channel_order)
+    {
+        channel_mask_from_order(acq.channel_order, hdr.channel_mask);
+    }
     hdr.discard_pre = acq.discard_pre ? *acq.discard_pre : 0;
     hdr.discard_post = acq.discard_post ? *acq.discard_post : 0;
     hdr.encoding_space_ref = acq.encoding_space_ref ? *acq.encoding_space_ref : 0;
@@ -1243,18 +1264,7 @@ ISMRMRD::Image<T> convert(mrd::Image<T> &image)
         im.setUserFloat(i, image.user_float[i]);
     }
 
-    ISMRMRD::MetaContainer meta;
-    for (auto it = image.meta.begin(); it != image.meta.end(); it++)
-    {
-        for (auto it2 = it->second.begin(); it2 != it->second.end(); it2++)
-        {
-            meta.append(it->first.c_str(), (*it2).c_str());
-        }
-    }
-
-    std::stringstream ss;
-    ISMRMRD::serialize(meta, ss);
-    im.setAttributeString(ss.str());
+    im.setAttributeString(format_meta_xml(image.meta));
 
     for (int c = 0; c < im.getNumberOfChannels(); c++)
     {
@@ -1273,11 +1283,20 @@ ISMRMRD::Image<T> convert(mrd::Image<T> &image)
     return im;
 }
 
-int main()
+void print_usage(std::string program_name)
+{
+    std::cerr << "Usage: " << program_name << std::endl;
+    std::cerr << "  -b|--buffer-size <output buffer size in bytes>" << std::endl;
+    print_server_usage();
+    std::cerr << "  -h|--help" << std::endl;
+}
+
+// Converts one MRD stream read from in to an ISMRMRD stream written to out.
+int convert_stream(std::istream &in, std::ostream &out)
 {
-    ISMRMRD::OStreamView ws(std::cout);
+    ISMRMRD::OStreamView ws(out);
     ISMRMRD::ProtocolSerializer serializer(ws);
-    mrd::binary::MrdReader r(std::cin);
+    mrd::binary::MrdReader r(in);
 
     std::optional<mrd::Header> header;
     r.ReadHeader(header);
@@ -1286,9 +1305,21 @@ int main()
         serializer.serialize(convert(*header));
     }
 
+    std::optional<uint32_t> receiver_channels;
+    if (header && header->acquisition_system_information)
+    {
+        receiver_channels = header->acquisition_system_information->receiver_channels;
+    }
+
     mrd::StreamItem item;
     while (r.ReadData(item))
     {
+        if (auto acq = std::get_if<mrd::Acquisition>(&item))
+        {
+            serializer.serialize(convert(*acq, receiver_channels));
+            continue;
+        }
+
         std::visit([&serializer](auto &&arg)
                    { serializer.serialize(convert(arg)); },
                    item);
@@ -1298,3 +1329,109 @@ int main()
 
     return 0;
 }
+
+int main(int argc, char **argv)
+{
+    size_t buffer_size = kDefaultOutputBufferSize;
+    std::optional<std::string> server_address;
+    size_t threads = std::thread::hardware_concurrency();
+
+    std::vector<std::string> args(argv, argv + argc);
+    auto current_arg = args.begin() + 1;
+    while (current_arg != args.end())
+    {
+        if (*current_arg == "--help" || *current_arg == "-h")
+        {
+            print_usage(args[0]);
+            return 0;
+        }
+        else if (*current_arg == "--buffer-size" || *current_arg == "-b")
+        {
+            current_arg++;
+            if (current_arg == args.end())
+            {
+                std::cerr << "Missing buffer size" << std::endl;
+                print_usage(args[0]);
+                return 1;
+            }
+            try
+            {
+                buffer_size = parse_buffer_size(*current_arg);
+            }
+            catch (const std::invalid_argument &e)
+            {
+                std::cerr << e.what() << std::endl;
+                print_usage(args[0]);
+                return 1;
+            }
+            current_arg++;
+        }
+        else if (*current_arg == "--server" || *current_arg == "-s")
+        {
+            current_arg++;
+            if (current_arg == args.end())
+            {
+                std::cerr << "Missing server address" << std::endl;
+                print_usage(args[0]);
+                return 1;
+            }
+            try
+            {
+                check_server_address(*current_arg);
+            }
+            catch (const std::invalid_argument &e)
+            {
+                std::cerr << e.what() << std::endl;
+                print_usage(args[0]);
+                return 1;
+            }
+            server_address = *current_arg;
+            current_arg++;
+        }
+        else if (*current_arg == "--threads" || *current_arg == "-t")
+        {
+            current_arg++;
+            if (current_arg == args.end())
+            {
+                std::cerr << "Missing number of threads" << std::endl;
+                print_usage(args[0]);
+                return 1;
+            }
+            try
+            {
+                threads = parse_server_threads(*current_arg);
+            }
+            catch (const std::invalid_argument &e)
+            {
+                std::cerr << e.what() << std::endl;
+                print_usage(args[0]);
+                return 1;
+            }
+            current_arg++;
+        }
+        else
+        {
+            std::cerr << "Unknown argument: " << *current_arg << std::endl;
+            print_usage(args[0]);
+            return 1;
+        }
+    }
+
+    if (server_address)
+    {
+        try
+        {
+            run_stream_server(*server_address, threads, buffer_size, [](std::istream &in, std::ostream &out)
+                              { convert_stream(in, out); });
+        }
+        catch (const std::runtime_error &e)
+        {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    }
+
+    FdOutputStream out(STDOUT_FILENO, buffer_size);
+    int result = convert_stream(std::cin, out);
+    return out.Finish() ? result : 1;
+}
@@ -0,0 +1,88 @@
+#include "philox_noise.h"
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+    constexpr uint32_t kMultiplier0 = 0xD2511F53;
+    constexpr uint32_t kMultiplier1 = 0xCD9E8D57;
+    constexpr uint32_t kWeyl0 = 0x9E3779B9;
+    constexpr uint32_t kWeyl1 = 0xBB67AE85;
+    constexpr int kRounds = 10;
+
+    // Blocks are generated in batches, so that each step runs as a loop over plain arrays.
+    constexpr size_t kBatch = 64;
+
+    // Applies the Philox rounds with the key (k0, k1) to the counters (c0[b], c1[b], c2[b], c3[b]) of a batch
+    // of blocks, each round to all blocks before the next.
+    void philox_rounds(uint32_t *c0, uint32_t *c1, uint32_t *c2, uint32_t *c3, size_t blocks, uint32_t k0, uint32_t k1)
+    {
+        for (int round = 0; round < kRounds; round++)
+        {
+            for (size_t b = 0; b < blocks; b++)
+            {
+                uint64_t p0 = uint64_t(kMultiplier0) * c0[b];
+                uint64_t p1 = uint64_t(kMultiplier1) * c2[b];
+                uint32_t n0 = static_cast<uint32_t>(p1 >> 32) ^ c1[b] ^ k0;
+                uint32_t n2 = static_cast<uint32_t>(p0 >> 32) ^ c3[b] ^ k1;
+                c1[b] = static_cast<uint32_t>(p1);
+                c3[b] = static_cast<uint32_t>(p0);
+                c0[b] = n0;
+                c2[b] = n2;
+            }
+            k0 += kWeyl0;
+            k1 += kWeyl1;
+        }
+    }
+
+    // Maps 32 random bits to (0, 1), so that the logarithm below is finite.
+    inline float to_uniform(uint32_t x)
+    {
+        return ((x >> 8) + 0.5f) * (1.0f / 16777216.0f);
+    }
+}
+
+PhiloxNoise::PhiloxNoise(uint64_t seed, float sigma)
+    : key_{static_cast<uint32_t>(seed), static_cast<uint32_t>(seed >> 32)}, sigma_(sigma)
+{
+}
+
+void PhiloxNoise::Add(std::complex<float> *data, size_t count, uint64_t stream) const
+{
+    uint32_t c0[kBatch], c1[kBatch], c2[kBatch], c3[kBatch];
+    float radius[2 * kBatch], angle[2 * kBatch];
+    for (size_t first = 0; first < count; first += 2 * kBatch)
+    {
+        size_t values = std::min(2 * kBatch, count - first);
+        size_t blocks = (values + 1) / 2;
+
+        // The counter is (block, 0, stream).
+        for (size_t b = 0; b < blocks; b++)
+        {
+            c0[b] = static_cast<uint32_t>(first / 2 + b);
+            c1[b] = 0;
+            c2[b] = static_cast<uint32_t>(stream);
+            c3[b] = static_cast<uint32_t>(stream >> 32);
+        }
+        philox_rounds(c0, c1, c2, c3, blocks, key_[0], key_[1]);
+
+        // Box-Muller: each pair of uniforms gives one complex value.
+        for (size_t b = 0; b < blocks; b++)
+        {
+            radius[2 * b] = sigma_ * std::sqrt(-2.0f * std::log(to_uniform(c0[b])));
+            angle[2 * b] = 6.28318530718f * to_uniform(c1[b]);
+            radius[2 * b + 1] = sigma_ * std::sqrt(-2.0f * std::log(to_uniform(c2[b])));
+            angle[2 * b + 1] = 6.28318530718f * to_uniform(c3[b]);
+        }
+        for (size_t i = 0; i < values; i++)
+        {
+            data[first + i] += std::complex<float>(radius[i] * std::cos(angle[i]), radius[i] * std::sin(angle[i]));
+        }
+    }
+}
+
+std::array<uint32_t, 4> PhiloxNoise::Block(std::array<uint32_t, 4> counter, std::array<uint32_t, 2> key)
+{
+    philox_rounds(&counter[0], &counter[1], &counter[2], &counter[3], 1, key[0], key[1]);
+    return counter;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <array>
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+
+// Complex Gaussian noise from the Philox4x32-10 counter-based generator (Salmon et al., "Parallel
+// random numbers: as easy as 1, 2, 3", SC11). Every value is a function of the seed, a stream
+// number and its position in the stream alone, so streams (e.g. acquisitions) can be filled in any
+// order and on any thread with the same result. One Philox block gives two complex values.
+
+class PhiloxNoise
+{
+public:
+    PhiloxNoise(uint64_t seed, float sigma);
+
+    // Adds noise with standard deviation sigma in both the real and imaginary part to count values,
+    // which are the first count values of the given stream.
+    void Add(std::complex<float> *data, size_t count, uint64_t stream) const;
+
+    // The Philox4x32-10 block for the given counter and key, as used by Add, for checking the generator
+    // against the known-answer vectors of the reference implementation.
+    static std::array<uint32_t, 4> Block(std::array<uint32_t, 4> counter, std::array<uint32_t, 2> key);
+
+private:
+    uint32_t key_[2];
+    float sigma_;
+};
@@ -0,0 +1,91 @@
+#include "philox_noise.h"
+#include "check.h"
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Checks the Philox4x32-10 generator behind the phantom noise against the known-answer vectors of the
+// reference implementation (Random123), and that the noise is built from the blocks of its position.
+
+namespace
+{
+    using check::expect;
+
+    std::string hex(const std::array<uint32_t, 4> &block)
+    {
+        char s[40];
+        std::snprintf(s, sizeof(s), "%08x %08x %08x %08x", block[0], block[1], block[2], block[3]);
+        return s;
+    }
+
+    void check_known_answers()
+    {
+        struct KnownAnswer
+        {
+            std::array<uint32_t, 4> counter;
+            std::array<uint32_t, 2> key;
+            std::array<uint32_t, 4> expected;
+        };
+
+        KnownAnswer known_answers[] = {
+            {{0x00000000, 0x00000000, 0x00000000, 0x00000000}, {0x00000000, 0x00000000}, {0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8}},
+            {{0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff}, {0xffffffff, 0xffffffff}, {0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd}},
+            {{0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344}, {0xa4093822, 0x299f31d0}, {0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1}},
+        };
+
+        for (auto &k : known_answers)
+        {
+            auto block = PhiloxNoise::Block(k.counter, k.key);
+            expect(block == k.expected, "Block(" + hex(k.counter) + ") is " + hex(k.expected) + ", not " + hex(block));
+        }
+    }
+
+    // Value i of a stream is the Box-Muller transform of half of block i / 2, with the counter (i / 2, 0, stream)
+    // and the seed as the key.
+    void check_noise()
+    {
+        uint64_t seed = 0x0123456789abcdef;
+        uint64_t stream = 0xfedcba9876543210;
+        float sigma = 2.0f;
+        std::vector<std::complex<float>> data(1001);
+        PhiloxNoise(seed, sigma).Add(data.data(), data.size(), stream);
+
+        for (size_t i : {size_t(0), size_t(1), size_t(127), size_t(128), size_t(1000)})
+        {
+            auto block = PhiloxNoise::Block({static_cast<uint32_t>(i / 2), 0, static_cast<uint32_t>(stream), static_cast<uint32_t>(stream >> 32)},
+                                            {static_cast<uint32_t>(seed), static_cast<uint32_t>(seed >> 32)});
+            auto uniform = [&](size_t word)
+            {
+                return ((block[word] >> 8) + 0.5) / 16777216.0;
+            };
+            size_t half = 2 * (i % 2);
+            double radius = sigma * std::sqrt(-2.0 * std::log(uniform(half)));
+            double angle = 2 * M_PI * uniform(half + 1);
+            std::complex<double> expected(radius * std::cos(angle), radius * std::sin(angle));
+            expect(std::abs(std::complex<double>(data[i]) - expected) < 1e-4 * sigma, "noise value " + std::to_string(i) + " matches its block");
+        }
+
+        std::vector<std::complex<float>> again(data.size(), std::complex<float>(1, -1));
+        PhiloxNoise(seed, sigma).Add(again.data(), again.size(), stream);
+        bool added = true;
+        for (size_t i = 0; i < data.size(); i++)
+        {
+            added = added && again[i] == data[i] + std::complex<float>(1, -1);
+        }
+        expect(added, "noise is added to the data and does not depend on the call");
+    }
+}
+
+int main()
+{
+    check_known_answers();
+    check_noise();
+    if (check::failures > 0)
+    {
+        std::cerr << check::failures << " Philox noise checks failed" << std::endl;
+        return 1;
+    }
+    return 0;
+}
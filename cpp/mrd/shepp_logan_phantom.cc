@@ -1,17 +1,126 @@
 #include "shepp_logan_phantom.h"
 #include "generated/types.h"
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+namespace {
+constexpr float kPi = 3.14159265359f;
+
+// sin and cos of x for |x| < 2^22, from a reduction to [-pi/4, pi/4] and the minimax polynomials of
+// Cephes (sinf, cosf), accurate to about 1e-7 plus the reduction error of |x| * 1e-7. Unlike
+// std::sin and std::cos, this has no branches or calls, so that loops over it can be vectorized.
+inline void sincos_reduced(float x, float& s, float& c) {
+  constexpr float kRound = 12582912.0f;  // 1.5 * 2^23, adding it rounds to an integer
+  float j = (x * 0.636619772f + kRound) - kRound;
+  float r = ((x - j * 1.5703125f) - j * 4.83751297e-4f) - j * 7.54978995e-8f;
+  float r2 = r * r;
+  float sr = r + r * r2 * (-1.6666654611e-1f + r2 * (8.3321608736e-3f + r2 * -1.9515295891e-4f));
+  float cr = 1.0f - 0.5f * r2 + r2 * r2 * (4.166664568298827e-2f + r2 * (-1.388731625493765e-3f + r2 * 2.443315711809948e-5f));
+  int q = static_cast<int>(j) & 3;
+  float sq = (q & 1) ? cr : sr;
+  float cq = (q & 1) ? sr : cr;
+  s = (q & 2) ? -sq : sq;
+  c = ((q + 1) & 2) ? -cq : cq;
+}
+
+// J1(x) / x for x >= 0, from the rational approximations of J1 in Numerical Recipes (bessj1). Below 8
+// the approximation is x times a ratio of polynomials, so there is no division by x near 0. Both
+// approximations are evaluated and one is selected, so that loops over this can be vectorized.
+inline float jinc(float x) {
+  float y = x * x;
+  float num = 72362614232.0f + y * (-7895059235.0f + y * (242396853.1f + y * (-2972611.439f + y * (15704.48260f + y * (-30.16036606f)))));
+  float den = 144725228442.0f + y * (2300535178.0f + y * (18583304.74f + y * (99447.43394f + y * (376.9991397f + y))));
+  float small = num / den;
+
+  float ax = std::max(x, 8.0f);
+  float z = 8.0f / ax;
+  y = z * z;
+  float p = 1.0f + y * (0.183105e-2f + y * (-0.3516396496e-4f + y * (0.2457520174e-5f + y * (-0.240337019e-6f))));
+  float q = 0.04687499995f + y * (-0.2002690873e-3f + y * (0.8449199096e-5f + y * (-0.88228987e-6f + y * 0.105787412e-6f)));
+  float s, c;
+  sincos_reduced(ax - 2.356194491f, s, c);
+  float large = std::sqrt(0.636619772f / ax) * (c * p - z * s * q) / ax;
+
+  return x < 8.0f ? small : large;
+}
+
+// Size of the grid that coil sensitivities are sampled on to fit their Fourier coefficients.
+constexpr unsigned int kCoilFitGrid = 64;
+
+// Cholesky decomposition L L^H of a Hermitian positive definite n x n matrix (row major).
+std::vector<std::complex<double>> cholesky_decompose(const std::vector<std::complex<double>>& a, size_t n) {
+  std::vector<std::complex<double>> l(n * n, 0.0);
+  for (size_t j = 0; j < n; j++) {
+    std::complex<double> d = a[j * n + j];
+    for (size_t k = 0; k < j; k++) {
+      d -= l[j * n + k] * std::conj(l[j * n + k]);
+    }
+    l[j * n + j] = std::sqrt(d.real());
+    for (size_t i = j + 1; i < n; i++) {
+      std::complex<double> s = a[i * n + j];
+      for (size_t k = 0; k < j; k++) {
+        s -= l[i * n + k] * std::conj(l[j * n + k]);
+      }
+      l[i * n + j] = s / l[j * n + j].real();
+    }
+  }
+  return l;
+}
+
+// Solves L L^H x = b.
+std::vector<std::complex<double>> cholesky_solve(const std::vector<std::complex<double>>& l, size_t n, std::vector<std::complex<double>> b) {
+  for (size_t i = 0; i < n; i++) {
+    for (size_t k = 0; k < i; k++) {
+      b[i] -= l[i * n + k] * b[k];
+    }
+    b[i] /= l[i * n + i].real();
+  }
+  for (size_t i = n; i-- > 0;) {
+    for (size_t k = i + 1; k < n; k++) {
+      b[i] -= std::conj(l[k * n + i]) * b[k];
+    }
+    b[i] /= l[i * n + i].real();
+  }
+  return b;
+}
+} // namespace
 
 mrd::ImageData<std::complex<float>> phantom(std::vector<PhantomEllipse>& ellipses, unsigned int matrix_size) {
   std::array<size_t, 4> shape = {1, 1, matrix_size, matrix_size};
   mrd::ImageData<std::complex<float>> out = xt::zeros<std::complex<float>>(shape);
-  for (std::vector<PhantomEllipse>::iterator it = ellipses.begin(); it != ellipses.end(); it++) {
-    for (unsigned int y = 0; y < matrix_size; y++) {
+  float half = matrix_size >> 1;
+  int last = static_cast<int>(matrix_size) - 1;
+  for (auto& e : ellipses) {
+    // Only rows within the bounding box, and only the span of each row inside the ellipse, are visited.
+    float height = e.halfHeight();
+    int y_begin = std::max(0, static_cast<int>(std::floor((e.getCenterY() - height) * half + half)) - 1);
+    int y_end = std::min(last, static_cast<int>(std::ceil((e.getCenterY() + height) * half + half)) + 1);
+    for (int y = y_begin; y <= y_end; y++) {
       float y_co = (1.0f * y - (matrix_size >> 1)) / (matrix_size >> 1);
-      for (unsigned int x = 0; x < matrix_size; x++) {
-        float x_co = (1.0f * x - (matrix_size >> 1)) / (matrix_size >> 1);
-        if (it->isInside(x_co, y_co)) {
-          out(0, 0, y, x) += std::complex<float>(it->getAmplitude(), 0.0);
-        }
+      float x_min, x_max;
+      if (!e.rowSpan(y_co, x_min, x_max)) {
+        continue;
+      }
+
+      // The span is rounded outwards and then trimmed with the exact test, so that the pixels are
+      // the same as when every pixel is tested.
+      int x_begin = std::max(0, static_cast<int>(std::floor(x_min * half + half)) - 1);
+      int x_end = std::min(last, static_cast<int>(std::ceil(x_max * half + half)) + 1);
+      auto inside = [&](int x) {
+        return e.isInside((1.0f * x - (matrix_size >> 1)) / (matrix_size >> 1), y_co);
+      };
+      while (x_begin <= x_end && !inside(x_begin)) {
+        x_begin++;
+      }
+      while (x_end >= x_begin && !inside(x_end)) {
+        x_end--;
+      }
+
+      std::complex<float>* pixels = &out(0, 0, y, 0);
+      std::complex<float> amplitude(e.getAmplitude(), 0.0f);
+      for (int x = x_begin; x <= x_end; x++) {
+        pixels[x] += amplitude;
       }
     }
   }
@@ -76,3 +185,306 @@ mrd::ImageData<std::complex<float>> generate_birdcage_sensitivities(unsigned int
 
   return out;
 }
+
+PhantomEllipsoid::PhantomEllipsoid(float A, float a, float b, float c, float x0, float y0, float z0, float phi, float theta, float psi)
+    : A_(A), axes_{a, b, c}, center_{x0, y0, z0} {
+  float cphi = std::cos(phi * kPi / 180);
+  float sphi = std::sin(phi * kPi / 180);
+  float ctheta = std::cos(theta * kPi / 180);
+  float stheta = std::sin(theta * kPi / 180);
+  float cpsi = std::cos(psi * kPi / 180);
+  float spsi = std::sin(psi * kPi / 180);
+  rotation_ = {{{cpsi * cphi - ctheta * sphi * spsi, cpsi * sphi + ctheta * cphi * spsi, spsi * stheta},
+                {-spsi * cphi - ctheta * sphi * cpsi, -spsi * sphi + ctheta * cphi * cpsi, cpsi * stheta},
+                {stheta * sphi, -stheta * cphi, ctheta}}};
+}
+
+bool PhantomEllipsoid::isInside(float x, float y, float z) const {
+  float d[3] = {x - center_[0], y - center_[1], z - center_[2]};
+  float sum = 0;
+  for (int i = 0; i < 3; i++) {
+    float p = rotation_[i][0] * d[0] + rotation_[i][1] * d[1] + rotation_[i][2] * d[2];
+    sum += p * p / (axes_[i] * axes_[i]);
+  }
+  return sum <= 1;
+}
+
+bool PhantomEllipsoid::rowSpan(float y, float z, float& x_min, float& x_max) const {
+  // Along the line, each rotated coordinate is r * dx + s, and inside is qa * dx^2 + qb * dx + qc <= 0.
+  float dy = y - center_[1];
+  float dz = z - center_[2];
+  float qa = 0, qb = 0, qc = -1;
+  for (int i = 0; i < 3; i++) {
+    float r = rotation_[i][0];
+    float s = rotation_[i][1] * dy + rotation_[i][2] * dz;
+    float asq = axes_[i] * axes_[i];
+    qa += r * r / asq;
+    qb += 2 * r * s / asq;
+    qc += s * s / asq;
+  }
+  float discriminant = qb * qb - 4 * qa * qc;
+  if (discriminant < 0) {
+    return false;
+  }
+  float root = std::sqrt(discriminant);
+  x_min = center_[0] + (-qb - root) / (2 * qa);
+  x_max = center_[0] + (-qb + root) / (2 * qa);
+  return true;
+}
+
+float PhantomEllipsoid::halfExtent(int axis) const {
+  float sum = 0;
+  for (int i = 0; i < 3; i++) {
+    sum += rotation_[i][axis] * rotation_[i][axis] * axes_[i] * axes_[i];
+  }
+  return std::sqrt(sum);
+}
+
+mrd::ImageData<std::complex<float>> phantom_3d(std::vector<PhantomEllipsoid>& ellipsoids, unsigned int matrix_size, size_t threads) {
+  std::array<size_t, 4> shape = {1, matrix_size, matrix_size, matrix_size};
+  mrd::ImageData<std::complex<float>> out = xt::zeros<std::complex<float>>(shape);
+  float half = matrix_size >> 1;
+  int last = static_cast<int>(matrix_size) - 1;
+  auto coordinate = [&](int i) {
+    return (1.0f * i - (matrix_size >> 1)) / (matrix_size >> 1);
+  };
+  auto bounds = [&](float low, float high, int& begin, int& end) {
+    begin = std::max(0, static_cast<int>(std::floor(low * half + half)) - 1);
+    end = std::min(last, static_cast<int>(std::ceil(high * half + half)) + 1);
+  };
+
+  // Slices are divided among threads. Within a slice, the ellipsoids are rasterized like the
+  // ellipses of phantom(), by bounding box and row spans.
+  std::vector<std::thread> workers;
+  for (size_t t = 0; t < std::max<size_t>(threads, 1); t++) {
+    workers.emplace_back([&, t] {
+      for (int z = static_cast<int>(t); z <= last; z += static_cast<int>(std::max<size_t>(threads, 1))) {
+        float z_co = coordinate(z);
+        for (auto& e : ellipsoids) {
+          if (std::fabs(z_co - e.getCenter(2)) > e.halfExtent(2)) {
+            continue;
+          }
+          int y_begin, y_end;
+          bounds(e.getCenter(1) - e.halfExtent(1), e.getCenter(1) + e.halfExtent(1), y_begin, y_end);
+          for (int y = y_begin; y <= y_end; y++) {
+            float y_co = coordinate(y);
+            float x_min, x_max;
+            if (!e.rowSpan(y_co, z_co, x_min, x_max)) {
+              continue;
+            }
+            int x_begin, x_end;
+            bounds(x_min, x_max, x_begin, x_end);
+            while (x_begin <= x_end && !e.isInside(coordinate(x_begin), y_co, z_co)) {
+              x_begin++;
+            }
+            while (x_end >= x_begin && !e.isInside(coordinate(x_end), y_co, z_co)) {
+              x_end--;
+            }
+
+            std::complex<float>* voxels = &out(0, z, y, 0);
+            std::complex<float> amplitude(e.getAmplitude(), 0.0f);
+            for (int x = x_begin; x <= x_end; x++) {
+              voxels[x] += amplitude;
+            }
+          }
+        }
+      }
+    });
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  return out;
+}
+
+mrd::ImageData<std::complex<float>> shepp_logan_phantom_3d(unsigned int matrix_size, size_t threads) {
+  std::vector<PhantomEllipsoid> e = modified_shepp_logan_ellipsoids();
+  return phantom_3d(e, matrix_size, threads);
+}
+
+std::vector<PhantomEllipsoid> shepp_logan_ellipsoids() {
+  std::vector<PhantomEllipsoid> out;
+  out.push_back(PhantomEllipsoid(1.0f, 0.6900f, 0.9200f, 0.8100f, 0.00f, 0.0000f, 0.00f, 0.0f, 0.0f, 0.0f));
+  out.push_back(PhantomEllipsoid(-0.98f, 0.6624f, 0.8740f, 0.7800f, 0.00f, -0.0184f, 0.00f, 0.0f, 0.0f, 0.0f));
+  out.push_back(PhantomEllipsoid(-0.02f, 0.1100f, 0.3100f, 0.2200f, 0.22f, 0.0000f, 0.00f, -18.0f, 0.0f, 10.0f));
+  out.push_back(PhantomEllipsoid(-0.02f, 0.1600f, 0.4100f, 0.2800f, -0.22f, 0.0000f, 0.00f, 18.0f, 0.0f, 10.0f));
+  out.push_back(PhantomEllipsoid(0.01f, 0.2100f, 0.2500f, 0.4100f, 0.00f, 0.3500f, -0.15f, 0.0f, 0.0f, 0.0f));
+  out.push_back(PhantomEllipsoid(0.01f, 0.0460f, 0.0460f, 0.0500f, 0.00f, 0.1000f, 0.25f, 0.0f, 0.0f, 0.0f));
+  out.push_back(PhantomEllipsoid(0.01f, 0.0460f, 0.0460f, 0.0500f, 0.00f, -0.1000f, 0.25f, 0.0f, 0.0f, 0.0f));
+  out.push_back(PhantomEllipsoid(0.01f, 0.0460f, 0.0230f, 0.0500f, -0.08f, -0.6050f, 0.00f, 0.0f, 0.0f, 0.0f));
+  out.push_back(PhantomEllipsoid(0.01f, 0.0230f, 0.0230f, 0.0200f, 0.00f, -0.6060f, 0.00f, 0.0f, 0.0f, 0.0f));
+  out.push_back(PhantomEllipsoid(0.01f, 0.0230f, 0.0460f, 0.0200f, 0.06f, -0.6050f, 0.00f, 0.0f, 0.0f, 0.0f));
+  return out;
+}
+
+std::vector<PhantomEllipsoid> modified_shepp_logan_ellipsoids() {
+  std::vector<PhantomEllipsoid> out;
+  out.push_back(PhantomEllipsoid(1.0f, .6900f, .9200f, .8100f, 0.00f, 0.0000f, 0.00f, 0.0f, 0.0f, 0.0f));
+  out.push_back(PhantomEllipsoid(-0.8f, .6624f, .8740f, .7800f, 0.00f, -0.0184f, 0.00f, 0.0f, 0.0f, 0.0f));
+  out.push_back(PhantomEllipsoid(-0.2f, .1100f, .3100f, .2200f, 0.22f, 0.0000f, 0.00f, -18.0f, 0.0f, 10.0f));
+  out.push_back(PhantomEllipsoid(-0.2f, .1600f, .4100f, .2800f, -0.22f, 0.0000f, 0.00f, 18.0f, 0.0f, 10.0f));
+  out.push_back(PhantomEllipsoid(0.1f, .2100f, .2500f, .4100f, 0.00f, 0.3500f, -0.15f, 0.0f, 0.0f, 0.0f));
+  out.push_back(PhantomEllipsoid(0.1f, .0460f, .0460f, .0500f, 0.00f, 0.1000f, 0.25f, 0.0f, 0.0f, 0.0f));
+  out.push_back(PhantomEllipsoid(0.1f, .0460f, .0460f, .0500f, 0.00f, -0.1000f, 0.25f, 0.0f, 0.0f, 0.0f));
+  out.push_back(PhantomEllipsoid(0.1f, .0460f, .0230f, .0500f, -0.08f, -0.6050f, 0.00f, 0.0f, 0.0f, 0.0f));
+  out.push_back(PhantomEllipsoid(0.1f, .0230f, .0230f, .0200f, 0.00f, -0.6060f, 0.00f, 0.0f, 0.0f, 0.0f));
+  out.push_back(PhantomEllipsoid(0.1f, .0230f, .0460f, .0200f, 0.06f, -0.6050f, 0.00f, 0.0f, 0.0f, 0.0f));
+  return out;
+}
+
+std::complex<float> birdcage_sensitivity_3d(float x, float y, float z, unsigned int c, unsigned int ncoils, unsigned int rings, float relative_radius) {
+  // Coils alternate between rings, and each ring is centered in an equal part of [-1, 1] along z.
+  rings = std::max(1u, std::min(rings, ncoils));
+  unsigned int per_ring = (ncoils + rings - 1) / rings;
+  unsigned int ring = c % rings;
+  float angle = (c / rings) * (2 * kPi / per_ring);
+  float coilx = relative_radius * std::cos(angle);
+  float coily = relative_radius * std::sin(angle);
+  float coilz = (2.0f * ring + 1) / rings - 1;
+  float x_co = x - coilx;
+  float y_co = y - coily;
+  float z_co = z - coilz;
+  float rr = std::sqrt(x_co * x_co + y_co * y_co + z_co * z_co);
+  return std::polar(1 / rr, std::atan2(x_co, -y_co) - angle);
+}
+
+AnalyticKspace::AnalyticKspace(std::vector<PhantomEllipse>& ellipses, unsigned int ncoils, float relative_radius, unsigned int coil_order)
+    : ncoils_(ncoils) {
+  for (auto& e : ellipses) {
+    float phi = e.getRotation() * kPi / 180;
+    float a = e.getSemiAxisA();
+    float b = e.getSemiAxisB();
+
+    // The transform of the unit disk is J1(2 pi k) / k = 2 pi jinc(2 pi k), scaled by the area a * b.
+    ellipses_.push_back({e.getAmplitude() * a * b * 2 * kPi, a, b, std::cos(phi), std::sin(phi), e.getCenterX(), e.getCenterY()});
+  }
+
+  // Fourier series of the sensitivities with period 2 (the field of view). The sensitivities are not
+  // periodic, so the coefficients are a least squares fit over the support of the phantom, which is
+  // the only place where they matter, rather than a truncated transform with ringing at the edges.
+  int order = static_cast<int>(coil_order);
+  for (int n = -order; n <= order; n++) {
+    for (int m = -order; m <= order; m++) {
+      qx_.push_back(0.5f * m);
+      qy_.push_back(0.5f * n);
+    }
+  }
+  size_t terms = qx_.size();
+
+  auto support = phantom(ellipses, kCoilFitGrid);
+  auto coils = generate_birdcage_sensitivities(kCoilFitGrid, ncoils, relative_radius);
+  std::vector<std::complex<double>> basis;
+  std::vector<std::pair<unsigned int, unsigned int>> points;
+  for (unsigned int y = 0; y < kCoilFitGrid; y++) {
+    float y_co = (1.0f * y - (kCoilFitGrid >> 1)) / (kCoilFitGrid >> 1);
+    for (unsigned int x = 0; x < kCoilFitGrid; x++) {
+      float x_co = (1.0f * x - (kCoilFitGrid >> 1)) / (kCoilFitGrid >> 1);
+      if (support(0, 0, y, x) == std::complex<float>(0.0f)) {
+        continue;
+      }
+      points.emplace_back(y, x);
+      for (size_t t = 0; t < terms; t++) {
+        basis.push_back(std::polar(1.0, 2.0 * kPi * (qx_[t] * x_co + qy_[t] * y_co)));
+      }
+    }
+  }
+
+  // Normal equations, shared by all coils, with a little regularization since high frequencies
+  // are poorly determined by a support smaller than the period.
+  std::vector<std::complex<double>> normal(terms * terms, 0.0);
+  for (size_t p = 0; p < points.size(); p++) {
+    const std::complex<double>* row = basis.data() + p * terms;
+    for (size_t i = 0; i < terms; i++) {
+      for (size_t j = 0; j < terms; j++) {
+        normal[i * terms + j] += std::conj(row[i]) * row[j];
+      }
+    }
+  }
+  for (size_t i = 0; i < terms; i++) {
+    normal[i * terms + i] += 1e-3 * points.size();
+  }
+  auto cholesky = cholesky_decompose(normal, terms);
+
+  coefficients_.resize(ncoils * terms);
+  for (unsigned int c = 0; c < ncoils; c++) {
+    std::vector<std::complex<double>> rhs(terms, 0.0);
+    for (size_t p = 0; p < points.size(); p++) {
+      std::complex<double> value = coils(c, 0, points[p].first, points[p].second);
+      for (size_t i = 0; i < terms; i++) {
+        rhs[i] += std::conj(basis[p * terms + i]) * value;
+      }
+    }
+    auto solution = cholesky_solve(cholesky, terms, rhs);
+    for (size_t t = 0; t < terms; t++) {
+      coefficients_[c * terms + t] = std::complex<float>(solution[t]);
+    }
+  }
+}
+
+void AnalyticKspace::evaluate(const float* kx, const float* ky, size_t count, std::complex<float>* out) const {
+  // The loops run over arrays of samples, with real and imaginary parts in separate arrays, so that
+  // the compiler can vectorize them. Per ellipse, the sample location in the ellipse's frame and the
+  // phase at the unshifted sample are computed once and reused for every term:
+  // exp(-2 pi i (k - q) . c) = exp(-2 pi i k . c) * exp(2 pi i q . c).
+  size_t nellipses = ellipses_.size();
+  std::vector<float> ku(nellipses * count);
+  std::vector<float> kv(nellipses * count);
+  std::vector<float> phase_re(nellipses * count);
+  std::vector<float> phase_im(nellipses * count);
+  for (size_t e = 0; e < nellipses; e++) {
+    const Ellipse& el = ellipses_[e];
+    for (size_t i = 0; i < count; i++) {
+      ku[e * count + i] = el.a * (kx[i] * el.cosp + ky[i] * el.sinp);
+      kv[e * count + i] = el.b * (ky[i] * el.cosp - kx[i] * el.sinp);
+      sincos_reduced(-2 * kPi * (kx[i] * el.x0 + ky[i] * el.y0), phase_im[e * count + i], phase_re[e * count + i]);
+    }
+  }
+
+  std::vector<float> out_re(ncoils_ * count, 0.0f);
+  std::vector<float> out_im(ncoils_ * count, 0.0f);
+  std::vector<float> term_re(count);
+  std::vector<float> term_im(count);
+  std::vector<float> j(count);
+  size_t terms = qx_.size();
+  for (size_t t = 0; t < terms; t++) {
+    std::fill(term_re.begin(), term_re.end(), 0.0f);
+    std::fill(term_im.begin(), term_im.end(), 0.0f);
+    for (size_t e = 0; e < nellipses; e++) {
+      const Ellipse& el = ellipses_[e];
+      float qu = el.a * (qx_[t] * el.cosp + qy_[t] * el.sinp);
+      float qv = el.b * (qy_[t] * el.cosp - qx_[t] * el.sinp);
+      const float* u = ku.data() + e * count;
+      const float* v = kv.data() + e * count;
+      for (size_t i = 0; i < count; i++) {
+        float du = u[i] - qu;
+        float dv = v[i] - qv;
+        j[i] = jinc(2 * kPi * std::sqrt(du * du + dv * dv));
+      }
+
+      std::complex<float> shift = std::polar(el.scale, 2 * kPi * (qx_[t] * el.x0 + qy_[t] * el.y0));
+      float sr = shift.real();
+      float si = shift.imag();
+      const float* pr = phase_re.data() + e * count;
+      const float* pi = phase_im.data() + e * count;
+      for (size_t i = 0; i < count; i++) {
+        term_re[i] += j[i] * (sr * pr[i] - si * pi[i]);
+        term_im[i] += j[i] * (sr * pi[i] + si * pr[i]);
+      }
+    }
+
+    for (unsigned int c = 0; c < ncoils_; c++) {
+      float cr = coefficients_[c * terms + t].real();
+      float ci = coefficients_[c * terms + t].imag();
+      float* o_re = out_re.data() + c * count;
+      float* o_im = out_im.data() + c * count;
+      for (size_t i = 0; i < count; i++) {
+        o_re[i] += cr * term_re[i] - ci * term_im[i];
+        o_im[i] += cr * term_im[i] + ci * term_re[i];
+      }
+    }
+  }
+
+  for (size_t i = 0; i < ncoils_ * count; i++) {
+    out[i] = std::complex<float>(out_re[i], out_im[i]);
+  }
+}
@@ -1,6 +1,8 @@
 #pragma once
 
 #include "generated/types.h"
+#include <array>
+#include <cmath>
 #include <complex>
 #include <vector>
 
@@ -8,23 +10,66 @@ class PhantomEllipse {
   public:
   PhantomEllipse(float A, float a, float b, float x0, float y0, float phi)
       : A_(A), a_(a), b_(b), x0_(x0), y0_(y0), phi_(phi) {
+    float radians = phi_ * 3.14159265359f / 180;
+    asq_ = a_ * a_;
+    bsq_ = b_ * b_;
+    cosp_ = cos(radians);
+    sinp_ = sin(radians);
   }
 
-  bool isInside(float x, float y) {
-    float asq = a_ * a_;                     // a^2
-    float bsq = b_ * b_;                     // b^2
-    float phi = phi_ * 3.14159265359f / 180; // rotation angle in radians
-    float x0 = x - x0_;                      // x offset
-    float y0 = y - y0_;                      // y offset
-    float cosp = cos(phi);
-    float sinp = sin(phi);
-    return (((x0 * cosp + y0 * sinp) * (x0 * cosp + y0 * sinp)) / asq + ((y0 * cosp - x0 * sinp) * (y0 * cosp - x0 * sinp)) / bsq <= 1);
+  bool isInside(float x, float y) const {
+    float x0 = x - x0_; // x offset
+    float y0 = y - y0_; // y offset
+    return (((x0 * cosp_ + y0 * sinp_) * (x0 * cosp_ + y0 * sinp_)) / asq_ + ((y0 * cosp_ - x0 * sinp_) * (y0 * cosp_ - x0 * sinp_)) / bsq_ <= 1);
   }
 
-  float getAmplitude() {
+  // Finds the range of x where the ellipse intersects the horizontal line at y.
+  // Returns false if it does not intersect the line.
+  bool rowSpan(float y, float& x_min, float& x_max) const {
+    // Inside is a quadratic inequality in the x offset: qa * x0^2 + qb * x0 + qc <= 0.
+    float y0 = y - y0_;
+    float qa = cosp_ * cosp_ / asq_ + sinp_ * sinp_ / bsq_;
+    float qb = 2 * y0 * cosp_ * sinp_ * (1 / asq_ - 1 / bsq_);
+    float qc = y0 * y0 * (sinp_ * sinp_ / asq_ + cosp_ * cosp_ / bsq_) - 1;
+    float discriminant = qb * qb - 4 * qa * qc;
+    if (discriminant < 0) {
+      return false;
+    }
+    float root = std::sqrt(discriminant);
+    x_min = x0_ + (-qb - root) / (2 * qa);
+    x_max = x0_ + (-qb + root) / (2 * qa);
+    return true;
+  }
+
+  // Half the height of the ellipse's bounding box.
+  float halfHeight() const {
+    return std::sqrt(asq_ * sinp_ * sinp_ + bsq_ * cosp_ * cosp_);
+  }
+
+  float getAmplitude() const {
     return A_;
   }
 
+  float getSemiAxisA() const {
+    return a_;
+  }
+
+  float getSemiAxisB() const {
+    return b_;
+  }
+
+  float getCenterX() const {
+    return x0_;
+  }
+
+  float getCenterY() const {
+    return y0_;
+  }
+
+  float getRotation() const {
+    return phi_;
+  }
+
   protected:
   float A_;
   float a_;
@@ -32,6 +77,43 @@ class PhantomEllipse {
   float x0_;
   float y0_;
   float phi_;
+
+  // Precomputed, since the rasterizer tests many points per ellipse.
+  float asq_;
+  float bsq_;
+  float cosp_;
+  float sinp_;
+};
+
+// Ellipsoid with semi-axes a, b and c along x, y and z, centered at (x0, y0, z0) and rotated by the
+// Euler angles phi, theta and psi (degrees), with the conventions of phantom3d.m by Matthias Schabel.
+// With theta = psi = 0, it is a PhantomEllipse extruded along z.
+class PhantomEllipsoid {
+  public:
+  PhantomEllipsoid(float A, float a, float b, float c, float x0, float y0, float z0, float phi, float theta, float psi);
+
+  bool isInside(float x, float y, float z) const;
+
+  // Finds the range of x where the ellipsoid intersects the line along x at (y, z).
+  // Returns false if it does not intersect the line.
+  bool rowSpan(float y, float z, float& x_min, float& x_max) const;
+
+  // Half the size of the ellipsoid's bounding box along axis 0 (x), 1 (y) or 2 (z).
+  float halfExtent(int axis) const;
+
+  float getAmplitude() const {
+    return A_;
+  }
+
+  float getCenter(int axis) const {
+    return center_[axis];
+  }
+
+  protected:
+  float A_;
+  std::array<float, 3> axes_;
+  std::array<float, 3> center_;
+  std::array<std::array<float, 3>, 3> rotation_; // from offsets to the ellipsoid's axes
 };
 
 std::vector<PhantomEllipse> shepp_logan_ellipses();
@@ -39,3 +121,49 @@ std::vector<PhantomEllipse> modified_shepp_logan_ellipses();
 mrd::ImageData<std::complex<float>> phantom(std::vector<PhantomEllipse>& coefficients, unsigned int matrix_size);
 mrd::ImageData<std::complex<float>> shepp_logan_phantom(unsigned int matrix_size);
 mrd::ImageData<std::complex<float>> generate_birdcage_sensitivities(unsigned int matrix_size, unsigned int ncoils, float relative_radius);
+
+std::vector<PhantomEllipsoid> shepp_logan_ellipsoids();
+std::vector<PhantomEllipsoid> modified_shepp_logan_ellipsoids();
+// Rasterizes ellipsoids into a matrix_size^3 volume (shape {1, z, y, x}), dividing slices among threads.
+mrd::ImageData<std::complex<float>> phantom_3d(std::vector<PhantomEllipsoid>& ellipsoids, unsigned int matrix_size, size_t threads);
+mrd::ImageData<std::complex<float>> shepp_logan_phantom_3d(unsigned int matrix_size, size_t threads);
+// Sensitivity at (x, y, z) in [-1, 1] of coil c of a birdcage whose coils are spread over rings along
+// z. The volume is too large to hold the sensitivities of all coils, so they are computed per voxel.
+// With a single ring, the slice z = 0 matches generate_birdcage_sensitivities.
+std::complex<float> birdcage_sensitivity_3d(float x, float y, float z, unsigned int c, unsigned int ncoils, unsigned int rings, float relative_radius);
+
+// Evaluates the k-space of an ellipse phantom seen through birdcage coils analytically, without
+// rasterizing the phantom or running FFTs. The Fourier transform of each ellipse is a Bessel (jinc)
+// function of the sample location. Coil sensitivities are approximated by their lowest spatial
+// frequencies (|m|, |n| <= coil_order, over the [-1, 1] field of view), so that the k-space of the
+// phantom times a sensitivity is a sum of shifted ellipse transforms. Samples can be at any location,
+// Cartesian or not.
+class AnalyticKspace {
+  public:
+  AnalyticKspace(std::vector<PhantomEllipse>& ellipses, unsigned int ncoils, float relative_radius, unsigned int coil_order = 5);
+
+  unsigned int getCoils() const {
+    return ncoils_;
+  }
+
+  // kx and ky are in cycles per unit of the phantom coordinates, where the phantom spans [-1, 1].
+  // Writes the value of coil c at sample i to out[c * count + i]. Safe to call from several threads.
+  void evaluate(const float* kx, const float* ky, size_t count, std::complex<float>* out) const;
+
+  protected:
+  struct Ellipse {
+    float scale; // amplitude * area of the unit disk transform
+    float a;
+    float b;
+    float cosp;
+    float sinp;
+    float x0;
+    float y0;
+  };
+
+  unsigned int ncoils_;
+  std::vector<Ellipse> ellipses_;
+  std::vector<float> qx_;
+  std::vector<float> qy_;
+  std::vector<std::complex<float>> coefficients_; // ncoils_ x terms
+};
@@ -0,0 +1,493 @@
+#include "stream_filter.h"
+#include <array>
+#include <cctype>
+#include <iostream>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace
+{
+    using FlagNames = std::vector<std::pair<const char *, uint64_t>>;
+
+    // The tables are built on first use, so that they never see uninitialized generated constants.
+    const FlagNames &acquisition_flags()
+    {
+        using mrd::AcquisitionFlags;
+        static const FlagNames flags = {
+            {"firstInEncodeStep1", static_cast<uint64_t>(AcquisitionFlags::kFirstInEncodeStep1)},
+            {"lastInEncodeStep1", static_cast<uint64_t>(AcquisitionFlags::kLastInEncodeStep1)},
+            {"firstInEncodeStep2", static_cast<uint64_t>(AcquisitionFlags::kFirstInEncodeStep2)},
+            {"lastInEncodeStep2", static_cast<uint64_t>(AcquisitionFlags::kLastInEncodeStep2)},
+            {"firstInAverage", static_cast<uint64_t>(AcquisitionFlags::kFirstInAverage)},
+            {"lastInAverage", static_cast<uint64_t>(AcquisitionFlags::kLastInAverage)},
+            {"firstInSlice", static_cast<uint64_t>(AcquisitionFlags::kFirstInSlice)},
+            {"lastInSlice", static_cast<uint64_t>(AcquisitionFlags::kLastInSlice)},
+            {"firstInContrast", static_cast<uint64_t>(AcquisitionFlags::kFirstInContrast)},
+            {"lastInContrast", static_cast<uint64_t>(AcquisitionFlags::kLastInContrast)},
+            {"firstInPhase", static_cast<uint64_t>(AcquisitionFlags::kFirstInPhase)},
+            {"lastInPhase", static_cast<uint64_t>(AcquisitionFlags::kLastInPhase)},
+            {"firstInRepetition", static_cast<uint64_t>(AcquisitionFlags::kFirstInRepetition)},
+            {"lastInRepetition", static_cast<uint64_t>(AcquisitionFlags::kLastInRepetition)},
+            {"firstInSet", static_cast<uint64_t>(AcquisitionFlags::kFirstInSet)},
+            {"lastInSet", static_cast<uint64_t>(AcquisitionFlags::kLastInSet)},
+            {"firstInSegment", static_cast<uint64_t>(AcquisitionFlags::kFirstInSegment)},
+            {"lastInSegment", static_cast<uint64_t>(AcquisitionFlags::kLastInSegment)},
+            {"isNoiseMeasurement", static_cast<uint64_t>(AcquisitionFlags::kIsNoiseMeasurement)},
+            {"isParallelCalibration", static_cast<uint64_t>(AcquisitionFlags::kIsParallelCalibration)},
+            {"isParallelCalibrationAndImaging", static_cast<uint64_t>(AcquisitionFlags::kIsParallelCalibrationAndImaging)},
+            {"isReverse", static_cast<uint64_t>(AcquisitionFlags::kIsReverse)},
+            {"isNavigationData", static_cast<uint64_t>(AcquisitionFlags::kIsNavigationData)},
+            {"isPhasecorrData", static_cast<uint64_t>(AcquisitionFlags::kIsPhasecorrData)},
+            {"lastInMeasurement", static_cast<uint64_t>(AcquisitionFlags::kLastInMeasurement)},
+            {"isHpfeedbackData", static_cast<uint64_t>(AcquisitionFlags::kIsHpfeedbackData)},
+            {"isDummyscanData", static_cast<uint64_t>(AcquisitionFlags::kIsDummyscanData)},
+            {"isRtfeedbackData", static_cast<uint64_t>(AcquisitionFlags::kIsRtfeedbackData)},
+            {"isSurfacecoilcorrectionscanData", static_cast<uint64_t>(AcquisitionFlags::kIsSurfacecoilcorrectionscanData)},
+            {"isPhaseStabilizationReference", static_cast<uint64_t>(AcquisitionFlags::kIsPhaseStabilizationReference)},
+            {"isPhaseStabilization", static_cast<uint64_t>(AcquisitionFlags::kIsPhaseStabilization)},
+        };
+        return flags;
+    }
+
+    const FlagNames &image_flags()
+    {
+        using mrd::ImageFlags;
+        static const FlagNames flags = {
+            {"isNavigationData", static_cast<uint64_t>(ImageFlags::kIsNavigationData)},
+            {"firstInAverage", static_cast<uint64_t>(ImageFlags::kFirstInAverage)},
+            {"lastInAverage", static_cast<uint64_t>(ImageFlags::kLastInAverage)},
+            {"firstInSlice", static_cast<uint64_t>(ImageFlags::kFirstInSlice)},
+            {"lastInSlice", static_cast<uint64_t>(ImageFlags::kLastInSlice)},
+            {"firstInContrast", static_cast<uint64_t>(ImageFlags::kFirstInContrast)},
+            {"lastInContrast", static_cast<uint64_t>(ImageFlags::kLastInContrast)},
+            {"firstInPhase", static_cast<uint64_t>(ImageFlags::kFirstInPhase)},
+            {"lastInPhase", static_cast<uint64_t>(ImageFlags::kLastInPhase)},
+            {"firstInRepetition", static_cast<uint64_t>(ImageFlags::kFirstInRepetition)},
+            {"lastInRepetition", static_cast<uint64_t>(ImageFlags::kLastInRepetition)},
+            {"firstInSet", static_cast<uint64_t>(ImageFlags::kFirstInSet)},
+            {"lastInSet", static_cast<uint64_t>(ImageFlags::kLastInSet)},
+        };
+        return flags;
+    }
+
+    // The name of a counter as in the model: kspace_encode_step_1 -> kspaceEncodeStep1
+    std::string model_counter_name(const std::string &name)
+    {
+        std::string model_name;
+        for (size_t i = 0; i < name.size(); i++)
+        {
+            if (name[i] == '_' && i + 1 < name.size())
+            {
+                model_name.push_back(static_cast<char>(std::toupper(static_cast<unsigned char>(name[++i]))));
+            }
+            else
+            {
+                model_name.push_back(name[i]);
+            }
+        }
+        return model_name;
+    }
+
+    constexpr uint32_t kFirstImageType = 2;
+
+    uint64_t find_flag(const FlagNames &flags, const std::string &name)
+    {
+        for (auto &[flag_name, value] : flags)
+        {
+            if (name == flag_name)
+            {
+                return value;
+            }
+        }
+        return 0;
+    }
+
+    enum class Comparison
+    {
+        kEqual,
+        kNotEqual,
+        kLess,
+        kLessEqual,
+        kGreater,
+        kGreaterEqual,
+    };
+}
+
+struct StreamFilter::Node
+{
+    enum class Kind
+    {
+        kConstant,
+        kFlag,
+        kType,
+        kCounter,
+        kNot,
+        kAnd,
+        kOr,
+    };
+
+    Kind kind = Kind::kConstant;
+    bool constant = false;
+
+    // kFlag
+    uint64_t acquisition_flag = 0;
+    uint64_t image_flag = 0;
+
+    // kType: inclusive range of mrd::StreamItem indices
+    uint32_t first_type = 0;
+    uint32_t last_type = 0;
+
+    // kCounter
+    size_t counter = 0;
+    Comparison comparison = Comparison::kEqual;
+    uint64_t value = 0;
+
+    std::unique_ptr<Node> left;
+    std::unique_ptr<Node> right;
+
+    bool Evaluate(const StreamIndexEntry &e) const
+    {
+        switch (kind)
+        {
+        case Kind::kConstant:
+            return constant;
+        case Kind::kFlag:
+            if (e.type_index == 0)
+            {
+                return e.flags & acquisition_flag;
+            }
+            return e.type_index >= kFirstImageType && (e.flags & image_flag);
+        case Kind::kType:
+            return e.type_index >= first_type && e.type_index <= last_type;
+        case Kind::kCounter:
+        {
+            auto c = e.counters[counter];
+            if (c == kNoCounter)
+            {
+                return false;
+            }
+            switch (comparison)
+            {
+            case Comparison::kEqual:
+                return c == value;
+            case Comparison::kNotEqual:
+                return c != value;
+            case Comparison::kLess:
+                return c < value;
+            case Comparison::kLessEqual:
+                return c <= value;
+            case Comparison::kGreater:
+                return c > value;
+            case Comparison::kGreaterEqual:
+                return c >= value;
+            }
+            return false;
+        }
+        case Kind::kNot:
+            return !left->Evaluate(e);
+        case Kind::kAnd:
+            return left->Evaluate(e) && right->Evaluate(e);
+        case Kind::kOr:
+            return left->Evaluate(e) || right->Evaluate(e);
+        }
+        return false;
+    }
+};
+
+namespace
+{
+    using Node = StreamFilter::Node;
+
+    class Parser
+    {
+    public:
+        explicit Parser(const std::string &expression)
+            : s_(expression)
+        {
+        }
+
+        std::unique_ptr<Node> Parse()
+        {
+            auto node = ParseOr();
+            SkipWhitespace();
+            if (pos_ != s_.size())
+            {
+                Fail("unexpected '" + s_.substr(pos_, 1) + "'");
+            }
+            return node;
+        }
+
+    private:
+        [[noreturn]] void Fail(const std::string &message) const
+        {
+            throw std::runtime_error("Invalid filter expression at position " + std::to_string(pos_) + ": " + message);
+        }
+
+        void SkipWhitespace()
+        {
+            while (pos_ < s_.size() && std::isspace(static_cast<unsigned char>(s_[pos_])))
+            {
+                pos_++;
+            }
+        }
+
+        bool Accept(const char *token)
+        {
+            SkipWhitespace();
+            std::string t(token);
+            if (s_.compare(pos_, t.size(), t) == 0)
+            {
+                pos_ += t.size();
+                return true;
+            }
+            return false;
+        }
+
+        // Identifiers may contain a template argument, as in Image<float>.
+        std::string Identifier()
+        {
+            SkipWhitespace();
+            auto start = pos_;
+            while (pos_ < s_.size() && (std::isalnum(static_cast<unsigned char>(s_[pos_])) || s_[pos_] == '_'))
+            {
+                pos_++;
+            }
+            if (s_.compare(start, pos_ - start, "Image") == 0 && pos_ < s_.size() && s_[pos_] == '<')
+            {
+                auto end = s_.find('>', pos_);
+                if (end == std::string::npos)
+                {
+                    Fail("missing '>'");
+                }
+                pos_ = end + 1;
+            }
+            return s_.substr(start, pos_ - start);
+        }
+
+        uint64_t Number()
+        {
+            SkipWhitespace();
+            auto start = pos_;
+            while (pos_ < s_.size() && std::isdigit(static_cast<unsigned char>(s_[pos_])))
+            {
+                pos_++;
+            }
+            if (start == pos_)
+            {
+                Fail("expected a number");
+            }
+            return std::stoull(s_.substr(start, pos_ - start));
+        }
+
+        std::unique_ptr<Node> Binary(Node::Kind kind, std::unique_ptr<Node> left, std::unique_ptr<Node> right)
+        {
+            auto node = std::make_unique<Node>();
+            node->kind = kind;
+            node->left = std::move(left);
+            node->right = std::move(right);
+            return node;
+        }
+
+        std::unique_ptr<Node> ParseOr()
+        {
+            auto node = ParseAnd();
+            while (Accept("||"))
+            {
+                node = Binary(Node::Kind::kOr, std::move(node), ParseAnd());
+            }
+            return node;
+        }
+
+        std::unique_ptr<Node> ParseAnd()
+        {
+            auto node = ParseUnary();
+            while (Accept("&&"))
+            {
+                node = Binary(Node::Kind::kAnd, std::move(node), ParseUnary());
+            }
+            return node;
+        }
+
+        std::unique_ptr<Node> ParseUnary()
+        {
+            if (Accept("!"))
+            {
+                return Binary(Node::Kind::kNot, ParseUnary(), nullptr);
+            }
+            return ParsePrimary();
+        }
+
+        Comparison ParseComparison()
+        {
+            // Two character operators first, so that "<=" is not read as "<".
+            if (Accept("=="))
+            {
+                return Comparison::kEqual;
+            }
+            if (Accept("!="))
+            {
+                return Comparison::kNotEqual;
+            }
+            if (Accept("<="))
+            {
+                return Comparison::kLessEqual;
+            }
+            if (Accept(">="))
+            {
+                return Comparison::kGreaterEqual;
+            }
+            if (Accept("<"))
+            {
+                return Comparison::kLess;
+            }
+            if (Accept(">"))
+            {
+                return Comparison::kGreater;
+            }
+            Fail("expected a comparison");
+        }
+
+        std::unique_ptr<Node> ParseType()
+        {
+            auto comparison = ParseComparison();
+            if (comparison != Comparison::kEqual && comparison != Comparison::kNotEqual)
+            {
+                Fail("types can only be compared with == and !=");
+            }
+
+            auto node = std::make_unique<Node>();
+            node->kind = Node::Kind::kType;
+            auto name = Identifier();
+            if (name == "Image")
+            {
+                node->first_type = kFirstImageType;
+                node->last_type = kStreamItemTypeNames.size() - 1;
+            }
+            else if (name == "Waveform")
+            {
+                node->first_type = node->last_type = 1;
+            }
+            else
+            {
+                bool found = false;
+                for (uint32_t i = 0; i < kStreamItemTypeNames.size(); i++)
+                {
+                    if (name == kStreamItemTypeNames[i])
+                    {
+                        node->first_type = node->last_type = i;
+                        found = true;
+                    }
+                }
+                if (!found)
+                {
+                    Fail("unknown item type '" + name + "'");
+                }
+            }
+
+            if (comparison == Comparison::kNotEqual)
+            {
+                return Binary(Node::Kind::kNot, std::move(node), nullptr);
+            }
+            return node;
+        }
+
+        std::unique_ptr<Node> ParsePrimary()
+        {
+            if (Accept("("))
+            {
+                auto node = ParseOr();
+                if (!Accept(")"))
+                {
+                    Fail("expected ')'");
+                }
+                return node;
+            }
+
+            auto name = Identifier();
+            if (name.empty())
+            {
+                Fail(pos_ < s_.size() ? "unexpected '" + s_.substr(pos_, 1) + "'" : "unexpected end of expression");
+            }
+
+            auto node = std::make_unique<Node>();
+            if (name == "true" || name == "false")
+            {
+                node->kind = Node::Kind::kConstant;
+                node->constant = name == "true";
+                return node;
+            }
+
+            if (name == "type")
+            {
+                return ParseType();
+            }
+
+            for (size_t i = 0; i < kIndexCounterCount; i++)
+            {
+                if (name == kIndexCounterNames[i] || name == model_counter_name(kIndexCounterNames[i]))
+                {
+                    node->kind = Node::Kind::kCounter;
+                    node->counter = i;
+                    node->comparison = ParseComparison();
+                    node->value = Number();
+                    return node;
+                }
+            }
+
+            node->kind = Node::Kind::kFlag;
+            node->acquisition_flag = find_flag(acquisition_flags(), name);
+            node->image_flag = find_flag(image_flags(), name);
+            if (!node->acquisition_flag && !node->image_flag)
+            {
+                pos_ -= name.size();
+                Fail("unknown name '" + name + "'");
+            }
+            return node;
+        }
+
+        const std::string &s_;
+        size_t pos_ = 0;
+    };
+}
+
+StreamFilter::StreamFilter(const std::string &expression)
+    : root_(Parser(expression).Parse())
+{
+}
+
+StreamFilter::~StreamFilter() = default;
+
+bool StreamFilter::Matches(const StreamIndexEntry &entry) const
+{
+    return root_->Evaluate(entry);
+}
+
+void print_stream_filter_names()
+{
+    std::cerr << "  Operators: ! && || ( ) and == != < <= > >= for counters" << std::endl;
+    std::cerr << "  Types (type == <name>): Acquisition Waveform Image";
+    for (uint32_t i = kFirstImageType; i < kStreamItemTypeNames.size(); i++)
+    {
+        std::cerr << " " << kStreamItemTypeNames[i];
+    }
+    std::cerr << std::endl
+              << "  Counters:";
+    for (auto name : kIndexCounterNames)
+    {
+        std::cerr << " " << name;
+    }
+    std::cerr << std::endl
+              << "  Acquisition flags:";
+    for (auto &[name, value] : acquisition_flags())
+    {
+        std::cerr << " " << name;
+    }
+    std::cerr << std::endl
+              << "  Image flags:";
+    for (auto &[name, value] : image_flags())
+    {
+        std::cerr << " " << name;
+    }
+    std::cerr << std::endl;
+}
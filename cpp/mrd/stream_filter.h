@@ -0,0 +1,34 @@
+#pragma once
+
+#include "stream_index.h"
+#include <memory>
+#include <string>
+
+// Boolean expressions over the item type, flags and encoding counters of stream items, e.g.
+//
+//   !isNoiseMeasurement && !isDummyscanData
+//   type == Acquisition && slice == 0 && (repetition >= 2 || firstInSlice)
+//
+// Flag names are those of mrd::AcquisitionFlags and mrd::ImageFlags, and are false for items whose
+// flags do not define them. Counters are the fields of mrd::EncodingCounters, named as in C++
+// (kspace_encode_step_1) or as in the model (kspaceEncodeStep1); comparisons with a counter that is
+// not set are false. Types are Acquisition, Waveform, Image or a specific image type such as
+// Image<float>. Expressions are evaluated on index entries, so items need not be decoded.
+
+class StreamFilter
+{
+public:
+    // Throws std::runtime_error if the expression is malformed.
+    explicit StreamFilter(const std::string &expression);
+    ~StreamFilter();
+
+    bool Matches(const StreamIndexEntry &entry) const;
+
+    struct Node;
+
+private:
+    std::unique_ptr<Node> root_;
+};
+
+// Prints the names that can be used in expressions.
+void print_stream_filter_names();
@@ -0,0 +1,353 @@
+#include "stream_index.h"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+const std::array<const char *, kIndexCounterCount> kIndexCounterNames = {
+    "kspace_encode_step_1",
+    "kspace_encode_step_2",
+    "average",
+    "slice",
+    "contrast",
+    "phase",
+    "repetition",
+    "set",
+    "segment",
+};
+
+const std::array<const char *, std::variant_size_v<mrd::StreamItem>> kStreamItemTypeNames = {
+    "Acquisition",
+    "Waveform<uint32>",
+    "Image<uint16>",
+    "Image<int16>",
+    "Image<uint>",
+    "Image<int>",
+    "Image<float>",
+    "Image<double>",
+    "Image<complexfloat>",
+    "Image<complexdouble>",
+};
+
+namespace
+{
+    constexpr char kIndexMagic[8] = {'M', 'R', 'D', 'I', 'N', 'D', 'E', 'X'};
+    constexpr uint32_t kIndexVersion = 2;
+
+    uint32_t counter_value(const std::optional<uint32_t> &c)
+    {
+        return c ? *c : kNoCounter;
+    }
+
+    void fill_entry(StreamIndexEntry &e, const mrd::Acquisition &a)
+    {
+        e.flags = a.flags.Value();
+        e.counters[kKspaceEncodeStep1] = counter_value(a.idx.kspace_encode_step_1);
+        e.counters[kKspaceEncodeStep2] = counter_value(a.idx.kspace_encode_step_2);
+        e.counters[kAverage] = counter_value(a.idx.average);
+        e.counters[kSlice] = counter_value(a.idx.slice);
+        e.counters[kContrast] = counter_value(a.idx.contrast);
+        e.counters[kPhase] = counter_value(a.idx.phase);
+        e.counters[kRepetition] = counter_value(a.idx.repetition);
+        e.counters[kSet] = counter_value(a.idx.set);
+        e.counters[kSegment] = counter_value(a.idx.segment);
+        e.time_stamp = counter_value(a.acquisition_time_stamp);
+    }
+
+    void fill_entry(StreamIndexEntry &e, const mrd::Waveform<uint32_t> &w)
+    {
+        e.flags = w.flags;
+        e.time_stamp = w.time_stamp;
+    }
+
+    template <typename T>
+    void fill_entry(StreamIndexEntry &e, const mrd::Image<T> &im)
+    {
+        e.flags = im.flags.Value();
+        e.counters[kAverage] = counter_value(im.average);
+        e.counters[kSlice] = counter_value(im.slice);
+        e.counters[kContrast] = counter_value(im.contrast);
+        e.counters[kPhase] = counter_value(im.phase);
+        e.counters[kRepetition] = counter_value(im.repetition);
+        e.counters[kSet] = counter_value(im.set);
+        e.time_stamp = counter_value(im.acquisition_time_stamp);
+    }
+
+    template <typename T>
+    void write_value(std::ostream &os, const T &value)
+    {
+        os.write(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    template <typename T>
+    void read_value(std::istream &is, T &value)
+    {
+        is.read(reinterpret_cast<char *>(&value), sizeof(value));
+    }
+
+    // Identifies the version of the data file an index was built from.
+    std::pair<uint64_t, int64_t> file_stamp(const std::filesystem::path &data_file)
+    {
+        return {std::filesystem::file_size(data_file), std::filesystem::last_write_time(data_file).time_since_epoch().count()};
+    }
+
+    // Parses a comma separated list of values and inclusive ranges, e.g. "1,3,10-20".
+    std::vector<std::pair<uint32_t, uint32_t>> parse_ranges(const std::string &s)
+    {
+        std::vector<std::pair<uint32_t, uint32_t>> ranges;
+        size_t start = 0;
+        while (start <= s.size())
+        {
+            auto end = s.find(',', start);
+            auto item = s.substr(start, end == std::string::npos ? std::string::npos : end - start);
+            auto dash = item.find('-');
+            try
+            {
+                size_t used_first = 0, used_last = 0;
+                uint32_t first = std::stoul(item.substr(0, dash), &used_first);
+                uint32_t last = dash == std::string::npos ? first : std::stoul(item.substr(dash + 1), &used_last);
+                if (used_first != item.substr(0, dash).size() || (dash != std::string::npos && used_last != item.size() - dash - 1) || last < first)
+                {
+                    throw std::invalid_argument(item);
+                }
+                ranges.emplace_back(first, last);
+            }
+            catch (const std::logic_error &)
+            {
+                throw std::runtime_error("Invalid range: " + s);
+            }
+
+            if (end == std::string::npos)
+            {
+                break;
+            }
+            start = end + 1;
+        }
+        return ranges;
+    }
+
+    // An empty list of ranges matches all values.
+    bool in_ranges(const std::vector<std::pair<uint32_t, uint32_t>> &ranges, uint64_t value)
+    {
+        if (ranges.empty())
+        {
+            return true;
+        }
+        for (auto &[first, last] : ranges)
+        {
+            if (value >= first && value <= last)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+}
+
+StreamIndexEntry make_index_entry(const mrd::StreamItem &item)
+{
+    StreamIndexEntry e;
+    e.type_index = static_cast<uint32_t>(item.index());
+    std::visit([&e](auto &&arg)
+               { fill_entry(e, arg); },
+               item);
+    return e;
+}
+
+std::filesystem::path index_path_for(const std::filesystem::path &data_file)
+{
+    return data_file.string() + ".mrdidx";
+}
+
+void write_stream_index(const std::filesystem::path &index_file, const std::filesystem::path &data_file, const StreamIndex &index)
+{
+    auto tmp_file = index_file.string() + ".tmp";
+    {
+        std::ofstream os(tmp_file, std::ios::binary);
+        os.write(kIndexMagic, sizeof(kIndexMagic));
+        write_value(os, kIndexVersion);
+        auto [size, mtime] = file_stamp(data_file);
+        write_value(os, size);
+        write_value(os, mtime);
+        write_value(os, index.header_size);
+        write_value(os, static_cast<uint64_t>(index.entries.size()));
+        for (auto &e : index.entries)
+        {
+            write_value(os, e.offset);
+            write_value(os, e.size);
+            write_value(os, e.type_index);
+            write_value(os, e.flags);
+            write_value(os, e.counters);
+            write_value(os, e.time_stamp);
+        }
+
+        if (!os)
+        {
+            throw std::runtime_error("Failed to write index " + tmp_file);
+        }
+    }
+    std::filesystem::rename(tmp_file, index_file);
+}
+
+std::optional<StreamIndex> read_stream_index(const std::filesystem::path &index_file, const std::filesystem::path &data_file)
+{
+    std::ifstream is(index_file, std::ios::binary);
+    if (!is)
+    {
+        return std::nullopt;
+    }
+
+    char magic[sizeof(kIndexMagic)];
+    uint32_t version;
+    uint64_t size, count;
+    int64_t mtime;
+    StreamIndex index;
+    is.read(magic, sizeof(magic));
+    read_value(is, version);
+    read_value(is, size);
+    read_value(is, mtime);
+    read_value(is, index.header_size);
+    read_value(is, count);
+    if (!is || !std::equal(magic, magic + sizeof(magic), kIndexMagic) || version != kIndexVersion ||
+        std::make_pair(size, mtime) != file_stamp(data_file))
+    {
+        return std::nullopt;
+    }
+
+    index.entries.resize(count);
+    for (auto &e : index.entries)
+    {
+        read_value(is, e.offset);
+        read_value(is, e.size);
+        read_value(is, e.type_index);
+        read_value(is, e.flags);
+        read_value(is, e.counters);
+        read_value(is, e.time_stamp);
+    }
+
+    if (!is)
+    {
+        return std::nullopt;
+    }
+
+    return index;
+}
+
+bool IndexSelection::ParseArg(std::vector<std::string>::iterator &arg, std::vector<std::string>::iterator end)
+{
+    if (arg->rfind("--", 0) != 0)
+    {
+        return false;
+    }
+
+    auto name = arg->substr(2);
+    for (auto &c : name)
+    {
+        c = c == '-' ? '_' : c;
+    }
+
+    std::vector<std::pair<uint32_t, uint32_t>> *counter_ranges = nullptr;
+    for (size_t i = 0; i < kIndexCounterCount; i++)
+    {
+        if (name == kIndexCounterNames[i])
+        {
+            counter_ranges = &ranges_[i];
+        }
+    }
+
+    if (name == "item")
+    {
+        counter_ranges = &items_;
+    }
+
+    if (!counter_ranges && name != "type")
+    {
+        return false;
+    }
+
+    if (arg + 1 == end)
+    {
+        throw std::runtime_error("Missing value for " + *arg);
+    }
+    auto value = *(arg + 1);
+
+    if (counter_ranges)
+    {
+        auto ranges = parse_ranges(value);
+        counter_ranges->insert(counter_ranges->end(), ranges.begin(), ranges.end());
+    }
+    else
+    {
+        bool found = false;
+        for (size_t i = 0; i < kStreamItemTypeNames.size(); i++)
+        {
+            if (value == kStreamItemTypeNames[i])
+            {
+                types_.push_back(i);
+                found = true;
+            }
+        }
+        if (!found)
+        {
+            throw std::runtime_error("Unknown item type: " + value);
+        }
+    }
+
+    arg += 2;
+    return true;
+}
+
+void IndexSelection::PrintUsage()
+{
+    std::cerr << "  Item selection (values are lists of numbers and ranges, e.g. 1,3,10-20):" << std::endl;
+    for (auto name : kIndexCounterNames)
+    {
+        std::string option = name;
+        for (auto &c : option)
+        {
+            c = c == '_' ? '-' : c;
+        }
+        std::cerr << "    --" << option << " <values>" << std::endl;
+    }
+    std::cerr << "    --item <values> (position of the item in the file)" << std::endl;
+    std::cerr << "    --type <item type, e.g. Acquisition or Image<float>>" << std::endl;
+}
+
+bool IndexSelection::Empty() const
+{
+    if (!types_.empty() || !items_.empty())
+    {
+        return false;
+    }
+    for (auto &r : ranges_)
+    {
+        if (!r.empty())
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool IndexSelection::Matches(const StreamIndexEntry &entry, size_t item) const
+{
+    if (!types_.empty() && std::find(types_.begin(), types_.end(), entry.type_index) == types_.end())
+    {
+        return false;
+    }
+
+    if (!in_ranges(items_, item))
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < kIndexCounterCount; i++)
+    {
+        if (!in_ranges(ranges_[i], entry.counters[i]))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "generated/types.h"
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <utility>
+#include <variant>
+#include <vector>
+
+// Index of the items in an MRD file: item type, flags, encoding counters and time stamp of each item,
+// and where to find it. Indexes are stored in sidecar files next to the data (<file>.mrdidx) and
+// record the size and modification time of the file they describe, so that stale indexes are ignored.
+
+constexpr uint32_t kNoCounter = 0xFFFFFFFF;
+
+enum IndexCounter
+{
+    kKspaceEncodeStep1,
+    kKspaceEncodeStep2,
+    kAverage,
+    kSlice,
+    kContrast,
+    kPhase,
+    kRepetition,
+    kSet,
+    kSegment,
+    kIndexCounterCount
+};
+
+// Counter names as used in mrd::EncodingCounters.
+extern const std::array<const char *, kIndexCounterCount> kIndexCounterNames;
+
+// Names of the mrd::StreamItem alternatives, in the order of the union.
+extern const std::array<const char *, std::variant_size_v<mrd::StreamItem>> kStreamItemTypeNames;
+
+struct StreamIndexEntry
+{
+    uint64_t offset = 0;     // Byte offset of the item in a binary stream, or item number in an HDF5 file
+    uint64_t size = 0;       // Size of the item in bytes in a binary stream, 0 for HDF5 files
+    uint32_t type_index = 0; // Index of the item type in mrd::StreamItem
+    uint64_t flags = 0;
+    std::array<uint32_t, kIndexCounterCount> counters; // kNoCounter where not set
+    uint32_t time_stamp = kNoCounter;
+
+    StreamIndexEntry()
+    {
+        counters.fill(kNoCounter);
+    }
+};
+
+struct StreamIndex
+{
+    // Size of the binary stream preamble (format header, schema and MRD header) preceding the items. 0 for HDF5 files.
+    uint64_t header_size = 0;
+    std::vector<StreamIndexEntry> entries;
+};
+
+// Returns the index entry for a decoded item. Offset and size are left at 0.
+StreamIndexEntry make_index_entry(const mrd::StreamItem &item);
+
+std::filesystem::path index_path_for(const std::filesystem::path &data_file);
+
+// Writes the index for data_file. The data file must be complete when this is called.
+void write_stream_index(const std::filesystem::path &index_file, const std::filesystem::path &data_file, const StreamIndex &index);
+
+// Reads the index for data_file. Returns std::nullopt if the index does not exist or does not match the data file.
+std::optional<StreamIndex> read_stream_index(const std::filesystem::path &index_file, const std::filesystem::path &data_file);
+
+// Selection of items by position, type and ranges of encoding counters.
+class IndexSelection
+{
+public:
+    // Parses a selection option such as "--slice 5", "--repetition 10-20", "--item 0-99" or "--type Acquisition"
+    // at *arg. Returns false if *arg is not a selection option. On success, arg is advanced past the option.
+    // Throws std::runtime_error for malformed values.
+    bool ParseArg(std::vector<std::string>::iterator &arg, std::vector<std::string>::iterator end);
+
+    static void PrintUsage();
+
+    bool Empty() const;
+    // item is the position of the entry in the index.
+    bool Matches(const StreamIndexEntry &entry, size_t item) const;
+
+private:
+    // Inclusive ranges; an item matches a counter if its value lies in any of them.
+    std::array<std::vector<std::pair<uint32_t, uint32_t>>, kIndexCounterCount> ranges_;
+    std::vector<std::pair<uint32_t, uint32_t>> items_;
+    std::vector<uint32_t> types_;
+};
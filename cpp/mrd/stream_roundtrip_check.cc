@@ -0,0 +1,267 @@
+#include "binary_stream_scanner.h"
+#include "check.h"
+#include "generated/binary/protocols.h"
+#include "mapped_stream_reader.h"
+#include "stream_index.h"
+#include <array>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+// Writes items of every mrd::StreamItem type with the generated binary writer and reads them back with
+// BinaryStreamScanner and MappedStreamReader, which decode the binary format without the generated
+// reader. If the model changes, this fails instead of the stream tools misreading streams.
+
+namespace
+{
+    using check::expect;
+
+    mrd::Header sample_header()
+    {
+        mrd::Header h;
+        h.version = 2;
+        h.experimental_conditions.h1resonance_frequency_hz = 63500000;
+        return h;
+    }
+
+    // An acquisition with every field set, including counters that need multi-byte varints.
+    mrd::Acquisition sample_acquisition()
+    {
+        mrd::Acquisition a;
+        a.flags = static_cast<uint64_t>(0x40 | 0x80 | 0x1000000);
+        a.idx.kspace_encode_step_1 = 300;
+        a.idx.kspace_encode_step_2 = 2;
+        a.idx.average = 1;
+        a.idx.slice = 4;
+        a.idx.contrast = 0;
+        a.idx.phase = 5;
+        a.idx.repetition = 70000;
+        a.idx.set = 1;
+        a.idx.segment = 2;
+        a.idx.user = {1, 200, 30000};
+        a.measurement_uid = 12345;
+        a.scan_counter = 99;
+        a.acquisition_time_stamp = 0xFFFFFFF0;
+        a.physiology_time_stamp = {10, 20, 30};
+        a.channel_order = {0, 1, 2, 3};
+        a.discard_pre = 3;
+        a.discard_post = 4;
+        a.center_sample = 64;
+        a.encoding_space_ref = 0;
+        a.sample_time_us = 2.5f;
+        a.position = {1.5f, -2.5f, 3.25f};
+        a.read_dir = {1, 0, 0};
+        a.phase_dir = {0, 1, 0};
+        a.slice_dir = {0, 0, 1};
+        a.patient_table_position = {0, 0, -100};
+        a.user_int = {-1, 0, 1 << 20};
+        a.user_float = {0.5f, -0.25f};
+
+        a.data.resize(std::array<size_t, 2>{4, 128});
+        for (size_t i = 0; i < a.data.size(); i++)
+        {
+            a.data.data()[i] = std::complex<float>(i * 0.5f, -static_cast<float>(i));
+        }
+        a.trajectory.resize(std::array<size_t, 2>{2, 128});
+        for (size_t i = 0; i < a.trajectory.size(); i++)
+        {
+            a.trajectory.data()[i] = i * 0.125f;
+        }
+        return a;
+    }
+
+    mrd::Waveform<uint32_t> sample_waveform()
+    {
+        mrd::Waveform<uint32_t> w;
+        w.flags = 1;
+        w.measurement_uid = 12345;
+        w.scan_counter = 100;
+        w.time_stamp = 400000;
+        w.sample_time_us = 2500;
+        w.waveform_id = 1;
+        w.data.resize(std::array<size_t, 2>{2, 16});
+        for (size_t i = 0; i < w.data.size(); i++)
+        {
+            w.data.data()[i] = static_cast<uint32_t>(i * 1000);
+        }
+        return w;
+    }
+
+    template <typename T>
+    mrd::Image<T> sample_image(uint32_t index)
+    {
+        mrd::Image<T> im;
+        im.flags = static_cast<uint64_t>(0x40 | 0x2000);
+        im.measurement_uid = 12345;
+        im.field_of_view = {256, 256, 5};
+        im.position = {0, 0, 10};
+        im.col_dir = {1, 0, 0};
+        im.line_dir = {0, 1, 0};
+        im.slice_dir = {0, 0, 1};
+        im.patient_table_position = {0, 0, -100};
+        im.average = 0;
+        im.slice = 4;
+        im.contrast = 1;
+        im.phase = 2;
+        im.repetition = 3;
+        im.set = 0;
+        im.acquisition_time_stamp = 1000 + index;
+        im.physiology_time_stamp = {1, 2, 3};
+        im.image_type = mrd::ImageType::kMagnitude;
+        im.image_index = index;
+        im.image_series_index = 7;
+        im.user_int = {-5};
+        im.user_float = {1.5f};
+        im.data.resize(std::array<size_t, 4>{1, 1, 8, 16});
+        for (size_t i = 0; i < im.data.size(); i++)
+        {
+            im.data.data()[i] = static_cast<T>(i % 100);
+        }
+        im.meta["WindowCenter"] = {"512"};
+        im.meta["ImageProcessingHistory"] = {"FFT", "COMBINE"};
+        return im;
+    }
+
+    // One item of each type, in the order of mrd::StreamItem, followed by an acquisition without
+    // any optional fields.
+    std::vector<mrd::StreamItem> sample_items()
+    {
+        std::vector<mrd::StreamItem> items;
+        items.push_back(sample_acquisition());
+        items.push_back(sample_waveform());
+        items.push_back(sample_image<uint16_t>(0));
+        items.push_back(sample_image<int16_t>(1));
+        items.push_back(sample_image<uint32_t>(2));
+        items.push_back(sample_image<int32_t>(3));
+        items.push_back(sample_image<float>(4));
+        items.push_back(sample_image<double>(5));
+        items.push_back(sample_image<std::complex<float>>(6));
+        items.push_back(sample_image<std::complex<double>>(7));
+        items.push_back(mrd::Acquisition());
+        return items;
+    }
+
+    // Writes the items one at a time and then again as one batch, so that the stream has blocks of
+    // one and of several items.
+    std::string write_stream(const mrd::Header &header, const std::vector<mrd::StreamItem> &items)
+    {
+        std::ostringstream os;
+        {
+            mrd::binary::MrdWriter w(os);
+            w.WriteHeader(header);
+            for (auto &item : items)
+            {
+                w.WriteData(item);
+            }
+            w.WriteData(items);
+            w.EndData();
+        }
+        return os.str();
+    }
+
+    void check_scanner(const std::string &stream, const mrd::Header &header, const std::vector<mrd::StreamItem> &items)
+    {
+        auto preamble = serialize_stream_preamble(header);
+        expect(stream.compare(0, preamble.size(), preamble) == 0, "serialize_stream_preamble matches the generated writer");
+
+        std::istringstream in(stream);
+        BinaryStreamScanner scanner(in);
+        expect(scanner.Header() == header, "scanner reads the header");
+        expect(scanner.HeaderSize() == preamble.size(), "scanner finds the end of the preamble");
+
+        StreamIndexEntry entry;
+        std::string bytes;
+        size_t n = 0;
+        while (scanner.Next(entry, &bytes))
+        {
+            if (n < items.size())
+            {
+                auto what = "scanned item " + std::to_string(n) + " (" + kStreamItemTypeNames[items[n].index()] + ")";
+                auto expected = make_index_entry(items[n]);
+                expect(entry.type_index == expected.type_index, what + ": type");
+                expect(entry.flags == expected.flags, what + ": flags");
+                expect(entry.counters == expected.counters, what + ": encoding counters");
+                expect(entry.time_stamp == expected.time_stamp, what + ": time stamp");
+                expect(bytes.size() == entry.size && stream.compare(entry.offset, entry.size, bytes) == 0,
+                       what + ": offset, size and bytes");
+            }
+            bytes.clear();
+            n++;
+        }
+        expect(n == items.size(), "scanner finds " + std::to_string(items.size()) + " items, found " + std::to_string(n));
+    }
+
+    void check_mapped_reader(const std::string &stream, const mrd::Header &header, const std::vector<mrd::StreamItem> &items)
+    {
+        auto path = std::filesystem::temp_directory_path() / ("stream_roundtrip_check." + std::to_string(getpid()) + ".bin");
+        {
+            std::ofstream os(path, std::ios::binary);
+            os << stream;
+        }
+
+        try
+        {
+            MappedStreamReader r(path.string());
+            expect(r.Header() == header, "mapped reader reads the header");
+
+            MappedStreamItem item;
+            size_t n = 0;
+            while (r.ReadData(item))
+            {
+                if (n < items.size())
+                {
+                    auto what = "mapped item " + std::to_string(n) + " (" + kStreamItemTypeNames[items[n].index()] + ")";
+                    if (auto view = std::get_if<AcquisitionView>(&item))
+                    {
+                        expect(items[n] == mrd::StreamItem(view->ToAcquisition()), what + " is read back unchanged");
+                    }
+                    else
+                    {
+                        expect(items[n] == std::get<mrd::StreamItem>(item), what + " is read back unchanged");
+                    }
+                }
+                n++;
+            }
+            expect(n == items.size(), "mapped reader reads " + std::to_string(items.size()) + " items, read " + std::to_string(n));
+        }
+        catch (const std::exception &e)
+        {
+            expect(false, std::string("mapped reader: ") + e.what());
+        }
+
+        std::error_code ec;
+        std::filesystem::remove(path, ec);
+    }
+}
+
+int main()
+{
+    auto header = sample_header();
+    auto items = sample_items();
+    auto stream = write_stream(header, items);
+
+    // The stream holds the items twice, see write_stream.
+    auto expected = items;
+    expected.insert(expected.end(), items.begin(), items.end());
+
+    try
+    {
+        check_scanner(stream, header, expected);
+    }
+    catch (const std::exception &e)
+    {
+        expect(false, std::string("scanner: ") + e.what());
+    }
+    check_mapped_reader(stream, header, expected);
+
+    if (check::failures > 0)
+    {
+        std::cerr << check::failures << " stream roundtrip checks failed" << std::endl;
+        return 1;
+    }
+    return 0;
+}
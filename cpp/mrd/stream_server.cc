@@ -0,0 +1,314 @@
+#include "stream_server.h"
+#include "fd_stream.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <netdb.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+namespace
+{
+    [[noreturn]] void fail(const std::string &message)
+    {
+        throw std::runtime_error(message + ": " + std::strerror(errno));
+    }
+
+    // Parses a number from 1 to max, or returns 0.
+    size_t parse_count(const std::string &arg, size_t max)
+    {
+        size_t n = 0;
+        auto [ptr, ec] = std::from_chars(arg.data(), arg.data() + arg.size(), n);
+        return ec == std::errc() && ptr == arg.data() + arg.size() && n <= max ? n : 0;
+    }
+
+    // Splits tcp:[<host>:]<port> into host and port.
+    std::pair<std::string, std::string> tcp_host_port(const std::string &address)
+    {
+        auto host_port = address.substr(4);
+        auto colon = host_port.rfind(':');
+        if (colon == std::string::npos)
+        {
+            return {"127.0.0.1", host_port};
+        }
+        return {host_port.substr(0, colon), host_port.substr(colon + 1)};
+    }
+
+    // Errors of accept that concern only the connection being accepted, or that pass once other
+    // connections have finished. Linux reports pending network errors of the new connection as well.
+    bool is_transient_accept_error(int error)
+    {
+        switch (error)
+        {
+        case EINTR:
+        case ECONNABORTED:
+        case EMFILE:
+        case ENFILE:
+        case ENOBUFS:
+        case ENOMEM:
+        case EPROTO:
+        case ENETDOWN:
+        case ENETUNREACH:
+        case EHOSTDOWN:
+        case EHOSTUNREACH:
+        case ENONET:
+        case ENOPROTOOPT:
+        case EOPNOTSUPP:
+        case ETIMEDOUT:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    int listen_unix(const std::string &path)
+    {
+        sockaddr_un addr{};
+        if (path.size() >= sizeof(addr.sun_path))
+        {
+            throw std::runtime_error("Socket path is too long: " + path);
+        }
+        addr.sun_family = AF_UNIX;
+        std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+        // A socket left behind by a server that was killed would make bind fail.
+        struct stat st;
+        if (stat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+        {
+            unlink(path.c_str());
+        }
+
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+        {
+            fail("Failed to create socket");
+        }
+        if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0)
+        {
+            fail("Failed to bind " + path);
+        }
+        return fd;
+    }
+
+    int listen_tcp(const std::string &host, const std::string &port)
+    {
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+        addrinfo *result = nullptr;
+        if (int error = getaddrinfo(host.c_str(), port.c_str(), &hints, &result); error != 0)
+        {
+            throw std::runtime_error("Failed to resolve " + host + ":" + port + ": " + gai_strerror(error));
+        }
+
+        int fd = socket(result->ai_family, result->ai_socktype | SOCK_CLOEXEC, result->ai_protocol);
+        if (fd < 0)
+        {
+            freeaddrinfo(result);
+            fail("Failed to create socket");
+        }
+
+        int reuse = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        int status = bind(fd, result->ai_addr, result->ai_addrlen);
+        freeaddrinfo(result);
+        if (status < 0)
+        {
+            fail("Failed to bind " + host + ":" + port);
+        }
+        return fd;
+    }
+
+    int listen_on(const std::string &address)
+    {
+        try
+        {
+            check_server_address(address);
+        }
+        catch (const std::invalid_argument &e)
+        {
+            throw std::runtime_error(e.what());
+        }
+
+        int fd;
+        if (address.rfind("unix:", 0) == 0)
+        {
+            fd = listen_unix(address.substr(5));
+        }
+        else
+        {
+            auto [host, port] = tcp_host_port(address);
+            fd = listen_tcp(host, port);
+        }
+
+        if (listen(fd, SOMAXCONN) < 0)
+        {
+            fail("Failed to listen on " + address);
+        }
+        return fd;
+    }
+
+    // Connections accepted but not yet picked up by a thread of the pool.
+    class ConnectionQueue
+    {
+    public:
+        void Push(int fd)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                fds_.push_back(fd);
+            }
+            changed_.notify_one();
+        }
+
+        // Returns -1 once the queue is closed and all connections have been picked up.
+        int Pop()
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            changed_.wait(lock, [this]
+                          { return closed_ || !fds_.empty(); });
+            if (fds_.empty())
+            {
+                return -1;
+            }
+            int fd = fds_.front();
+            fds_.pop_front();
+            return fd;
+        }
+
+        void Close()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                closed_ = true;
+            }
+            changed_.notify_all();
+        }
+
+    private:
+        std::mutex mutex_;
+        std::condition_variable changed_;
+        std::deque<int> fds_;
+        bool closed_ = false;
+    };
+
+    void serve(int fd, uint64_t id, size_t buffer_size, const StreamHandler &handler)
+    {
+        try
+        {
+            FdInputStream in(fd, buffer_size);
+            FdOutputStream out(fd, buffer_size);
+            handler(in, out);
+            out.flush();
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Connection " << id << " failed: " << e.what() << std::endl;
+        }
+        close(fd);
+    }
+}
+
+void run_stream_server(const std::string &address, size_t threads, size_t buffer_size, const StreamHandler &handler)
+{
+    // Clients that disconnect early fail their own connection instead of terminating the server.
+    std::signal(SIGPIPE, SIG_IGN);
+
+    int listen_fd = listen_on(address);
+    std::cerr << "Listening on " << address << " with " << threads << " threads" << std::endl;
+
+    ConnectionQueue queue;
+    std::atomic<uint64_t> next_id = 0;
+    std::vector<std::thread> pool;
+    for (size_t i = 0; i < std::max<size_t>(threads, 1); i++)
+    {
+        pool.emplace_back([&]
+                          {
+            for (int fd = queue.Pop(); fd >= 0; fd = queue.Pop())
+            {
+                serve(fd, next_id++, buffer_size, handler);
+            } });
+    }
+
+    while (true)
+    {
+        int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd >= 0)
+        {
+            queue.Push(fd);
+        }
+        else if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM)
+        {
+            // Wait for connections to finish and release their descriptors and memory.
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        else if (!is_transient_accept_error(errno))
+        {
+            break;
+        }
+    }
+
+    // Stop listening, but let the pool serve the connections already accepted.
+    std::string message = "Failed to accept connection on " + address + ": " + std::strerror(errno);
+    close(listen_fd);
+    queue.Close();
+    for (auto &thread : pool)
+    {
+        thread.join();
+    }
+    throw std::runtime_error(message);
+}
+
+void check_server_address(const std::string &address)
+{
+    if (address.rfind("unix:", 0) == 0)
+    {
+        if (address.size() == 5)
+        {
+            throw std::invalid_argument("Missing socket path in server address " + address);
+        }
+    }
+    else if (address.rfind("tcp:", 0) == 0)
+    {
+        auto port = tcp_host_port(address).second;
+        if (parse_count(port, 65535) == 0)
+        {
+            throw std::invalid_argument("Invalid port " + port + " in server address " + address + ", expected 1 to 65535");
+        }
+    }
+    else
+    {
+        throw std::invalid_argument("Invalid server address " + address + ", expected unix:<path> or tcp:[<host>:]<port>");
+    }
+}
+
+size_t parse_server_threads(const std::string &arg)
+{
+    size_t threads = parse_count(arg, kMaxServerThreads);
+    if (threads == 0)
+    {
+        throw std::invalid_argument("Invalid number of threads " + arg + ", expected 1 to " + std::to_string(kMaxServerThreads));
+    }
+    return threads;
+}
+
+void print_server_usage()
+{
+    std::cerr << "  -s|--server <unix:<path> or tcp:[<host>:]<port>> (serve each connection as a stream instead of stdin/stdout)" << std::endl;
+    std::cerr << "  -t|--threads <number of connections served at once> (default: number of cores)" << std::endl;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <istream>
+#include <ostream>
+#include <string>
+
+// Runs a stream tool as a persistent service on a local socket instead of once per pipeline.
+// Each connection carries one complete exchange: the client writes a stream to the socket, shuts down
+// its sending side (as nc -N or socat do), and reads the tool's output until the server closes the
+// connection. Reading and writing should overlap, since output may be sent before all input is read.
+// Connections are served concurrently by a fixed pool of threads, so state shared by the handler
+// (caches, FFT plans) is set up once per process rather than once per scan, and must be thread-safe.
+
+using StreamHandler = std::function<void(std::istream &in, std::ostream &out)>;
+
+// Largest number of connections served at once.
+constexpr size_t kMaxServerThreads = 1024;
+
+// Listens on address, which is unix:<path> or tcp:[<host>:]<port> (host defaults to 127.0.0.1),
+// and calls handler for every connection. Errors in a connection are printed and end only that
+// connection. Does not return; throws std::runtime_error if the socket cannot be set up, or if
+// accepting connections fails, after the connections already accepted have been served.
+[[noreturn]] void run_stream_server(const std::string &address, size_t threads, size_t buffer_size, const StreamHandler &handler);
+
+// Checks a --server argument. Throws std::invalid_argument unless it is unix:<path> or
+// tcp:[<host>:]<port> with a port from 1 to 65535.
+void check_server_address(const std::string &address);
+
+// Parses a --threads argument. Throws std::invalid_argument unless it is a number from 1 to kMaxServerThreads.
+size_t parse_server_threads(const std::string &arg);
+
+// Prints the usage of the server options, which tools parse as -s|--server and -t|--threads.
+void print_server_usage();
@@ -0,0 +1,296 @@
+#include "tee_output.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <stdexcept>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+    void write_all(int fd, const char *data, size_t size, const std::string &path)
+    {
+        while (size > 0)
+        {
+            auto written = ::write(fd, data, size);
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                throw std::runtime_error("Failed to write " + path + ": " + std::strerror(errno));
+            }
+            data += written;
+            size -= written;
+        }
+    }
+
+    void pwrite_all(int fd, const char *data, size_t size, uint64_t offset)
+    {
+        while (size > 0)
+        {
+            auto written = ::pwrite(fd, data, size, offset);
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                throw std::runtime_error(std::string("Failed to write spill file: ") + std::strerror(errno));
+            }
+            data += written;
+            size -= written;
+            offset += written;
+        }
+    }
+
+    void pread_all(int fd, char *data, size_t size, uint64_t offset)
+    {
+        while (size > 0)
+        {
+            auto n = ::pread(fd, data, size, offset);
+            if (n <= 0)
+            {
+                if (n < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                throw std::runtime_error(std::string("Failed to read spill file: ") + (n < 0 ? std::strerror(errno) : "unexpected end of file"));
+            }
+            data += n;
+            size -= n;
+            offset += n;
+        }
+    }
+}
+
+TeeOutput::TeeOutput(std::string path, size_t max_queued_bytes, LagPolicy policy, std::string spill_directory)
+    : path_(std::move(path)), max_queued_bytes_(max_queued_bytes), policy_(policy), spill_directory_(std::move(spill_directory))
+{
+    thread_ = std::thread(&TeeOutput::Run, this);
+}
+
+TeeOutput::~TeeOutput()
+{
+    if (thread_.joinable())
+    {
+        try
+        {
+            Close();
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << e.what() << std::endl;
+        }
+    }
+}
+
+void TeeOutput::Write(std::shared_ptr<const std::string> chunk, uint64_t items, bool required)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto fits = [&]
+    {
+        return queue_.empty() || queued_bytes_ + chunk->size() <= max_queued_bytes_;
+    };
+
+    if (failed_)
+    {
+        return;
+    }
+
+    if (policy_ == LagPolicy::kSpill && (!spilled_.empty() || !fits()))
+    {
+        try
+        {
+            Spill({std::move(chunk), items});
+        }
+        catch (...)
+        {
+            // Like a failed write, a failed spill (e.g. a full disk) ends this output only.
+            FailLocked(std::current_exception());
+        }
+        lock.unlock();
+        changed_.notify_all();
+        return;
+    }
+
+    if (policy_ == LagPolicy::kDrop && !required && !fits())
+    {
+        dropped_items_ += items;
+        return;
+    }
+
+    changed_.wait(lock, [&]
+                  { return failed_ || fits(); });
+    if (failed_)
+    {
+        return;
+    }
+
+    queued_bytes_ += chunk->size();
+    queue_.push_back({std::move(chunk), items});
+    lock.unlock();
+    changed_.notify_all();
+}
+
+void TeeOutput::Spill(const Chunk &chunk)
+{
+    if (spill_fd_ < 0)
+    {
+        std::string name = spill_directory_ + "/mrd_stream_tee.XXXXXX";
+        std::vector<char> name_template(name.begin(), name.end());
+        name_template.push_back('\0');
+        spill_fd_ = mkstemp(name_template.data());
+        if (spill_fd_ < 0)
+        {
+            throw std::runtime_error("Failed to create spill file in " + spill_directory_ + ": " + std::strerror(errno));
+        }
+
+        // The file is removed once the descriptor is closed, also if the process dies.
+        unlink(name_template.data());
+    }
+
+    pwrite_all(spill_fd_, chunk.bytes->data(), chunk.bytes->size(), spill_end_);
+    spilled_.push_back({spill_end_, chunk.bytes->size(), chunk.items});
+    spill_end_ += chunk.bytes->size();
+    spilled_bytes_ += chunk.bytes->size();
+}
+
+void TeeOutput::Close()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closing_ = true;
+    }
+    changed_.notify_all();
+    thread_.join();
+
+    if (spill_fd_ >= 0)
+    {
+        close(spill_fd_);
+        spill_fd_ = -1;
+    }
+
+    if (error_)
+    {
+        std::rethrow_exception(error_);
+    }
+}
+
+uint64_t TeeOutput::WrittenItems()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return written_items_;
+}
+
+uint64_t TeeOutput::DroppedItems()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return dropped_items_;
+}
+
+uint64_t TeeOutput::SpilledBytes()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return spilled_bytes_;
+}
+
+void TeeOutput::Fail(std::exception_ptr error)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        FailLocked(error);
+    }
+    changed_.notify_all();
+}
+
+void TeeOutput::FailLocked(std::exception_ptr error)
+{
+    if (!error_)
+    {
+        error_ = error;
+    }
+    failed_ = true;
+    queue_.clear();
+    queued_bytes_ = 0;
+    spilled_.clear();
+}
+
+void TeeOutput::Run()
+{
+    int fd = -1;
+    try
+    {
+        if (path_ == "-")
+        {
+            fd = STDOUT_FILENO;
+        }
+        else
+        {
+            fd = open(path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+            if (fd < 0)
+            {
+                throw std::runtime_error("Failed to open " + path_ + ": " + std::strerror(errno));
+            }
+        }
+
+        std::string buffer;
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true)
+        {
+            changed_.wait(lock, [this]
+                          { return closing_ || !queue_.empty() || !spilled_.empty(); });
+
+            // Queued chunks always precede spilled ones in the stream.
+            if (!queue_.empty())
+            {
+                auto chunk = std::move(queue_.front());
+                queue_.pop_front();
+                queued_bytes_ -= chunk.bytes->size();
+                lock.unlock();
+                changed_.notify_all();
+
+                write_all(fd, chunk.bytes->data(), chunk.bytes->size(), path_);
+                lock.lock();
+                written_items_ += chunk.items;
+            }
+            else if (!spilled_.empty())
+            {
+                auto spilled = spilled_.front();
+                spilled_.pop_front();
+                lock.unlock();
+
+                buffer.resize(spilled.size);
+                pread_all(spill_fd_, buffer.data(), spilled.size, spilled.offset);
+                write_all(fd, buffer.data(), buffer.size(), path_);
+                lock.lock();
+                written_items_ += spilled.items;
+
+                // Start over at the beginning of the spill file once the output has caught up.
+                if (spilled_.empty())
+                {
+                    if (ftruncate(spill_fd_, 0) < 0)
+                    {
+                        throw std::runtime_error(std::string("Failed to truncate spill file: ") + std::strerror(errno));
+                    }
+                    spill_end_ = 0;
+                }
+            }
+            else
+            {
+                break;
+            }
+        }
+    }
+    catch (...)
+    {
+        Fail(std::current_exception());
+    }
+
+    if (fd >= 0 && fd != STDOUT_FILENO)
+    {
+        close(fd);
+    }
+}
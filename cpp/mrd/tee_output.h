@@ -0,0 +1,104 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// What to do with the stream when an output cannot keep up and its queue is full.
+enum class LagPolicy
+{
+    // Wait for the output, which slows down the input and all other outputs.
+    kBlock,
+    // Drop whole blocks of items for this output only. The output still receives a valid stream.
+    kDrop,
+    // Queue further blocks in a temporary file, which the output catches up on later.
+    kSpill,
+};
+
+// One destination of a stream that is fanned out to several consumers. Chunks of the encoded stream are
+// queued in memory up to max_queued_bytes and written to the file or named pipe by a thread of its own,
+// so that a slow consumer only holds up the others if the policy is kBlock.
+// Chunks must each hold whole items of the stream, so that dropping them leaves a valid stream.
+
+class TeeOutput
+{
+public:
+    // A path of "-" writes to stdout. Named pipes are opened by the output thread, so a consumer that has
+    // not started yet does not hold up the others.
+    TeeOutput(std::string path, size_t max_queued_bytes, LagPolicy policy, std::string spill_directory);
+
+    // Closes the output if Close was not called, printing any error.
+    ~TeeOutput();
+
+    TeeOutput(const TeeOutput &) = delete;
+    TeeOutput &operator=(const TeeOutput &) = delete;
+
+    // Queues a chunk holding items items of the stream. Required chunks (the preamble and the end of the
+    // stream) are never dropped. Does nothing if the output has failed, e.g. because its reader went away.
+    // If a chunk cannot be spilled, the output fails; Close reports the error.
+    void Write(std::shared_ptr<const std::string> chunk, uint64_t items, bool required = false);
+
+    // Writes the remaining chunks and waits for the output thread.
+    // Throws std::runtime_error if writing the output failed.
+    void Close();
+
+    const std::string &Path() const
+    {
+        return path_;
+    }
+
+    uint64_t WrittenItems();
+    uint64_t DroppedItems();
+    uint64_t SpilledBytes();
+
+private:
+    struct Chunk
+    {
+        std::shared_ptr<const std::string> bytes;
+        uint64_t items;
+    };
+
+    struct SpilledChunk
+    {
+        uint64_t offset;
+        size_t size;
+        uint64_t items;
+    };
+
+    void Run();
+    // Throws std::runtime_error if the spill file cannot be created or written.
+    void Spill(const Chunk &chunk);
+    // Marks the output as failed with the first error and discards its queued chunks.
+    void Fail(std::exception_ptr error);
+    // Like Fail, with mutex_ held.
+    void FailLocked(std::exception_ptr error);
+
+    std::string path_;
+    size_t max_queued_bytes_;
+    LagPolicy policy_;
+    std::string spill_directory_;
+
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    std::deque<Chunk> queue_;
+    size_t queued_bytes_ = 0;
+
+    // Once a chunk has been spilled, later chunks are spilled too until the output has caught up,
+    // so that the order of the stream is kept.
+    int spill_fd_ = -1;
+    std::deque<SpilledChunk> spilled_;
+    uint64_t spill_end_ = 0;
+
+    uint64_t written_items_ = 0;
+    uint64_t dropped_items_ = 0;
+    uint64_t spilled_bytes_ = 0;
+    bool closing_ = false;
+    bool failed_ = false;
+    std::exception_ptr error_;
+    std::thread thread_;
+};